@@ -0,0 +1,457 @@
+#include "action.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+#include "log.h"
+#include "pool.h"
+
+#define BREAKER_FAILURES 5
+#define ACTION_SLAB 32
+#define BREAKER_COOLDOWN_MIN 1000
+#define BREAKER_COOLDOWN_MAX 60000
+
+struct _CtnActionQueue {
+    gchar* name;
+    GQueue actions;
+    GQueue parked;
+    GHashTable* counters;
+
+    CtnBreakerState state;
+    guint failures;
+    guint trips;
+    guint cooldown;
+    guint breaker_timer;
+    CtnAction* probe;
+};
+
+//one goes out per frame, they come from a pool and sit in the queues by
+//their own links
+struct _CtnAction {
+    GList link;        //in q->actions
+    GList parked_link; //in q->parked
+    CtnActionQueue* q;
+    GUPnPServiceProxy* proxy;
+    const gchar* name;
+    CtnActionPolicy policy;
+    CtnActionBegin begin;
+    CtnActionEnd end;
+    CtnActionDone done;
+    gpointer data;
+    CtnActionCounters* counters;
+
+    GUPnPServiceProxyAction* pending;
+    guint timer;
+    guint attempts;
+    gboolean parked;
+};
+
+static void action_start(CtnAction* a);
+
+static CtnPool*
+action_get_pool(void)
+{
+    static CtnPool* pool = NULL;
+
+    if( g_once_init_enter( &pool ) ) {
+        g_once_init_leave( &pool, ctn_pool_new( "actions", sizeof(CtnAction), ACTION_SLAB ) );
+    }
+    return pool;
+}
+
+const gchar*
+ctn_breaker_state_name(CtnBreakerState state)
+{
+    switch( state ) {
+        case CTN_BREAKER_CLOSED:
+            return "closed";
+        case CTN_BREAKER_OPEN:
+            return "open";
+        case CTN_BREAKER_HALF_OPEN:
+            return "half-open";
+    }
+    return "unknown";
+}
+
+//equal jitter, never less than half of ms
+static guint
+jitter(guint ms)
+{
+    if( ms < 2 ) {
+        return ms;
+    }
+    return ms / 2 + g_random_int_range( 0, ms / 2 + 1 );
+}
+
+static void
+action_free(CtnAction* a)
+{
+    g_queue_unlink( &a->q->actions, &a->link );
+    g_object_unref( a->proxy );
+    ctn_pool_release( action_get_pool(), a );
+}
+
+//stops whatever the action is waiting on, the GUPnP callback of a cancelled
+//attempt never runs
+static void
+action_stop(CtnAction* a)
+{
+    if( a->pending ) {
+        gupnp_service_proxy_cancel_action( a->proxy, a->pending );
+        a->pending = NULL;
+    }
+    if( a->timer ) {
+        g_source_remove( a->timer );
+        a->timer = 0;
+    }
+    if( a->parked ) {
+        g_queue_unlink( &a->q->parked, &a->parked_link );
+        a->parked = FALSE;
+    }
+    if( a->q->probe == a ) {
+        a->q->probe = NULL;
+    }
+}
+
+static void
+action_finish(
+        CtnAction* a,
+        GError* error)
+{
+    action_stop( a );
+    if( error && !g_error_matches( error, G_IO_ERROR, G_IO_ERROR_CANCELLED ) ) {
+        a->counters->failures++;
+    }
+    a->done( a->proxy, error, a->data );
+    action_free( a );
+}
+
+static void
+breaker_release(CtnActionQueue* q);
+
+static gboolean
+breaker_half_open(gpointer user_data)
+{
+    CtnActionQueue* q = user_data;
+
+    q->breaker_timer = 0;
+    q->state = CTN_BREAKER_HALF_OPEN;
+    ctn_info( CTN_LOG_UPNP, "%s breaker half-open", q->name );
+    breaker_release( q );
+    return FALSE;
+}
+
+//starts parked actions for as long as the breaker lets them through
+static void
+breaker_release(CtnActionQueue* q)
+{
+    GList* link;
+
+    while( ( q->state == CTN_BREAKER_CLOSED ||
+                ( q->state == CTN_BREAKER_HALF_OPEN && !q->probe ) ) &&
+            ( link = g_queue_pop_head_link( &q->parked ) ) ) {
+        CtnAction* a = link->data;
+        a->parked = FALSE;
+        action_start( a );
+    }
+}
+
+static void
+breaker_success(CtnActionQueue* q)
+{
+    q->failures = 0;
+    q->cooldown = 0;
+    if( q->state != CTN_BREAKER_CLOSED ) {
+        ctn_info( CTN_LOG_UPNP, "%s breaker closed", q->name );
+        q->state = CTN_BREAKER_CLOSED;
+        breaker_release( q );
+    }
+}
+
+static void
+breaker_failure(CtnActionQueue* q)
+{
+    guint wait;
+
+    q->failures++;
+    if( q->state == CTN_BREAKER_OPEN ||
+            ( q->state == CTN_BREAKER_CLOSED && q->failures < BREAKER_FAILURES ) ) {
+        return;
+    }
+
+    //a failed probe opens it again for twice as long
+    q->cooldown = q->cooldown ? MIN( q->cooldown * 2, BREAKER_COOLDOWN_MAX ) : BREAKER_COOLDOWN_MIN;
+    wait = jitter( q->cooldown );
+    q->state = CTN_BREAKER_OPEN;
+    q->trips++;
+    ctn_warning( CTN_LOG_UPNP, "%s breaker open for %ums after %u failures",
+            q->name, wait, q->failures );
+
+    if( q->breaker_timer ) {
+        g_source_remove( q->breaker_timer );
+    }
+    q->breaker_timer = g_timeout_add( wait, breaker_half_open, q );
+}
+
+static gboolean
+action_retry(gpointer user_data)
+{
+    CtnAction* a = user_data;
+
+    a->timer = 0;
+    a->counters->retries++;
+    action_start( a );
+    return FALSE;
+}
+
+guint
+ctn_action_backoff(const CtnActionPolicy* policy,
+        guint attempt)
+{
+    guint delay = policy->backoff_min;
+    guint i;
+
+    for( i=1; i<attempt && delay < policy->backoff_max; i++ ) {
+        delay *= 2;
+    }
+    return jitter( MIN( delay, policy->backoff_max ) );
+}
+
+static void
+action_failed(
+        CtnAction* a,
+        GError* error)
+{
+    guint delay;
+
+    breaker_failure( a->q );
+
+    if( a->policy.attempts && a->attempts >= a->policy.attempts ) {
+        action_finish( a, error );
+        return;
+    }
+
+    delay = ctn_action_backoff( &a->policy, a->attempts );
+
+    ctn_debug( CTN_LOG_UPNP, "%s %s attempt %u failed (%s), retry in %ums",
+            a->q->name, a->name, a->attempts, error->message, delay );
+    g_error_free( error );
+    error = NULL;
+
+    a->timer = g_timeout_add( delay, action_retry, a );
+}
+
+static void
+attempt_done(
+        GUPnPServiceProxy* proxy,
+        GUPnPServiceProxyAction* action,
+        gpointer user_data)
+{
+    CtnAction* a = user_data;
+    CtnActionQueue* q = a->q;
+    GError* error = NULL;
+
+    a->pending = NULL;
+    if( a->timer ) {
+        g_source_remove( a->timer );
+        a->timer = 0;
+    }
+    if( q->probe == a ) {
+        q->probe = NULL;
+    }
+
+    if( !a->end( proxy, action, a->data, &error ) ) {
+        if( !error ) {
+            error = g_error_new( G_IO_ERROR, G_IO_ERROR_FAILED, "%s failed", a->name );
+        }
+        action_failed( a, error );
+        return;
+    }
+
+    //finish first, the breaker may start parked actions
+    action_finish( a, NULL );
+    breaker_success( q );
+}
+
+static gboolean
+attempt_timeout(gpointer user_data)
+{
+    CtnAction* a = user_data;
+
+    a->timer = 0;
+    gupnp_service_proxy_cancel_action( a->proxy, a->pending );
+    a->pending = NULL;
+    if( a->q->probe == a ) {
+        a->q->probe = NULL;
+    }
+
+    a->counters->timeouts++;
+    action_failed( a, g_error_new( G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                "%s timed out after %ums", a->name, a->policy.timeout ) );
+    return FALSE;
+}
+
+static void
+action_start(CtnAction* a)
+{
+    CtnActionQueue* q = a->q;
+
+    if( q->state == CTN_BREAKER_OPEN || ( q->state == CTN_BREAKER_HALF_OPEN && q->probe ) ) {
+        a->parked = TRUE;
+        g_queue_push_tail_link( &q->parked, &a->parked_link );
+        return;
+    }
+
+    if( q->state == CTN_BREAKER_HALF_OPEN ) {
+        q->probe = a;
+    }
+
+    a->attempts++;
+    a->counters->attempts++;
+    if( a->policy.timeout ) {
+        a->timer = g_timeout_add( a->policy.timeout, attempt_timeout, a );
+    }
+    a->pending = a->begin( a->proxy, a->data, attempt_done, a );
+}
+
+static void
+queue_free(gpointer data)
+{
+    CtnActionQueue* q = data;
+
+    while( q->actions.head ) {
+        CtnAction* a = q->actions.head->data;
+        action_finish( a, g_error_new( G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                    "%s cancelled", a->name ) );
+    }
+
+    if( q->breaker_timer ) {
+        g_source_remove( q->breaker_timer );
+    }
+    g_hash_table_destroy( q->counters );
+    g_free( q->name );
+    g_slice_free( CtnActionQueue, q );
+}
+
+static void
+counters_free(gpointer data)
+{
+    g_slice_free( CtnActionCounters, data );
+}
+
+CtnActionQueue*
+ctn_action_queue_for_device(GUPnPDeviceProxy* device)
+{
+    CtnActionQueue* q = g_object_get_data( G_OBJECT(device), "ctn-action-queue" );
+
+    if( q ) {
+        return q;
+    }
+
+    q = g_slice_new0( CtnActionQueue );
+    q->name = g_strdup( gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(device) ) );
+    q->counters = g_hash_table_new_full( g_str_hash, g_str_equal, NULL, counters_free );
+    g_queue_init( &q->actions );
+    g_queue_init( &q->parked );
+    g_object_set_data_full( G_OBJECT(device), "ctn-action-queue", q, queue_free );
+    return q;
+}
+
+CtnAction*
+ctn_action_submit(CtnActionQueue* q,
+        GUPnPServiceProxy* proxy,
+        const gchar* name,
+        const CtnActionPolicy* policy,
+        CtnActionBegin begin,
+        CtnActionEnd end,
+        CtnActionDone done,
+        gpointer data)
+{
+    CtnAction* a = ctn_pool_alloc0( action_get_pool() );
+
+    a->link.data = a;
+    a->parked_link.data = a;
+    a->q = q;
+    a->proxy = g_object_ref( proxy );
+    a->name = name;
+    a->policy = *policy;
+    a->policy.backoff_min = MAX( a->policy.backoff_min, 1 );
+    a->policy.backoff_max = MAX( a->policy.backoff_max, a->policy.backoff_min );
+    a->begin = begin;
+    a->end = end;
+    a->done = done;
+    a->data = data;
+
+    a->counters = g_hash_table_lookup( q->counters, name );
+    if( !a->counters ) {
+        a->counters = g_slice_new0( CtnActionCounters );
+        g_hash_table_insert( q->counters, (gpointer)name, a->counters );
+    }
+
+    g_queue_push_head_link( &q->actions, &a->link );
+    action_start( a );
+    return a;
+}
+
+void
+ctn_action_cancel(CtnAction* a)
+{
+    CtnActionQueue* q = a->q;
+    gboolean probe = q->probe == a;
+
+    action_finish( a, g_error_new( G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                "%s cancelled", a->name ) );
+
+    //nobody is probing the device any more
+    if( probe ) {
+        breaker_release( q );
+    }
+}
+
+void
+ctn_action_cancel_proxy(CtnActionQueue* q,
+        GUPnPServiceProxy* proxy)
+{
+    GList* cancel = NULL;
+    GList* l;
+
+    //done callbacks may submit new actions, collect first
+    for( l=q->actions.head; l; l=l->next ) {
+        CtnAction* a = l->data;
+        if( a->proxy == proxy ) {
+            action_stop( a );
+            cancel = g_list_prepend( cancel, a );
+        }
+    }
+
+    for( l=cancel; l; l=l->next ) {
+        ctn_action_cancel( l->data );
+    }
+    g_list_free( cancel );
+
+    breaker_release( q );
+}
+
+void
+ctn_action_queue_get_stats(CtnActionQueue* q,
+        CtnActionQueueStats* stats)
+{
+    stats->state = q->state;
+    stats->consecutive_failures = q->failures;
+    stats->trips = q->trips;
+    stats->parked = g_queue_get_length( &q->parked );
+}
+
+void
+ctn_action_queue_get_counters(CtnActionQueue* q,
+        const gchar* name,
+        CtnActionCounters* counters)
+{
+    CtnActionCounters* c = g_hash_table_lookup( q->counters, name );
+
+    if( c ) {
+        *counters = *c;
+    } else {
+        memset( counters, 0, sizeof(*counters) );
+    }
+}
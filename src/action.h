@@ -0,0 +1,106 @@
+#ifndef ACTION_H
+#define ACTION_H
+
+#include <libgupnp/gupnp.h>
+
+G_BEGIN_DECLS
+
+/* Scheduler for the SOAP actions sent to one device. Every action gets a
+ * timeout per attempt and is retried with exponential backoff and jitter.
+ * Consecutive failures open a circuit breaker for the whole device: while
+ * it is open, attempts wait instead of going out. After a cooldown, a single
+ * probe is let through, and the breaker closes again when the probe
+ * succeeds. Everything runs on the main context. */
+
+typedef struct _CtnActionQueue CtnActionQueue;
+typedef struct _CtnAction CtnAction;
+
+typedef struct {
+    guint timeout;      //ms for one attempt
+    guint attempts;     //0 retries until cancelled
+    guint backoff_min;  //ms before the first retry
+    guint backoff_max;  //ms
+} CtnActionPolicy;
+
+typedef struct {
+    guint attempts;
+    guint retries;
+    guint timeouts;
+    guint failures;     //actions that gave up
+} CtnActionCounters;
+
+typedef enum {
+    CTN_BREAKER_CLOSED,
+    CTN_BREAKER_OPEN,
+    CTN_BREAKER_HALF_OPEN
+} CtnBreakerState;
+
+typedef struct {
+    CtnBreakerState state;
+    guint consecutive_failures;
+    guint trips;
+    guint parked;
+} CtnActionQueueStats;
+
+/* starts one attempt */
+typedef GUPnPServiceProxyAction* (*CtnActionBegin) (GUPnPServiceProxy *proxy,
+        gpointer data,
+        GUPnPServiceProxyActionCallback callback,
+        gpointer user_data);
+
+/* ends an attempt, FALSE with error set when it failed */
+typedef gboolean (*CtnActionEnd) (GUPnPServiceProxy *proxy,
+        GUPnPServiceProxyAction *action,
+        gpointer data,
+        GError **error);
+
+/* called exactly once, error is owned by the callee. Cancelled actions get
+ * G_IO_ERROR_CANCELLED. */
+typedef void (*CtnActionDone) (GUPnPServiceProxy *proxy,
+        GError *error,
+        gpointer data);
+
+/* one queue per device, freed along with the device proxy */
+CtnActionQueue*
+ctn_action_queue_for_device (GUPnPDeviceProxy *device);
+
+/* name must be a static string, it keys the counters */
+CtnAction*
+ctn_action_submit (CtnActionQueue *queue,
+        GUPnPServiceProxy *proxy,
+        const gchar *name,
+        const CtnActionPolicy *policy,
+        CtnActionBegin begin,
+        CtnActionEnd end,
+        CtnActionDone done,
+        gpointer data);
+
+void
+ctn_action_cancel (CtnAction *action);
+
+/* the wait before retry number attempt, counted from 1, with jitter */
+guint
+ctn_action_backoff (const CtnActionPolicy *policy,
+        guint attempt);
+
+/* cancels every action sent through proxy */
+void
+ctn_action_cancel_proxy (CtnActionQueue *queue,
+        GUPnPServiceProxy *proxy);
+
+void
+ctn_action_queue_get_stats (CtnActionQueue *queue,
+        CtnActionQueueStats *stats);
+
+/* zeroes when nothing of that name was submitted yet */
+void
+ctn_action_queue_get_counters (CtnActionQueue *queue,
+        const gchar *name,
+        CtnActionCounters *counters);
+
+const gchar*
+ctn_breaker_state_name (CtnBreakerState state);
+
+G_END_DECLS
+
+#endif
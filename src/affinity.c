@@ -0,0 +1,167 @@
+#include "affinity.h"
+
+#include <glib/gstdio.h>
+
+#include "log.h"
+
+#define AFFINITY_GROUP "pairings"
+
+struct _CtnAffinity {
+    gchar* path;
+    GHashTable* ports; //udn -> port
+    GHashTable* udns;  //port -> udn, both point at the strings in ports
+};
+
+static void
+affinity_remove(
+        CtnAffinity* a,
+        const gchar* udn)
+{
+    const gchar* port = g_hash_table_lookup( a->ports, udn );
+
+    if( port ) {
+        g_hash_table_remove( a->udns, port );
+        g_hash_table_remove( a->ports, udn );
+    }
+}
+
+static void
+affinity_insert(
+        CtnAffinity* a,
+        const gchar* udn,
+        const gchar* port)
+{
+    const gchar* owner = g_hash_table_lookup( a->udns, port );
+    gchar* u;
+    gchar* p;
+
+    if( owner && g_strcmp0( owner, udn ) != 0 ) {
+        affinity_remove( a, owner );
+    }
+    affinity_remove( a, udn );
+
+    u = g_strdup( udn );
+    p = g_strdup( port );
+    g_hash_table_insert( a->ports, u, p );
+    g_hash_table_insert( a->udns, p, u );
+}
+
+static void
+affinity_save(CtnAffinity* a)
+{
+    GKeyFile* key_file;
+    GHashTableIter iter;
+    gpointer udn, port;
+    gchar* data;
+    gchar* dir;
+    gsize len;
+    GError* error = NULL;
+
+    if( !a->path ) {
+        return;
+    }
+
+    key_file = g_key_file_new();
+    g_key_file_set_comment( key_file, NULL, NULL,
+            " mocur UDN = USB port path of its TA, written by ctntad", NULL );
+    g_hash_table_iter_init( &iter, a->ports );
+    while( g_hash_table_iter_next( &iter, &udn, &port ) ) {
+        g_key_file_set_string( key_file, AFFINITY_GROUP, udn, port );
+    }
+    data = g_key_file_to_data( key_file, &len, NULL );
+    g_key_file_free( key_file );
+
+    dir = g_path_get_dirname( a->path );
+    g_mkdir_with_parents( dir, 0755 );
+    g_free( dir );
+
+    if( !g_file_set_contents( a->path, data, len, &error ) ) {
+        ctn_warning( CTN_LOG_CORE, "failed to save pairings %s", error->message );
+        g_error_free( error );
+        error = NULL;
+    }
+    g_free( data );
+}
+
+CtnAffinity*
+ctn_affinity_load(const gchar* path)
+{
+    CtnAffinity* a = g_slice_new0( CtnAffinity );
+    GKeyFile* key_file;
+    gchar** udns;
+    GError* error = NULL;
+    int i;
+
+    a->path = g_strdup( path );
+    a->ports = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, g_free );
+    a->udns = g_hash_table_new( g_str_hash, g_str_equal );
+
+    if( !path ) {
+        return a;
+    }
+
+    key_file = g_key_file_new();
+    if( !g_key_file_load_from_file( key_file, path, G_KEY_FILE_NONE, &error ) ) {
+        if( !g_error_matches( error, G_FILE_ERROR, G_FILE_ERROR_NOENT ) ) {
+            ctn_warning( CTN_LOG_CORE, "ignoring pairings in %s: %s", path, error->message );
+        }
+        g_error_free( error );
+        error = NULL;
+        g_key_file_free( key_file );
+        return a;
+    }
+
+    udns = g_key_file_get_keys( key_file, AFFINITY_GROUP, NULL, NULL );
+    for( i=0; udns && udns[i]; i++ ) {
+        gchar* port = g_key_file_get_string( key_file, AFFINITY_GROUP, udns[i], NULL );
+        if( port && *port ) {
+            affinity_insert( a, udns[i], port );
+        }
+        g_free( port );
+    }
+    g_strfreev( udns );
+    g_key_file_free( key_file );
+
+    ctn_info( CTN_LOG_CORE, "loaded %u pairings from %s", g_hash_table_size( a->ports ), path );
+    return a;
+}
+
+void
+ctn_affinity_free(CtnAffinity* a)
+{
+    if( !a ) {
+        return;
+    }
+
+    g_hash_table_destroy( a->udns );
+    g_hash_table_destroy( a->ports );
+    g_free( a->path );
+    g_slice_free( CtnAffinity, a );
+}
+
+const gchar*
+ctn_affinity_lookup_port(CtnAffinity* a,
+        const gchar* udn)
+{
+    return g_hash_table_lookup( a->ports, udn );
+}
+
+const gchar*
+ctn_affinity_lookup_udn(CtnAffinity* a,
+        const gchar* port)
+{
+    return g_hash_table_lookup( a->udns, port );
+}
+
+void
+ctn_affinity_set(CtnAffinity* a,
+        const gchar* udn,
+        const gchar* port)
+{
+    if( g_strcmp0( ctn_affinity_lookup_port( a, udn ), port ) == 0 ) {
+        return;
+    }
+
+    affinity_insert( a, udn, port );
+    affinity_save( a );
+}
@@ -0,0 +1,37 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Which mocur UDN was last paired with the TA on which USB port, kept in a
+ * key file so pairings come back the same way after a restart. A port
+ * belongs to one UDN at a time. Main loop only. */
+typedef struct _CtnAffinity CtnAffinity;
+
+/* a missing or unreadable file starts an empty cache, NULL path keeps it
+ * in memory only */
+CtnAffinity*
+ctn_affinity_load (const gchar *path);
+
+void
+ctn_affinity_free (CtnAffinity *affinity);
+
+const gchar*
+ctn_affinity_lookup_port (CtnAffinity *affinity,
+        const gchar *udn);
+
+const gchar*
+ctn_affinity_lookup_udn (CtnAffinity *affinity,
+        const gchar *port);
+
+/* records the pairing, the file is rewritten when it changed */
+void
+ctn_affinity_set (CtnAffinity *affinity,
+        const gchar *udn,
+        const gchar *port);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,88 @@
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "base64.h"
+
+//frame sizes seen on the bridge, up to a full TA_BUFFER_SIZE read
+static const gsize sizes[] = { 64, 188, 1024, 4096, 16*1024 };
+
+#define BENCH_BYTES (64*1024*1024)
+
+static gdouble
+ns_per_call(
+        gint64 start,
+        guint iterations)
+{
+    return ( g_get_monotonic_time() - start ) * 1000.0 / iterations;
+}
+
+int main(int argc, char** argv)
+{
+    int s;
+
+    g_print("base64 implementation: %s\n", ctn_base64_impl());
+    g_print("%8s %12s %12s %12s %12s\n",
+            "bytes", "glib enc ns", "ctn enc ns", "glib dec ns", "ctn dec ns");
+
+    for( s=0; s<G_N_ELEMENTS(sizes); s++ ) {
+        gsize size = sizes[s];
+        guint iterations = MAX( BENCH_BYTES / size, 1000 );
+        guchar* data = g_malloc( size );
+        gchar* encoded = g_malloc( CTN_BASE64_ENCODED_SIZE(size) );
+        guchar* decoded = g_malloc( CTN_BASE64_DECODED_SIZE(CTN_BASE64_ENCODED_SIZE(size)) );
+        gchar* reference;
+        gdouble glib_enc, ctn_enc, glib_dec, ctn_dec;
+        gsize len;
+        gint64 start;
+        guint i;
+
+        for( i=0; i<size; i++ ) {
+            data[i] = g_random_int();
+        }
+
+        reference = g_base64_encode( data, size );
+        len = ctn_base64_encode( data, size, encoded );
+        if( strcmp( reference, encoded ) != 0 ||
+                ctn_base64_decode( encoded, len, decoded ) != size ||
+                memcmp( data, decoded, size ) != 0 ) {
+            g_printerr("output differs from glib for %" G_GSIZE_FORMAT " bytes\n", size);
+            return EXIT_FAILURE;
+        }
+
+        start = g_get_monotonic_time();
+        for( i=0; i<iterations; i++ ) {
+            g_free( g_base64_encode( data, size ) );
+        }
+        glib_enc = ns_per_call( start, iterations );
+
+        start = g_get_monotonic_time();
+        for( i=0; i<iterations; i++ ) {
+            ctn_base64_encode( data, size, encoded );
+        }
+        ctn_enc = ns_per_call( start, iterations );
+
+        start = g_get_monotonic_time();
+        for( i=0; i<iterations; i++ ) {
+            gsize out_len;
+            g_free( g_base64_decode( reference, &out_len ) );
+        }
+        glib_dec = ns_per_call( start, iterations );
+
+        start = g_get_monotonic_time();
+        for( i=0; i<iterations; i++ ) {
+            ctn_base64_decode( encoded, len, decoded );
+        }
+        ctn_dec = ns_per_call( start, iterations );
+
+        g_print("%8" G_GSIZE_FORMAT " %12.1f %12.1f %12.1f %12.1f\n",
+                size, glib_enc, ctn_enc, glib_dec, ctn_dec);
+
+        g_free( reference );
+        g_free( decoded );
+        g_free( encoded );
+        g_free( data );
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,380 @@
+#include "base64.h"
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+static const gchar encode_table[64] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+//0xff for anything outside the alphabet, 0xfe for the padding
+static const guchar decode_table[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xfe, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+static gsize
+encode_scalar(
+        const guchar* in,
+        gsize len,
+        gchar* out)
+{
+    gchar* o = out;
+    gsize i = 0;
+
+    for( ; i + 3 <= len; i += 3 ) {
+        guint32 v = ( in[i] << 16 ) | ( in[i+1] << 8 ) | in[i+2];
+        *o++ = encode_table[ ( v >> 18 ) & 0x3f ];
+        *o++ = encode_table[ ( v >> 12 ) & 0x3f ];
+        *o++ = encode_table[ ( v >> 6 ) & 0x3f ];
+        *o++ = encode_table[ v & 0x3f ];
+    }
+
+    if( len - i == 1 ) {
+        guint32 v = in[i] << 16;
+        *o++ = encode_table[ ( v >> 18 ) & 0x3f ];
+        *o++ = encode_table[ ( v >> 12 ) & 0x3f ];
+        *o++ = '=';
+        *o++ = '=';
+    } else if( len - i == 2 ) {
+        guint32 v = ( in[i] << 16 ) | ( in[i+1] << 8 );
+        *o++ = encode_table[ ( v >> 18 ) & 0x3f ];
+        *o++ = encode_table[ ( v >> 12 ) & 0x3f ];
+        *o++ = encode_table[ ( v >> 6 ) & 0x3f ];
+        *o++ = '=';
+    }
+
+    return o - out;
+}
+
+static gsize
+decode_scalar(
+        const gchar* in,
+        gsize len,
+        guchar* out)
+{
+    guchar* o = out;
+    guint32 v = 0;
+    guint n = 0;
+    gsize i;
+
+    for( i=0; i<len; i++ ) {
+        guchar c = decode_table[ (guchar)in[i] ];
+        if( c == 0xfe ) {
+            break;
+        }
+        if( c == 0xff ) {
+            continue;
+        }
+
+        v = ( v << 6 ) | c;
+        if( ++n == 4 ) {
+            *o++ = v >> 16;
+            *o++ = v >> 8;
+            *o++ = v;
+            v = 0;
+            n = 0;
+        }
+    }
+
+    if( n == 2 ) {
+        *o++ = v >> 4;
+    } else if( n == 3 ) {
+        *o++ = v >> 10;
+        *o++ = v >> 2;
+    }
+
+    return o - out;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* The vector paths follow Wojciech Muła's pshufb based codec, which
+ * needs SSSE3 at least, plain SSE2 has no byte shuffle. */
+
+__attribute__((target("ssse3")))
+static inline __m128i
+enc_reshuffle_128(
+        __m128i in)
+{
+    __m128i t0, t1, t2, t3;
+
+    in = _mm_shuffle_epi8( in, _mm_set_epi8(
+                10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1 ) );
+    t0 = _mm_and_si128( in, _mm_set1_epi32( 0x0fc0fc00 ) );
+    t1 = _mm_mulhi_epu16( t0, _mm_set1_epi32( 0x04000040 ) );
+    t2 = _mm_and_si128( in, _mm_set1_epi32( 0x003f03f0 ) );
+    t3 = _mm_mullo_epi16( t2, _mm_set1_epi32( 0x01000010 ) );
+    return _mm_or_si128( t1, t3 );
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i
+enc_translate_128(
+        __m128i in)
+{
+    const __m128i lut = _mm_setr_epi8(
+            'A', 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '+' - 62, '/' - 63, 0, 0 );
+    __m128i idx = _mm_subs_epu8( in, _mm_set1_epi8( 51 ) );
+    __m128i mask = _mm_cmpgt_epi8( in, _mm_set1_epi8( 25 ) );
+    idx = _mm_sub_epi8( idx, mask );
+    return _mm_add_epi8( in, _mm_shuffle_epi8( lut, idx ) );
+}
+
+__attribute__((target("ssse3")))
+static gsize
+encode_ssse3(
+        const guchar* in,
+        gsize len,
+        gchar* out)
+{
+    gsize i = 0;
+    gchar* o = out;
+
+    //16 byte loads of which 12 are used
+    for( ; len - i >= 16; i += 12, o += 16 ) {
+        __m128i v = _mm_loadu_si128( (const __m128i*)( in + i ) );
+        v = enc_translate_128( enc_reshuffle_128( v ) );
+        _mm_storeu_si128( (__m128i*)o, v );
+    }
+
+    return ( o - out ) + encode_scalar( in + i, len - i, o );
+}
+
+//lut_lo/lut_hi flag invalid characters, lut_roll maps ASCII to sextets
+__attribute__((target("ssse3")))
+static inline gboolean
+dec_translate_128(
+        __m128i in,
+        __m128i* out)
+{
+    const __m128i lut_lo = _mm_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a );
+    const __m128i lut_hi = _mm_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 );
+    const __m128i lut_roll = _mm_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0 );
+    const __m128i mask_0f = _mm_set1_epi8( 0x0f );
+
+    __m128i hi_nibbles = _mm_and_si128( _mm_srli_epi32( in, 4 ), mask_0f );
+    __m128i lo_nibbles = _mm_and_si128( in, mask_0f );
+    __m128i lo = _mm_shuffle_epi8( lut_lo, lo_nibbles );
+    __m128i hi = _mm_shuffle_epi8( lut_hi, hi_nibbles );
+
+    if( _mm_movemask_epi8( _mm_cmpgt_epi8( _mm_and_si128( lo, hi ), _mm_setzero_si128() ) ) ) {
+        return FALSE;
+    }
+
+    __m128i eq_2f = _mm_cmpeq_epi8( in, _mm_set1_epi8( '/' ) );
+    __m128i roll = _mm_shuffle_epi8( lut_roll, _mm_add_epi8( eq_2f, hi_nibbles ) );
+    *out = _mm_add_epi8( in, roll );
+    return TRUE;
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i
+dec_pack_128(
+        __m128i in)
+{
+    __m128i merged = _mm_maddubs_epi16( in, _mm_set1_epi32( 0x01400140 ) );
+    __m128i packed = _mm_madd_epi16( merged, _mm_set1_epi32( 0x00011000 ) );
+    return _mm_shuffle_epi8( packed, _mm_setr_epi8(
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1 ) );
+}
+
+__attribute__((target("ssse3")))
+static gsize
+decode_ssse3(
+        const gchar* in,
+        gsize len,
+        guchar* out)
+{
+    gsize i = 0;
+    guchar* o = out;
+
+    /* Each block writes 16 bytes of which 12 are valid. Stopping 24 bytes
+     * short of the end keeps that store inside out and leaves the padding
+     * to the scalar tail. The store never passes the input already read,
+     * so decoding in place is fine. */
+    for( ; len - i >= 24; i += 16, o += 12 ) {
+        __m128i v = _mm_loadu_si128( (const __m128i*)( in + i ) );
+        if( !dec_translate_128( v, &v ) ) {
+            break;
+        }
+        _mm_storeu_si128( (__m128i*)o, dec_pack_128( v ) );
+    }
+
+    return ( o - out ) + decode_scalar( in + i, len - i, o );
+}
+
+__attribute__((target("avx2")))
+static gsize
+encode_avx2(
+        const guchar* in,
+        gsize len,
+        gchar* out)
+{
+    const __m256i shuf = _mm256_set_epi8(
+            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1 );
+    const __m256i lut = _mm256_setr_epi8(
+            'A', 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '+' - 62, '/' - 63, 0, 0,
+            'A', 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '+' - 62, '/' - 63, 0, 0 );
+    gsize i = 0;
+    gchar* o = out;
+
+    //each lane takes 12 input bytes, the second lane loads at +12
+    for( ; len - i >= 32; i += 24, o += 32 ) {
+        __m256i v = _mm256_inserti128_si256(
+                _mm256_castsi128_si256( _mm_loadu_si128( (const __m128i*)( in + i ) ) ),
+                _mm_loadu_si128( (const __m128i*)( in + i + 12 ) ), 1 );
+        __m256i t0, t1, t2, t3, idx, mask;
+
+        v = _mm256_shuffle_epi8( v, shuf );
+        t0 = _mm256_and_si256( v, _mm256_set1_epi32( 0x0fc0fc00 ) );
+        t1 = _mm256_mulhi_epu16( t0, _mm256_set1_epi32( 0x04000040 ) );
+        t2 = _mm256_and_si256( v, _mm256_set1_epi32( 0x003f03f0 ) );
+        t3 = _mm256_mullo_epi16( t2, _mm256_set1_epi32( 0x01000010 ) );
+        v = _mm256_or_si256( t1, t3 );
+
+        idx = _mm256_subs_epu8( v, _mm256_set1_epi8( 51 ) );
+        mask = _mm256_cmpgt_epi8( v, _mm256_set1_epi8( 25 ) );
+        idx = _mm256_sub_epi8( idx, mask );
+        v = _mm256_add_epi8( v, _mm256_shuffle_epi8( lut, idx ) );
+
+        _mm256_storeu_si256( (__m256i*)o, v );
+    }
+
+    return ( o - out ) + encode_ssse3( in + i, len - i, o );
+}
+
+__attribute__((target("avx2")))
+static gsize
+decode_avx2(
+        const gchar* in,
+        gsize len,
+        guchar* out)
+{
+    const __m256i lut_lo = _mm256_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a );
+    const __m256i lut_hi = _mm256_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 );
+    const __m256i lut_roll = _mm256_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0 );
+    const __m256i pack = _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1 );
+    const __m256i mask_0f = _mm256_set1_epi8( 0x0f );
+    gsize i = 0;
+    guchar* o = out;
+
+    //32 byte stores with 24 valid, same reasoning as decode_ssse3
+    for( ; len - i >= 48; i += 32, o += 24 ) {
+        __m256i v = _mm256_loadu_si256( (const __m256i*)( in + i ) );
+        __m256i hi_nibbles = _mm256_and_si256( _mm256_srli_epi32( v, 4 ), mask_0f );
+        __m256i lo_nibbles = _mm256_and_si256( v, mask_0f );
+        __m256i lo = _mm256_shuffle_epi8( lut_lo, lo_nibbles );
+        __m256i hi = _mm256_shuffle_epi8( lut_hi, hi_nibbles );
+
+        if( !_mm256_testz_si256( lo, hi ) ) {
+            break;
+        }
+
+        __m256i eq_2f = _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '/' ) );
+        __m256i roll = _mm256_shuffle_epi8( lut_roll, _mm256_add_epi8( eq_2f, hi_nibbles ) );
+        v = _mm256_add_epi8( v, roll );
+
+        v = _mm256_maddubs_epi16( v, _mm256_set1_epi32( 0x01400140 ) );
+        v = _mm256_madd_epi16( v, _mm256_set1_epi32( 0x00011000 ) );
+        v = _mm256_shuffle_epi8( v, pack );
+        v = _mm256_permutevar8x32_epi32( v, _mm256_setr_epi32( 0, 1, 2, 4, 5, 6, 7, 7 ) );
+
+        _mm256_storeu_si256( (__m256i*)o, v );
+    }
+
+    return ( o - out ) + decode_ssse3( in + i, len - i, o );
+}
+
+#endif
+
+gsize
+ctn_base64_encode(
+        const guchar* in,
+        gsize len,
+        gchar* out)
+{
+    gsize n;
+
+#ifdef HAVE_X86_SIMD
+    if( __builtin_cpu_supports( "avx2" ) ) {
+        n = encode_avx2( in, len, out );
+    } else if( __builtin_cpu_supports( "ssse3" ) ) {
+        n = encode_ssse3( in, len, out );
+    } else
+#endif
+    {
+        n = encode_scalar( in, len, out );
+    }
+
+    out[n] = '\0';
+    return n;
+}
+
+gsize
+ctn_base64_decode(
+        const gchar* in,
+        gsize len,
+        guchar* out)
+{
+#ifdef HAVE_X86_SIMD
+    if( __builtin_cpu_supports( "avx2" ) ) {
+        return decode_avx2( in, len, out );
+    } else if( __builtin_cpu_supports( "ssse3" ) ) {
+        return decode_ssse3( in, len, out );
+    }
+#endif
+    return decode_scalar( in, len, out );
+}
+
+const gchar*
+ctn_base64_impl(void)
+{
+#ifdef HAVE_X86_SIMD
+    if( __builtin_cpu_supports( "avx2" ) ) {
+        return "avx2";
+    } else if( __builtin_cpu_supports( "ssse3" ) ) {
+        return "ssse3";
+    }
+#endif
+    return "scalar";
+}
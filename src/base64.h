@@ -0,0 +1,33 @@
+#ifndef BASE64_H
+#define BASE64_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Base64 into caller owned buffers, vectorized where the CPU allows.
+ * Output is identical to g_base64_encode, and ctn_base64_decode skips
+ * characters outside the alphabet like g_base64_decode does. */
+
+/* includes the terminating NUL */
+#define CTN_BASE64_ENCODED_SIZE(n) ((((n) + 2) / 3) * 4 + 1)
+#define CTN_BASE64_DECODED_SIZE(n) ((((n) + 3) / 4) * 3)
+
+/* writes a NUL terminated string, returns its length */
+gsize
+ctn_base64_encode (const guchar *in,
+        gsize len,
+        gchar *out);
+
+/* returns the number of bytes written, out may be the same buffer as in */
+gsize
+ctn_base64_decode (const gchar *in,
+        gsize len,
+        guchar *out);
+
+const gchar*
+ctn_base64_impl (void);
+
+G_END_DECLS
+
+#endif
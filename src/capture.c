@@ -0,0 +1,266 @@
+#include "capture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CAPTURE_CHUNK ( 4 * 1024 * 1024 )
+#define CAPTURE_FILE_HEADER 16
+
+#define ALIGN_UP(n) ( ( (n) + CTN_CAPTURE_ALIGN - 1 ) / CTN_CAPTURE_ALIGN * CTN_CAPTURE_ALIGN )
+
+G_STATIC_ASSERT( sizeof(CtnCaptureHeader) == CTN_CAPTURE_ALIGN );
+
+struct _CtnCapture {
+    GMutex lock;
+    int fd;
+    gint64 start;   //monotonic
+    guchar* window; //mapping of the chunk being filled
+    gsize window_size;
+    goffset window_offset;
+    gsize used;     //bytes of the window filled
+    gboolean failed;
+};
+
+struct _CtnCaptureReader {
+    guchar* data;
+    gsize size;
+    gsize offset;
+    gint64 start;
+};
+
+static void
+set_errno_error(
+        GError** error,
+        const gchar* what,
+        const gchar* path)
+{
+    int errsv = errno;
+    g_set_error( error, G_IO_ERROR, g_io_error_from_errno( errsv ),
+            "%s %s: %s", what, path, g_strerror( errsv ) );
+}
+
+//unmaps the current window and maps the next size bytes of the file,
+//size is a multiple of the chunk and so of the page size
+static gboolean
+capture_map(
+        CtnCapture* c,
+        gsize size)
+{
+    goffset offset = c->window_offset + c->window_size;
+
+    if( c->window ) {
+        munmap( c->window, c->window_size );
+        c->window = NULL;
+    }
+
+    if( ftruncate( c->fd, offset + size ) < 0 ) {
+        return FALSE;
+    }
+
+    c->window = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, offset );
+    if( c->window == MAP_FAILED ) {
+        c->window = NULL;
+        return FALSE;
+    }
+
+    c->window_offset = offset;
+    c->window_size = size;
+    c->used = 0;
+    return TRUE;
+}
+
+CtnCapture*
+ctn_capture_open(const gchar* path,
+        GError** error)
+{
+    CtnCapture* c;
+    gint64 start = g_get_real_time();
+    int fd;
+
+    //a new file rather than truncating, a daemon handing over may still
+    //have the old one mapped
+    unlink( path );
+    fd = open( path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600 );
+
+    if( fd < 0 ) {
+        set_errno_error( error, "failed to create", path );
+        return NULL;
+    }
+
+    c = g_slice_new0( CtnCapture );
+    g_mutex_init( &c->lock );
+    c->fd = fd;
+    c->start = g_get_monotonic_time();
+
+    if( !capture_map( c, CAPTURE_CHUNK ) ) {
+        set_errno_error( error, "failed to map", path );
+        ctn_capture_close( c );
+        return NULL;
+    }
+
+    memcpy( c->window, CTN_CAPTURE_MAGIC, 8 );
+    memcpy( c->window + 8, &start, sizeof(start) );
+    c->used = CAPTURE_FILE_HEADER;
+    return c;
+}
+
+void
+ctn_capture_close(CtnCapture* c)
+{
+    if( !c ) {
+        return;
+    }
+
+    if( c->window ) {
+        munmap( c->window, c->window_size );
+        //drop the unused tail of the last chunk
+        if( ftruncate( c->fd, c->window_offset + c->used ) < 0 ) {
+            g_printerr("failed to trim the capture: %s\n", g_strerror( errno ));
+        }
+    }
+    close( c->fd );
+    g_mutex_clear( &c->lock );
+    g_slice_free( CtnCapture, c );
+}
+
+gboolean
+ctn_capture_write(CtnCapture* c,
+        guint16 pair,
+        CtnCaptureType type,
+        gconstpointer data,
+        gsize len)
+{
+    CtnCaptureHeader header;
+    gsize size = sizeof(header) + ALIGN_UP( len );
+
+    header.length = len;
+    header.pair = pair;
+    header.type = type;
+    header.reserved = 0;
+
+    g_mutex_lock( &c->lock );
+    if( c->failed ) {
+        g_mutex_unlock( &c->lock );
+        return FALSE;
+    }
+
+    header.time = g_get_monotonic_time() - c->start;
+
+    if( c->used + size > c->window_size ) {
+        //the remainder is a multiple of the alignment, so a header fits
+        if( c->used < c->window_size ) {
+            CtnCaptureHeader pad = { c->window_size - c->used - sizeof(pad), 0, CTN_CAPTURE_PAD, 0, header.time };
+            memcpy( c->window + c->used, &pad, sizeof(pad) );
+            c->used = c->window_size;
+        }
+        if( !capture_map( c, MAX( CAPTURE_CHUNK, ( size + CAPTURE_CHUNK - 1 ) / CAPTURE_CHUNK * CAPTURE_CHUNK ) ) ) {
+            c->failed = TRUE;
+            g_mutex_unlock( &c->lock );
+            return FALSE;
+        }
+    }
+
+    //padding bytes are still zero from ftruncate
+    memcpy( c->window + c->used, &header, sizeof(header) );
+    memcpy( c->window + c->used + sizeof(header), data, len );
+    c->used += size;
+
+    g_mutex_unlock( &c->lock );
+    return TRUE;
+}
+
+CtnCaptureReader*
+ctn_capture_reader_open(const gchar* path,
+        GError** error)
+{
+    CtnCaptureReader* r;
+    struct stat st;
+    void* data;
+    int fd = open( path, O_RDONLY | O_CLOEXEC );
+
+    if( fd < 0 ) {
+        set_errno_error( error, "failed to open", path );
+        return NULL;
+    }
+
+    if( fstat( fd, &st ) < 0 ) {
+        set_errno_error( error, "failed to stat", path );
+        close( fd );
+        return NULL;
+    }
+
+    if( st.st_size < CAPTURE_FILE_HEADER ) {
+        g_set_error( error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                "%s is too short for a capture", path );
+        close( fd );
+        return NULL;
+    }
+
+    data = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if( data == MAP_FAILED ) {
+        set_errno_error( error, "failed to map", path );
+        return NULL;
+    }
+
+    if( memcmp( data, CTN_CAPTURE_MAGIC, 8 ) != 0 ) {
+        g_set_error( error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                "%s is not a ctntad capture", path );
+        munmap( data, st.st_size );
+        return NULL;
+    }
+
+    r = g_slice_new0( CtnCaptureReader );
+    r->data = data;
+    r->size = st.st_size;
+    r->offset = CAPTURE_FILE_HEADER;
+    memcpy( &r->start, r->data + 8, sizeof(r->start) );
+    return r;
+}
+
+void
+ctn_capture_reader_free(CtnCaptureReader* r)
+{
+    if( !r ) {
+        return;
+    }
+
+    munmap( r->data, r->size );
+    g_slice_free( CtnCaptureReader, r );
+}
+
+gint64
+ctn_capture_reader_get_start(CtnCaptureReader* r)
+{
+    return r->start;
+}
+
+gboolean
+ctn_capture_reader_next(CtnCaptureReader* r,
+        CtnCaptureHeader* header,
+        const guchar** data)
+{
+    while( r->offset + sizeof(*header) <= r->size ) {
+        gsize size;
+
+        memcpy( header, r->data + r->offset, sizeof(*header) );
+        size = sizeof(*header) + ALIGN_UP( (gsize)header->length );
+
+        //zeros past the last record of a capture that wasn't closed
+        if( header->type == 0 || r->offset + size > r->size ) {
+            return FALSE;
+        }
+
+        *data = r->data + r->offset + sizeof(*header);
+        r->offset += size;
+        if( header->type != CTN_CAPTURE_PAD ) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
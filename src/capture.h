@@ -0,0 +1,75 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Append-only binary log of bridged frames, written through a shared
+ * mapping so a frame costs a memcpy and nothing is lost if the daemon
+ * dies. The file is a 16 byte header, "CTNCAP" 0 1 and the start time in
+ * wall clock microseconds, followed by records of a 16 byte
+ * CtnCaptureHeader and its payload, each aligned to 16 bytes. The file
+ * grows in chunks, a record that would straddle one is preceded by a
+ * CTN_CAPTURE_PAD record filling up the rest. After a crash the file
+ * ends in zeros, which readers take as the end. Little endian. */
+
+#define CTN_CAPTURE_MAGIC "CTNCAP\0\1"
+#define CTN_CAPTURE_ALIGN 16
+
+typedef enum {
+    CTN_CAPTURE_TA_TO_MOCUR = 1, //raw bytes of a TA read
+    CTN_CAPTURE_MOCUR_TO_TA = 2, //decoded UDCPMessage as written to the TA
+    CTN_CAPTURE_PAIRED = 3,      //mocur UDN, a NUL, the TA port path
+    CTN_CAPTURE_PAD = 4,
+} CtnCaptureType;
+
+typedef struct {
+    guint32 length; //payload bytes, without the header and alignment
+    guint16 pair;   //numbered from 0 in pairing order
+    guint8 type;
+    guint8 reserved;
+    gint64 time;    //monotonic microseconds since the capture started
+} CtnCaptureHeader;
+
+typedef struct _CtnCapture CtnCapture;
+
+CtnCapture*
+ctn_capture_open (const gchar *path,
+        GError **error);
+
+/* trims the file to what was written */
+void
+ctn_capture_close (CtnCapture *capture);
+
+/* from any thread, FALSE once the capture failed and stopped recording */
+gboolean
+ctn_capture_write (CtnCapture *capture,
+        guint16 pair,
+        CtnCaptureType type,
+        gconstpointer data,
+        gsize len);
+
+typedef struct _CtnCaptureReader CtnCaptureReader;
+
+CtnCaptureReader*
+ctn_capture_reader_open (const gchar *path,
+        GError **error);
+
+void
+ctn_capture_reader_free (CtnCaptureReader *reader);
+
+/* wall clock start of the capture */
+gint64
+ctn_capture_reader_get_start (CtnCaptureReader *reader);
+
+/* the next record other than padding, data points into the mapping and
+ * is valid until the reader is freed. FALSE at the end. */
+gboolean
+ctn_capture_reader_next (CtnCaptureReader *reader,
+        CtnCaptureHeader *header,
+        const guchar **data);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,257 @@
+#include "classify.h"
+
+#include <stdlib.h>
+
+#define CLASSIFY_FORMAT_GROUP "format"
+#define CLASSIFY_TYPES_GROUP "types"
+#define CLASSIFY_PRIORITY_GROUP "priority"
+
+struct _CtnClassifier {
+    gsize tag_offset;
+    gchar* names[256];
+    gboolean urgent[256];
+};
+
+static gboolean
+parse_type(
+        const gchar* s,
+        guint8* type)
+{
+    gchar* end;
+    gulong value = strtoul( s, &end, 0 );
+
+    if( *end || end == s || value > 255 ) {
+        return FALSE;
+    }
+    *type = value;
+    return TRUE;
+}
+
+CtnClassifier*
+ctn_classifier_load(const gchar* path,
+        GError** error)
+{
+    CtnClassifier* c;
+    GKeyFile* key_file;
+    gchar** keys;
+    GError* local = NULL;
+    gint offset;
+    int i;
+
+    key_file = g_key_file_new();
+    if( path && !g_key_file_load_from_file( key_file, path, G_KEY_FILE_NONE, error ) ) {
+        g_key_file_free( key_file );
+        return NULL;
+    }
+
+    c = g_slice_new0( CtnClassifier );
+
+    offset = g_key_file_get_integer( key_file, CLASSIFY_FORMAT_GROUP, "tag-offset", &local );
+    if( local ) {
+        g_error_free( local );
+        local = NULL;
+    } else {
+        c->tag_offset = MAX( offset, 0 );
+    }
+
+    keys = g_key_file_get_keys( key_file, CLASSIFY_TYPES_GROUP, NULL, NULL );
+    for( i=0; keys && keys[i]; i++ ) {
+        guint8 type;
+        if( !parse_type( keys[i], &type ) ) {
+            g_set_error( error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                    "%s: message type %s is not a byte", path, keys[i] );
+            g_strfreev( keys );
+            g_key_file_free( key_file );
+            ctn_classifier_free( c );
+            return NULL;
+        }
+        g_free( c->names[type] );
+        c->names[type] = g_key_file_get_string( key_file, CLASSIFY_TYPES_GROUP, keys[i], NULL );
+    }
+    g_strfreev( keys );
+
+    keys = g_key_file_get_string_list( key_file, CLASSIFY_PRIORITY_GROUP, "urgent", NULL, NULL );
+    for( i=0; keys && keys[i]; i++ ) {
+        guint8 type;
+        if( !parse_type( g_strstrip( keys[i] ), &type ) ) {
+            g_set_error( error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                    "%s: urgent type %s is not a byte", path, keys[i] );
+            g_strfreev( keys );
+            g_key_file_free( key_file );
+            ctn_classifier_free( c );
+            return NULL;
+        }
+        c->urgent[type] = TRUE;
+    }
+    g_strfreev( keys );
+    g_key_file_free( key_file );
+
+    for( i=0; i<256; i++ ) {
+        if( !c->names[i] || !*c->names[i] ) {
+            g_free( c->names[i] );
+            c->names[i] = g_strdup_printf( "0x%02x", i );
+        }
+    }
+    return c;
+}
+
+void
+ctn_classifier_free(CtnClassifier* c)
+{
+    int i;
+
+    if( !c ) {
+        return;
+    }
+
+    for( i=0; i<256; i++ ) {
+        g_free( c->names[i] );
+    }
+    g_slice_free( CtnClassifier, c );
+}
+
+const gchar*
+ctn_classifier_get_name(const CtnClassifier* c,
+        guint8 type)
+{
+    return c->names[type];
+}
+
+CtnLane
+ctn_classifier_get_lane(const CtnClassifier* c,
+        const guchar* frame,
+        gsize len)
+{
+    if( len <= c->tag_offset ) {
+        return CTN_LANE_NORMAL;
+    }
+    return c->urgent[frame[c->tag_offset]] ? CTN_LANE_URGENT : CTN_LANE_NORMAL;
+}
+
+CtnMessageStats*
+ctn_message_stats_new(const CtnClassifier* classifier)
+{
+    CtnMessageStats* s = g_new0( CtnMessageStats, 1 );
+    s->classifier = classifier;
+    return s;
+}
+
+void
+ctn_message_stats_free(CtnMessageStats* s)
+{
+    int d, t;
+
+    if( !s ) {
+        return;
+    }
+
+    for( d=0; d<CTN_DIRECTIONS; d++ ) {
+        for( t=0; t<256; t++ ) {
+            g_free( s->types[d][t] );
+        }
+    }
+    g_free( s );
+}
+
+static CtnMessageTypeStats*
+type_stats(
+        CtnMessageStats* s,
+        CtnDirection direction,
+        guint8 type)
+{
+    CtnMessageTypeStats* ts = s->types[direction][type];
+
+    if( !ts ) {
+        //published zeroed, readers see it empty rather than half set up
+        ts = g_new0( CtnMessageTypeStats, 1 );
+        g_atomic_pointer_set( &s->types[direction][type], ts );
+    }
+    return ts;
+}
+
+void
+ctn_message_stats_record(CtnMessageStats* s,
+        CtnDirection direction,
+        const guchar* frame,
+        gsize len,
+        gint64 now)
+{
+    CtnDirection other = direction == CTN_DIRECTION_UPSTREAM ?
+        CTN_DIRECTION_DOWNSTREAM : CTN_DIRECTION_UPSTREAM;
+    CtnMessageTypeStats* ts;
+    guint8 type;
+
+    if( len <= s->classifier->tag_offset ) {
+        s->untagged++;
+        return;
+    }
+
+    type = frame[s->classifier->tag_offset];
+    ts = type_stats( s, direction, type );
+    ts->frames++;
+    ts->bytes += len;
+
+    if( s->waiting[other] ) {
+        CtnMessageTypeStats* request = type_stats( s, other, s->waiting_type[other] );
+        ctn_histogram_record( &request->reply, MAX( now - s->waiting_since[other], 0 ) );
+        s->waiting[other] = FALSE;
+    } else if( !s->waiting[direction] ) {
+        s->waiting[direction] = TRUE;
+        s->waiting_type[direction] = type;
+        s->waiting_since[direction] = now;
+    }
+}
+
+void
+ctn_message_stats_forget(CtnMessageStats* s)
+{
+    int d;
+    for( d=0; d<CTN_DIRECTIONS; d++ ) {
+        s->waiting[d] = FALSE;
+    }
+}
+
+const CtnMessageTypeStats*
+ctn_message_stats_get(const CtnMessageStats* s,
+        CtnDirection direction,
+        guint8 type)
+{
+    return g_atomic_pointer_get( &s->types[direction][type] );
+}
+
+const gchar*
+ctn_direction_name(CtnDirection direction)
+{
+    return direction == CTN_DIRECTION_UPSTREAM ? "upstream" : "downstream";
+}
+
+void
+ctn_message_stats_print(GString* out,
+        const CtnMessageStats* s)
+{
+    int d, t;
+
+    for( d=0; d<CTN_DIRECTIONS; d++ ) {
+        for( t=0; t<256; t++ ) {
+            const CtnMessageTypeStats* ts = ctn_message_stats_get( s, d, t );
+            if( !ts ) {
+                continue;
+            }
+            g_string_append_printf( out, "\t%s %s: %" G_GUINT64_FORMAT " frames, %"
+                    G_GUINT64_FORMAT " bytes",
+                    ctn_direction_name( d ), ctn_classifier_get_name( s->classifier, t ),
+                    ts->frames, ts->bytes );
+            if( ts->reply.count ) {
+                g_string_append_printf( out, ", reply p50 %" G_GUINT64_FORMAT " p99 %"
+                        G_GUINT64_FORMAT " max %" G_GUINT64_FORMAT " us",
+                        ctn_histogram_percentile( &ts->reply, 50.0 ),
+                        ctn_histogram_percentile( &ts->reply, 99.0 ),
+                        ts->reply.max );
+            }
+            g_string_append( out, "\n" );
+        }
+    }
+    if( s->untagged ) {
+        g_string_append_printf( out, "\tuntagged: %" G_GUINT64_FORMAT " frames\n", s->untagged );
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef CLASSIFY_H
+#define CLASSIFY_H
+
+#include <glib.h>
+
+#include "stats.h"
+
+G_BEGIN_DECLS
+
+/* Sorts TA and card frames by message type, the byte at a fixed offset
+ * of the frame, and measures how long each type waits for its reply.
+ * The reply to a frame is the first frame going the other way, a frame
+ * that is itself a reply doesn't wait for one. Types are shown as 0xNN
+ * unless a key file names them:
+ *
+ *   [format]
+ *   tag-offset=0
+ *   [types]
+ *   0x01=tune-request
+ *   [priority]
+ *   urgent=0x01;0x02
+ *
+ * Frames of urgent types are sent ahead of everything else queued for
+ * the same pair and direction.
+ *
+ * A CtnMessageStats is written by the pair's I/O thread only, types are
+ * allocated the first time they are seen and may be read elsewhere. */
+
+typedef enum {
+    CTN_DIRECTION_UPSTREAM,   //ta -> mocur
+    CTN_DIRECTION_DOWNSTREAM, //mocur -> ta
+    CTN_DIRECTIONS
+} CtnDirection;
+
+typedef enum {
+    CTN_LANE_URGENT,
+    CTN_LANE_NORMAL,
+    CTN_LANES
+} CtnLane;
+
+typedef struct _CtnClassifier CtnClassifier;
+
+/* NULL path for the defaults */
+CtnClassifier*
+ctn_classifier_load (const gchar *path,
+        GError **error);
+
+void
+ctn_classifier_free (CtnClassifier *classifier);
+
+const gchar*
+ctn_classifier_get_name (const CtnClassifier *classifier,
+        guint8 type);
+
+/* NORMAL for frames too short to carry a type */
+CtnLane
+ctn_classifier_get_lane (const CtnClassifier *classifier,
+        const guchar *frame,
+        gsize len);
+
+typedef struct {
+    guint64 frames;
+    guint64 bytes;
+    CtnHistogram reply; //microseconds until the first frame back
+} CtnMessageTypeStats;
+
+typedef struct {
+    const CtnClassifier* classifier;
+    CtnMessageTypeStats* types[CTN_DIRECTIONS][256];
+    guint64 untagged; //too short to carry a type
+
+    //oldest frame each way still waiting for a reply
+    gboolean waiting[CTN_DIRECTIONS];
+    guint8 waiting_type[CTN_DIRECTIONS];
+    gint64 waiting_since[CTN_DIRECTIONS];
+} CtnMessageStats;
+
+CtnMessageStats*
+ctn_message_stats_new (const CtnClassifier *classifier);
+
+void
+ctn_message_stats_free (CtnMessageStats *stats);
+
+/* now is when the frame reached ctntad */
+void
+ctn_message_stats_record (CtnMessageStats *stats,
+        CtnDirection direction,
+        const guchar *frame,
+        gsize len,
+        gint64 now);
+
+/* stops waiting for replies, for when frames in flight were thrown away */
+void
+ctn_message_stats_forget (CtnMessageStats *stats);
+
+/* NULL for a type not seen yet */
+const CtnMessageTypeStats*
+ctn_message_stats_get (const CtnMessageStats *stats,
+        CtnDirection direction,
+        guint8 type);
+
+const gchar*
+ctn_direction_name (CtnDirection direction);
+
+void
+ctn_message_stats_print (GString *out,
+        const CtnMessageStats *stats);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,228 @@
+#include "control.h"
+
+#include <glib/gstdio.h>
+
+#include "handover.h"
+#include "log.h"
+
+struct _CtnControl {
+    GSocketService* service;
+    CtnControlHandler handler;
+    gpointer user_data;
+    gchar* unix_path;
+    GSocket* socket;
+};
+
+typedef struct {
+    CtnControl* c;
+    GSocketConnection* connection;
+    GDataInputStream* in;
+    GString* reply;
+} ControlClient;
+
+static void read_command(ControlClient* cc);
+
+static void
+client_free(ControlClient* cc)
+{
+    g_io_stream_close( G_IO_STREAM(cc->connection), NULL, NULL );
+    g_object_unref( cc->in );
+    g_object_unref( cc->connection );
+    g_string_free( cc->reply, TRUE );
+    g_slice_free( ControlClient, cc );
+}
+
+static void
+reply_written(
+        GObject* source,
+        GAsyncResult* res,
+        gpointer user_data)
+{
+    ControlClient* cc = user_data;
+    GError* error = NULL;
+
+    if( !g_output_stream_write_all_finish( G_OUTPUT_STREAM(source), res, NULL, &error ) ) {
+        ctn_warning( CTN_LOG_CORE, "control write failed %s", error->message );
+        g_error_free( error );
+        error = NULL;
+        client_free( cc );
+        return;
+    }
+
+    read_command( cc );
+}
+
+static void
+run_command(
+        ControlClient* cc,
+        gchar* line)
+{
+    gchar** argv = g_strsplit_set( g_strstrip( line ), " \t", -1 );
+    gchar** arg;
+    gchar** packed = argv;
+    GError* error = NULL;
+
+    //runs of blanks leave empty words behind
+    for( arg=argv; *arg; arg++ ) {
+        if( **arg ) {
+            *packed++ = *arg;
+        } else {
+            g_free( *arg );
+        }
+    }
+    *packed = NULL;
+
+    g_string_truncate( cc->reply, 0 );
+    if( !argv[0] ) {
+        //blank lines just get an OK, handy to check the daemon is alive
+        g_string_append( cc->reply, "OK\n" );
+    } else if( cc->c->handler( argv, cc->reply, cc->c->user_data, &error ) ) {
+        g_string_append( cc->reply, "OK\n" );
+    } else {
+        g_string_append_printf( cc->reply, "ERR %s\n",
+                error ? error->message : "failed" );
+        if( error ) {
+            g_error_free( error );
+            error = NULL;
+        }
+    }
+    g_strfreev( argv );
+
+    g_output_stream_write_all_async(
+            g_io_stream_get_output_stream( G_IO_STREAM(cc->connection) ),
+            cc->reply->str,
+            cc->reply->len,
+            G_PRIORITY_DEFAULT,
+            NULL,
+            reply_written,
+            cc);
+}
+
+static void
+command_read(
+        GObject* source,
+        GAsyncResult* res,
+        gpointer user_data)
+{
+    ControlClient* cc = user_data;
+    GError* error = NULL;
+    gchar* line = g_data_input_stream_read_line_finish( G_DATA_INPUT_STREAM(source),
+            res, NULL, &error );
+
+    if( !line ) {
+        if( error ) {
+            ctn_warning( CTN_LOG_CORE, "control read failed %s", error->message );
+            g_error_free( error );
+            error = NULL;
+        }
+        client_free( cc );
+        return;
+    }
+
+    run_command( cc, line );
+    g_free( line );
+}
+
+static void
+read_command(ControlClient* cc)
+{
+    g_data_input_stream_read_line_async( cc->in,
+            G_PRIORITY_DEFAULT,
+            NULL,
+            command_read,
+            cc);
+}
+
+static gboolean
+incoming(
+        GSocketService* service,
+        GSocketConnection* connection,
+        GObject* source_object,
+        gpointer user_data)
+{
+    ControlClient* cc = g_slice_new0( ControlClient );
+    cc->c = user_data;
+    cc->connection = g_object_ref( connection );
+    cc->in = g_data_input_stream_new(
+            g_io_stream_get_input_stream( G_IO_STREAM(connection) ) );
+    g_data_input_stream_set_newline_type( cc->in, G_DATA_STREAM_NEWLINE_TYPE_ANY );
+    cc->reply = g_string_sized_new( 1024 );
+    read_command( cc );
+    return TRUE;
+}
+
+CtnControl*
+ctn_control_new(CtnControlHandler handler,
+        gpointer user_data)
+{
+    CtnControl* c = g_slice_new0( CtnControl );
+    c->handler = handler;
+    c->user_data = user_data;
+    c->service = g_socket_service_new();
+    g_signal_connect( c->service, "incoming", G_CALLBACK(incoming), c );
+    return c;
+}
+
+void
+ctn_control_free(CtnControl* c)
+{
+    if( !c ) {
+        return;
+    }
+
+    g_socket_service_stop( c->service );
+    g_socket_listener_close( G_SOCKET_LISTENER(c->service) );
+    g_object_unref( c->service );
+    if( c->socket ) {
+        g_object_unref( c->socket );
+    }
+    if( c->unix_path ) {
+        g_unlink( c->unix_path );
+        g_free( c->unix_path );
+    }
+    g_slice_free( CtnControl, c );
+}
+
+gboolean
+ctn_control_listen_unix(CtnControl* c,
+        const gchar* path,
+        GError** error)
+{
+    //resets and log levels are for the operator only
+    GSocket* socket = ctn_handover_socket_new_unix( path, 0600, error );
+    gboolean ok;
+
+    if( !socket ) {
+        return FALSE;
+    }
+
+    ok = ctn_control_listen_socket( c, socket, path, error );
+    g_object_unref( socket );
+    return ok;
+}
+
+gboolean
+ctn_control_listen_socket(CtnControl* c,
+        GSocket* socket,
+        const gchar* path,
+        GError** error)
+{
+    if( !g_socket_listener_add_socket( G_SOCKET_LISTENER(c->service), socket, NULL, error ) ) {
+        return FALSE;
+    }
+
+    c->socket = g_object_ref( socket );
+    c->unix_path = g_strdup( path );
+    return TRUE;
+}
+
+GSocket*
+ctn_control_hand_over(CtnControl* c)
+{
+    g_socket_service_stop( c->service );
+
+    //the path belongs to the new daemon now
+    g_free( c->unix_path );
+    c->unix_path = NULL;
+    return c->socket;
+}
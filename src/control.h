@@ -0,0 +1,48 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Line based control socket. Every line a client sends is one command,
+ * split on whitespace and run on the main loop by the handler. The reply
+ * is whatever the handler wrote, then a line "OK", or "ERR <message>"
+ * when it failed. Clients may send any number of commands on one
+ * connection, socat - UNIX-CONNECT:path is enough to talk to it. */
+
+typedef struct _CtnControl CtnControl;
+
+typedef gboolean (*CtnControlHandler) (gchar **argv,
+        GString *out,
+        gpointer user_data,
+        GError **error);
+
+CtnControl*
+ctn_control_new (CtnControlHandler handler,
+        gpointer user_data);
+
+void
+ctn_control_free (CtnControl *control);
+
+/* the socket is only accessible to the daemon's user */
+gboolean
+ctn_control_listen_unix (CtnControl *control,
+        const gchar *path,
+        GError **error);
+
+/* a socket passed over by a daemon handing over, listening on path */
+gboolean
+ctn_control_listen_socket (CtnControl *control,
+        GSocket *socket,
+        const gchar *path,
+        GError **error);
+
+/* stops taking commands, the listening socket or NULL stays open for
+ * the new daemon until the control is freed */
+GSocket*
+ctn_control_hand_over (CtnControl *control);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,1243 @@
+/* End to end benchmark for ctntad.
+ *
+ * Each simulated pair is a fake mocur, a GUPnPRootDevice serving the
+ * OCTAMessage service on the benchmark interface, and an emulated TA, a
+ * FunctionFS gadget with the Motorola ids bound to a dummy_hcd UDC. ctntad
+ * is started against them and pairs them like real hardware. Frames carry
+ * their origin and send time, so latency is measured where they arrive.
+ *
+ * With --replay the frames are the ones ctntad --capture recorded, sent
+ * on their original schedule or --speed times faster, one simulated pair
+ * per captured one. Latency then assumes mocur i is paired with TA i.
+ *
+ * Needs root, configfs and the libcomposite, usb_f_fs and dummy_hcd
+ * modules (modprobe dummy_hcd num=N for N pairs). SSDP on lo needs
+ * "ip link set lo multicast on". */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <libgupnp/gupnp.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/usb/functionfs.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <unistd.h>
+
+#include "base64.h"
+#include "capture.h"
+#include "stats.h"
+
+#define MOCUR_DEVICE_TYPE "urn:schemas-cetoncorp-com:device:SecureContainer:1"
+#define OCTA_DEVICE_TYPE "urn:schemas-cetoncorp-com:device:SecureContainer:1"
+#define OCTA_SERVICE_TYPE "urn:schemas-microsoft-com:service:OCTAMessage:1"
+
+#define MOT_TA_VENDOR_ID 0x07b2
+#define MOT_TA_PRODUCT_ID 0x6002
+
+#define GADGET_ROOT "/sys/kernel/config/usb_gadget"
+#define BENCH_MAGIC 0x424e5443 //"CTNB"
+#define BENCH_PACKET_SIZE 512
+#define BENCH_MAX_FRAME 16*1024
+#define READY_TIMEOUT 30 //s
+#define DRAIN_TIME 1 //s
+
+typedef enum {
+    MODE_ECHO,
+    MODE_UPSTREAM,
+    MODE_DOWNSTREAM,
+    MODE_REPLAY
+} BenchMode;
+
+//leads every frame, the rest is filler
+typedef struct {
+    guint32 magic;
+    guint32 origin;
+    guint64 seq;
+    gint64 sent; //monotonic us
+} __attribute__((packed)) BenchFrame;
+
+typedef struct {
+    guint index;
+
+    //fake mocur
+    gchar* description_dir;
+    GUPnPRootDevice* root;
+    GUPnPService* octa;
+    gboolean octa_init;
+
+    //emulated TA
+    gchar* gadget;
+    gchar* ffs;
+    gint ep0;
+    gint ep_in;
+    gint ep_out;
+    volatile gint ta_enabled;
+    GAsyncQueue* to_ta;
+
+    //pacing, owned by the main loop
+    gint64 last_pace;
+    gdouble credit;
+    guint64 next_seq;
+    volatile gint outstanding;
+
+    //measurement, each written by one thread
+    guint64 sent;
+    guint64 down_frames;     //TA out thread
+    guint64 down_bytes;
+    CtnHistogram down;
+    guint64 up_frames;       //main loop
+    guint64 up_bytes;
+    CtnHistogram up;
+    CtnHistogram round_trip;
+    gint peer; //TA a mocur was paired with, as seen in frames
+
+    //replay, send times of the frames in flight each way
+    GAsyncQueue* replay_up;
+    GAsyncQueue* replay_down;
+    guint64 up_sent;
+    guint64 down_sent;
+} BenchPair;
+
+static gint n_pairs = 1;
+static gint rate = 0;
+static gint window = 8;
+static gint frame_size = 188;
+static gint duration = 10;
+static gint warmup = 2;
+static gchar* mode_name = "echo";
+static gchar* interface = "lo";
+static gchar* ctntad_path = "./ctntad";
+static gboolean verbose = FALSE;
+static gchar** ctntad_args = NULL;
+static gchar* replay_path = NULL;
+static gdouble replay_speed = 1.0;
+
+static BenchMode mode;
+static BenchPair* pairs;
+static volatile gint measuring = FALSE;
+static gint64 measure_start;
+static gint64 measure_end;
+static GMainLoop* main_loop;
+static GPid ctntad_pid;
+
+static CtnCaptureReader* replay;
+static CtnCaptureHeader replay_header;
+static const guchar* replay_data;
+static gboolean replay_pending;
+static gint64 replay_first;
+static gint64 replay_start;
+static gint64 replay_sent; //when the last frame went out
+
+static GOptionEntry options[] = {
+    { "pairs", 'n', 0, G_OPTION_ARG_INT, &n_pairs, "simulated mocur and TA pairs, needs as many dummy_hcd UDCs", "N" },
+    { "mode", 'm', 0, G_OPTION_ARG_STRING, &mode_name, "echo (mocur -> ta -> mocur), upstream or downstream", "MODE" },
+    { "rate", 'r', 0, G_OPTION_ARG_INT, &rate, "frames per second per pair, 0 runs closed loop to find the maximum", "N" },
+    { "window", 'w', 0, G_OPTION_ARG_INT, &window, "frames in flight per pair when running closed loop", "N" },
+    { "size", 's', 0, G_OPTION_ARG_INT, &frame_size, "binary frame size", "BYTES" },
+    { "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "measured seconds", "S" },
+    { "warmup", 0, 0, G_OPTION_ARG_INT, &warmup, "unmeasured seconds after pairing", "S" },
+    { "interface", 'i', 0, G_OPTION_ARG_STRING, &interface, "interface for the fake mocurs and ctntad", "I" },
+    { "ctntad", 0, 0, G_OPTION_ARG_FILENAME, &ctntad_path, "ctntad binary to run", "PATH" },
+    { "replay", 0, 0, G_OPTION_ARG_FILENAME, &replay_path, "send the frames of a ctntad --capture instead of generated ones, with as many pairs as it has", "FILE" },
+    { "speed", 0, 0, G_OPTION_ARG_DOUBLE, &replay_speed, "replay this many times faster than captured, 0 as fast as --window allows", "X" },
+    { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "keep ctntad's output", NULL },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &ctntad_args, NULL, "[-- CTNTAD OPTIONS]" },
+    { NULL }
+};
+
+static const gchar description_template[] =
+    "<?xml version=\"1.0\"?>\n"
+    "<root xmlns=\"urn:schemas-upnp-org:device-1-0\">\n"
+    " <specVersion><major>1</major><minor>0</minor></specVersion>\n"
+    " <device>\n"
+    "  <deviceType>" MOCUR_DEVICE_TYPE "</deviceType>\n"
+    "  <friendlyName>ctntad bench mocur %u</friendlyName>\n"
+    "  <manufacturer>ctntad</manufacturer>\n"
+    "  <modelName>bench</modelName>\n"
+    "  <UDN>uuid:c7a7ad00-0000-4000-8000-%012x</UDN>\n"
+    "  <deviceList>\n"
+    "   <device>\n"
+    "    <deviceType>" OCTA_DEVICE_TYPE "</deviceType>\n"
+    "    <friendlyName>ctntad bench octa %u</friendlyName>\n"
+    "    <manufacturer>ctntad</manufacturer>\n"
+    "    <modelName>bench</modelName>\n"
+    "    <UDN>uuid:c7a7ad00-0000-4000-8001-%012x</UDN>\n"
+    "    <serviceList>\n"
+    "     <service>\n"
+    "      <serviceType>" OCTA_SERVICE_TYPE "</serviceType>\n"
+    "      <serviceId>urn:microsoft-com:serviceId:OCTAMessage</serviceId>\n"
+    "      <SCPDURL>/OCTAMessage.xml</SCPDURL>\n"
+    "      <controlURL>/OCTAMessage/control</controlURL>\n"
+    "      <eventSubURL>/OCTAMessage/event</eventSubURL>\n"
+    "     </service>\n"
+    "    </serviceList>\n"
+    "   </device>\n"
+    "  </deviceList>\n"
+    " </device>\n"
+    "</root>\n";
+
+//the parts of the OCTAMessage service ctntad uses
+static const gchar scpd[] =
+    "<?xml version=\"1.0\"?>\n"
+    "<scpd xmlns=\"urn:schemas-upnp-org:service-1-0\">\n"
+    " <specVersion><major>1</major><minor>0</minor></specVersion>\n"
+    " <actionList>\n"
+    "  <action><name>SendMessageToUDCP</name><argumentList>\n"
+    "   <argument><name>OCTAMessage</name><direction>in</direction>"
+    "<relatedStateVariable>A_ARG_TYPE_OCTA_MESSAGE</relatedStateVariable></argument>\n"
+    "  </argumentList></action>\n"
+    "  <action><name>OCTAInit</name><argumentList>\n"
+    "   <argument><name>EnableOCTA</name><direction>in</direction>"
+    "<relatedStateVariable>A_ARG_TYPE_OCTA_ENABLE</relatedStateVariable></argument>\n"
+    "  </argumentList></action>\n"
+    "  <action><name>USBResetComplete</name></action>\n"
+    " </actionList>\n"
+    " <serviceStateTable>\n"
+    "  <stateVariable sendEvents=\"yes\"><name>UDCPMessage</name><dataType>bin.base64</dataType></stateVariable>\n"
+    "  <stateVariable sendEvents=\"yes\"><name>TACommunicationError</name><dataType>boolean</dataType></stateVariable>\n"
+    "  <stateVariable sendEvents=\"no\"><name>A_ARG_TYPE_OCTA_MESSAGE</name><dataType>bin.base64</dataType></stateVariable>\n"
+    "  <stateVariable sendEvents=\"no\"><name>A_ARG_TYPE_OCTA_ENABLE</name><dataType>boolean</dataType></stateVariable>\n"
+    " </serviceStateTable>\n"
+    "</scpd>\n";
+
+static gint64
+frame_latency(
+        const BenchFrame* frame)
+{
+    return g_get_monotonic_time() - frame->sent;
+}
+
+//only frames sent inside the measured period count
+static gboolean
+frame_measured(
+        const BenchFrame* frame)
+{
+    return measure_start && frame->sent >= measure_start &&
+        ( !measure_end || frame->sent < measure_end );
+}
+
+static GBytes*
+frame_new(
+        BenchPair* bp)
+{
+    guchar* data = g_malloc0( frame_size );
+    BenchFrame* frame = (BenchFrame*)data;
+    frame->magic = BENCH_MAGIC;
+    frame->origin = bp->index;
+    frame->seq = bp->next_seq++;
+    frame->sent = g_get_monotonic_time();
+    if( g_atomic_int_get( &measuring ) ) {
+        bp->sent++;
+    }
+    return g_bytes_new_take( data, frame_size );
+}
+
+/* emulated TA */
+
+//in place rather than g_file_set_contents(), configfs attributes can't be
+//replaced by a rename
+static gboolean
+write_file(
+        const gchar* dir,
+        const gchar* name,
+        const gchar* contents)
+{
+    gchar* path = g_build_filename( dir, name, NULL );
+    FILE* f = fopen( path, "w" );
+    gboolean ok = f && fputs( contents, f ) >= 0;
+
+    if( f && fclose( f ) != 0 ) {
+        ok = FALSE;
+    }
+
+    if( !ok ) {
+        g_printerr("failed to write %s\n", path);
+    }
+    g_free( path );
+    return ok;
+}
+
+static gboolean
+make_dir(
+        const gchar* dir,
+        const gchar* name)
+{
+    gchar* path = g_build_filename( dir, name, NULL );
+    gboolean ok = g_mkdir( path, 0755 ) == 0 || errno == EEXIST;
+    if( !ok ) {
+        g_printerr("failed to create %s: %s\n", path, g_strerror( errno ));
+    }
+    g_free( path );
+    return ok;
+}
+
+static gboolean
+write_ffs_descriptors(
+        gint ep0)
+{
+    static const struct {
+        struct usb_functionfs_descs_head_v2 header;
+        __le32 fs_count;
+        __le32 hs_count;
+        struct {
+            struct usb_interface_descriptor intf;
+            struct usb_endpoint_descriptor_no_audio in;
+            struct usb_endpoint_descriptor_no_audio out;
+        } __attribute__((packed)) fs, hs;
+    } __attribute__((packed)) descriptors = {
+        .header = {
+            .magic = FUNCTIONFS_DESCRIPTORS_MAGIC_V2,
+            .flags = FUNCTIONFS_HAS_FS_DESC | FUNCTIONFS_HAS_HS_DESC,
+            .length = sizeof(descriptors),
+        },
+        .fs_count = 3,
+        .hs_count = 3,
+        //the IN endpoint comes first so it is ep1, dummy_hcd hands out
+        //0x81 and 0x02 for these, the addresses ctntad uses
+        .fs = {
+            .intf = {
+                .bLength = sizeof(descriptors.fs.intf),
+                .bDescriptorType = USB_DT_INTERFACE,
+                .bNumEndpoints = 2,
+                .bInterfaceClass = USB_CLASS_VENDOR_SPEC,
+                .iInterface = 1,
+            },
+            .in = {
+                .bLength = sizeof(descriptors.fs.in),
+                .bDescriptorType = USB_DT_ENDPOINT,
+                .bEndpointAddress = 1 | USB_DIR_IN,
+                .bmAttributes = USB_ENDPOINT_XFER_BULK,
+                .wMaxPacketSize = 64,
+            },
+            .out = {
+                .bLength = sizeof(descriptors.fs.out),
+                .bDescriptorType = USB_DT_ENDPOINT,
+                .bEndpointAddress = 2 | USB_DIR_OUT,
+                .bmAttributes = USB_ENDPOINT_XFER_BULK,
+                .wMaxPacketSize = 64,
+            },
+        },
+        .hs = {
+            .intf = {
+                .bLength = sizeof(descriptors.hs.intf),
+                .bDescriptorType = USB_DT_INTERFACE,
+                .bNumEndpoints = 2,
+                .bInterfaceClass = USB_CLASS_VENDOR_SPEC,
+                .iInterface = 1,
+            },
+            .in = {
+                .bLength = sizeof(descriptors.hs.in),
+                .bDescriptorType = USB_DT_ENDPOINT,
+                .bEndpointAddress = 1 | USB_DIR_IN,
+                .bmAttributes = USB_ENDPOINT_XFER_BULK,
+                .wMaxPacketSize = BENCH_PACKET_SIZE,
+            },
+            .out = {
+                .bLength = sizeof(descriptors.hs.out),
+                .bDescriptorType = USB_DT_ENDPOINT,
+                .bEndpointAddress = 2 | USB_DIR_OUT,
+                .bmAttributes = USB_ENDPOINT_XFER_BULK,
+                .wMaxPacketSize = BENCH_PACKET_SIZE,
+            },
+        },
+    };
+
+    static const struct {
+        struct usb_functionfs_strings_head header;
+        struct {
+            __le16 code;
+            const char str1[sizeof("ctntad bench TA")];
+        } __attribute__((packed)) lang0;
+    } __attribute__((packed)) strings = {
+        .header = {
+            .magic = FUNCTIONFS_STRINGS_MAGIC,
+            .length = sizeof(strings),
+            .str_count = 1,
+            .lang_count = 1,
+        },
+        .lang0 = { 0x0409, "ctntad bench TA" },
+    };
+
+    if( write( ep0, &descriptors, sizeof(descriptors) ) != sizeof(descriptors) ||
+            write( ep0, &strings, sizeof(strings) ) != sizeof(strings) ) {
+        g_printerr("failed to write FunctionFS descriptors: %s\n", g_strerror( errno ));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gpointer
+ta_ep0_thread(
+        gpointer data)
+{
+    BenchPair* bp = data;
+    struct usb_functionfs_event event;
+
+    while( read( bp->ep0, &event, sizeof(event) ) == sizeof(event) ) {
+        switch( event.type ) {
+            case FUNCTIONFS_ENABLE:
+                g_atomic_int_set( &bp->ta_enabled, TRUE );
+                break;
+            case FUNCTIONFS_DISABLE:
+            case FUNCTIONFS_UNBIND:
+                g_atomic_int_set( &bp->ta_enabled, FALSE );
+                break;
+            case FUNCTIONFS_SETUP:
+                //the TA has no control requests, reading against an IN
+                //request or writing against an OUT one stalls it
+                if( event.u.setup.bRequestType & USB_DIR_IN ) {
+                    if( read( bp->ep0, NULL, 0 ) < 0 ) {}
+                } else {
+                    if( write( bp->ep0, NULL, 0 ) < 0 ) {}
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return NULL;
+}
+
+//frames for the host, generated upstream or echoed
+static gpointer
+ta_in_thread(
+        gpointer data)
+{
+    BenchPair* bp = data;
+
+    for( ;; ) {
+        GBytes* frame = g_async_queue_pop( bp->to_ta );
+        gsize len;
+        const guchar* buffer = g_bytes_get_data( frame, &len );
+
+        while( write( bp->ep_in, buffer, len ) < 0 ) {
+            //the host side was reset or isn't configured yet
+            g_usleep( 10 * G_TIME_SPAN_MILLISECOND );
+        }
+        //captured frames may be a multiple of the packet size, end them
+        if( len % BENCH_PACKET_SIZE == 0 && write( bp->ep_in, buffer, 0 ) < 0 ) {
+            g_printerr("ta %u: failed to end a %" G_GSIZE_FORMAT " byte frame\n", bp->index, len);
+        }
+        g_bytes_unref( frame );
+    }
+    return NULL;
+}
+
+//frames from the host, ctntad's writes of UDCPMessage events
+static gpointer
+ta_out_thread(
+        gpointer data)
+{
+    BenchPair* bp = data;
+    guchar* buffer = g_malloc( BENCH_MAX_FRAME );
+
+    for( ;; ) {
+        gssize len = read( bp->ep_out, buffer, BENCH_MAX_FRAME );
+        const BenchFrame* frame = (const BenchFrame*)buffer;
+        BenchPair* origin;
+
+        if( len < 0 ) {
+            g_usleep( 10 * G_TIME_SPAN_MILLISECOND );
+            continue;
+        }
+
+        if( mode == MODE_REPLAY ) {
+            gint64* sent = g_async_queue_try_pop( bp->replay_down );
+            if( sent ) {
+                bp->down_frames++;
+                bp->down_bytes += len;
+                ctn_histogram_record( &bp->down, g_get_monotonic_time() - *sent );
+                g_free( sent );
+                g_atomic_int_add( &bp->outstanding, -1 );
+            }
+            continue;
+        }
+
+        if( len < sizeof(BenchFrame) || frame->magic != BENCH_MAGIC ||
+                frame->origin >= n_pairs ) {
+            g_printerr("ta %u: unexpected %" G_GSSIZE_FORMAT " byte frame\n", bp->index, len);
+            continue;
+        }
+
+        origin = &pairs[frame->origin];
+        if( frame_measured( frame ) ) {
+            origin->down_frames++;
+            origin->down_bytes += len;
+            ctn_histogram_record( &origin->down, frame_latency( frame ) );
+        }
+
+        if( mode == MODE_ECHO ) {
+            g_async_queue_push( bp->to_ta, g_bytes_new( buffer, len ) );
+        } else {
+            g_atomic_int_add( &origin->outstanding, -1 );
+        }
+    }
+    return NULL;
+}
+
+static gboolean
+ta_setup(
+        BenchPair* bp)
+{
+    gchar* name = g_strdup_printf( "ctnbench%u", bp->index );
+    gchar* function = g_strdup_printf( "functions/ffs.%s", name );
+    gchar* udc = g_strdup_printf( "dummy_udc.%u", bp->index );
+    gchar* link = NULL;
+    gchar* target = NULL;
+    gchar* ep;
+    gboolean ok = FALSE;
+
+    bp->gadget = g_build_filename( GADGET_ROOT, name, NULL );
+    bp->ffs = g_build_filename( g_get_tmp_dir(), name, NULL );
+    bp->ep0 = bp->ep_in = bp->ep_out = -1;
+
+    gchar* vid = g_strdup_printf( "0x%04x", MOT_TA_VENDOR_ID );
+    gchar* pid = g_strdup_printf( "0x%04x", MOT_TA_PRODUCT_ID );
+    ok = make_dir( GADGET_ROOT, name ) &&
+        write_file( bp->gadget, "idVendor", vid ) &&
+        write_file( bp->gadget, "idProduct", pid ) &&
+        make_dir( bp->gadget, "strings/0x409" ) &&
+        write_file( bp->gadget, "strings/0x409/manufacturer", "ctntad" ) &&
+        write_file( bp->gadget, "strings/0x409/product", "bench TA" ) &&
+        write_file( bp->gadget, "strings/0x409/serialnumber", name ) &&
+        make_dir( bp->gadget, "configs/c.1" ) &&
+        make_dir( bp->gadget, function );
+    g_free( vid );
+    g_free( pid );
+    if( !ok ) {
+        g_printerr("is configfs mounted and libcomposite loaded?\n");
+        goto out;
+    }
+
+    link = g_strdup_printf( "%s/configs/c.1/ffs.%s", bp->gadget, name );
+    target = g_build_filename( bp->gadget, function, NULL );
+    if( symlink( target, link ) != 0 && errno != EEXIST ) {
+        g_printerr("failed to link %s: %s\n", link, g_strerror( errno ));
+        ok = FALSE;
+        goto out;
+    }
+
+    g_mkdir( bp->ffs, 0755 );
+    if( mount( name, bp->ffs, "functionfs", 0, NULL ) != 0 ) {
+        g_printerr("failed to mount functionfs on %s: %s\n", bp->ffs, g_strerror( errno ));
+        ok = FALSE;
+        goto out;
+    }
+
+    ep = g_build_filename( bp->ffs, "ep0", NULL );
+    bp->ep0 = open( ep, O_RDWR );
+    g_free( ep );
+    if( bp->ep0 < 0 || !write_ffs_descriptors( bp->ep0 ) ) {
+        ok = FALSE;
+        goto out;
+    }
+
+    ep = g_build_filename( bp->ffs, "ep1", NULL );
+    bp->ep_in = open( ep, O_RDWR );
+    g_free( ep );
+    ep = g_build_filename( bp->ffs, "ep2", NULL );
+    bp->ep_out = open( ep, O_RDWR );
+    g_free( ep );
+    if( bp->ep_in < 0 || bp->ep_out < 0 ) {
+        g_printerr("failed to open the gadget endpoints: %s\n", g_strerror( errno ));
+        ok = FALSE;
+        goto out;
+    }
+
+    bp->to_ta = g_async_queue_new_full( (GDestroyNotify)g_bytes_unref );
+    g_thread_unref( g_thread_new( "ta-ep0", ta_ep0_thread, bp ) );
+    g_thread_unref( g_thread_new( "ta-in", ta_in_thread, bp ) );
+    g_thread_unref( g_thread_new( "ta-out", ta_out_thread, bp ) );
+
+    ok = write_file( bp->gadget, "UDC", udc );
+    if( !ok ) {
+        g_printerr("is dummy_hcd loaded with num=%d?\n", n_pairs);
+    }
+
+out:
+    g_free( target );
+    g_free( link );
+    g_free( udc );
+    g_free( function );
+    g_free( name );
+    return ok;
+}
+
+//best effort, a failed step leaves the rest for the next run to reuse
+static void
+ta_teardown(
+        BenchPair* bp)
+{
+    gchar* name;
+    gchar* path;
+
+    if( !bp->gadget ) {
+        return;
+    }
+
+    name = g_path_get_basename( bp->gadget );
+
+    write_file( bp->gadget, "UDC", "\n" );
+    umount2( bp->ffs, MNT_DETACH );
+    g_rmdir( bp->ffs );
+
+    path = g_strdup_printf( "%s/configs/c.1/ffs.%s", bp->gadget, name );
+    g_unlink( path );
+    g_free( path );
+    path = g_strdup_printf( "%s/functions/ffs.%s", bp->gadget, name );
+    g_rmdir( path );
+    g_free( path );
+    path = g_build_filename( bp->gadget, "configs/c.1", NULL );
+    g_rmdir( path );
+    g_free( path );
+    path = g_build_filename( bp->gadget, "strings/0x409", NULL );
+    g_rmdir( path );
+    g_free( path );
+    g_rmdir( bp->gadget );
+
+    g_free( name );
+}
+
+/* fake mocur */
+
+static void
+send_message_to_udcp(
+        GUPnPService* service,
+        GUPnPServiceAction* action,
+        gpointer user_data)
+{
+    BenchPair* bp = user_data;
+    gchar* message = NULL;
+    gsize len;
+
+    gupnp_service_action_get( action,
+            "OCTAMessage", G_TYPE_STRING, &message,
+            NULL);
+    gupnp_service_action_return( action );
+
+    if( !message ) {
+        return;
+    }
+
+    //a frame is never longer than its base64
+    len = ctn_base64_decode( message, strlen( message ), (guchar*)message );
+    const BenchFrame* frame = (const BenchFrame*)message;
+
+    if( mode == MODE_REPLAY ) {
+        gint64* sent = g_async_queue_try_pop( bp->replay_up );
+        if( sent ) {
+            bp->up_frames++;
+            bp->up_bytes += len;
+            ctn_histogram_record( &bp->up, g_get_monotonic_time() - *sent );
+            g_free( sent );
+            g_atomic_int_add( &bp->outstanding, -1 );
+        }
+        g_free( message );
+        return;
+    }
+
+    if( len < sizeof(BenchFrame) || frame->magic != BENCH_MAGIC ||
+            frame->origin >= n_pairs ) {
+        g_printerr("mocur %u: unexpected %" G_GSIZE_FORMAT " byte frame\n", bp->index, len);
+        g_free( message );
+        return;
+    }
+
+    //echoed frames come back to the mocur they left from, upstream ones
+    //say which TA this mocur is paired with
+    if( mode == MODE_ECHO ) {
+        BenchPair* origin = &pairs[frame->origin];
+        if( frame_measured( frame ) ) {
+            ctn_histogram_record( &origin->round_trip, frame_latency( frame ) );
+        }
+        g_atomic_int_add( &origin->outstanding, -1 );
+    } else {
+        bp->peer = frame->origin;
+        if( frame_measured( frame ) ) {
+            bp->up_frames++;
+            bp->up_bytes += len;
+            ctn_histogram_record( &bp->up, frame_latency( frame ) );
+        }
+        g_atomic_int_add( &pairs[frame->origin].outstanding, -1 );
+    }
+
+    g_free( message );
+}
+
+static void
+octa_init(
+        GUPnPService* service,
+        GUPnPServiceAction* action,
+        gpointer user_data)
+{
+    BenchPair* bp = user_data;
+    gboolean enable = FALSE;
+
+    gupnp_service_action_get( action,
+            "EnableOCTA", G_TYPE_BOOLEAN, &enable,
+            NULL);
+    gupnp_service_action_return( action );
+
+    if( enable && !bp->octa_init ) {
+        g_print("mocur %u: paired\n", bp->index);
+        bp->octa_init = TRUE;
+    }
+}
+
+static void
+usb_reset_complete(
+        GUPnPService* service,
+        GUPnPServiceAction* action,
+        gpointer user_data)
+{
+    BenchPair* bp = user_data;
+    g_print("mocur %u: TA reset\n", bp->index);
+    gupnp_service_action_return( action );
+}
+
+static void
+query_variable(
+        GUPnPService* service,
+        const gchar* variable,
+        GValue* value,
+        gpointer user_data)
+{
+    if( strcmp( variable, "UDCPMessage" ) == 0 ) {
+        g_value_init( value, G_TYPE_STRING );
+        g_value_set_string( value, "" );
+    } else {
+        g_value_init( value, G_TYPE_BOOLEAN );
+        g_value_set_boolean( value, FALSE );
+    }
+}
+
+static gboolean
+mocur_setup(
+        BenchPair* bp,
+        GUPnPContext* context)
+{
+    GError* error = NULL;
+    gchar* description;
+    GUPnPDeviceInfo* octa_device;
+
+    bp->description_dir = g_dir_make_tmp( "ctntad-bench-XXXXXX", &error );
+    if( !bp->description_dir ) {
+        g_printerr("failed to create the description directory: %s\n", error->message);
+        g_error_free( error );
+        return FALSE;
+    }
+
+    description = g_strdup_printf( description_template,
+            bp->index, bp->index, bp->index, bp->index );
+    if( !write_file( bp->description_dir, "description.xml", description ) ||
+            !write_file( bp->description_dir, "OCTAMessage.xml", scpd ) ) {
+        g_free( description );
+        return FALSE;
+    }
+    g_free( description );
+
+    bp->root = gupnp_root_device_new( context, "description.xml", bp->description_dir, &error );
+    if( !bp->root ) {
+        g_printerr("failed to create the fake mocur: %s\n", error->message);
+        g_error_free( error );
+        return FALSE;
+    }
+
+    octa_device = gupnp_device_info_get_device( GUPNP_DEVICE_INFO(bp->root), OCTA_DEVICE_TYPE );
+    bp->octa = GUPNP_SERVICE(gupnp_device_info_get_service( octa_device, OCTA_SERVICE_TYPE ));
+    g_object_unref( octa_device );
+
+    g_signal_connect( bp->octa, "action-invoked::SendMessageToUDCP",
+            G_CALLBACK(send_message_to_udcp), bp );
+    g_signal_connect( bp->octa, "action-invoked::OCTAInit",
+            G_CALLBACK(octa_init), bp );
+    g_signal_connect( bp->octa, "action-invoked::USBResetComplete",
+            G_CALLBACK(usb_reset_complete), bp );
+    g_signal_connect( bp->octa, "query-variable",
+            G_CALLBACK(query_variable), bp );
+
+    gupnp_root_device_set_available( bp->root, TRUE );
+    return TRUE;
+}
+
+static void
+mocur_teardown(
+        BenchPair* bp)
+{
+    gchar* path;
+
+    if( bp->root ) {
+        gupnp_root_device_set_available( bp->root, FALSE );
+        g_object_unref( bp->octa );
+        g_object_unref( bp->root );
+    }
+
+    if( bp->description_dir ) {
+        path = g_build_filename( bp->description_dir, "description.xml", NULL );
+        g_unlink( path );
+        g_free( path );
+        path = g_build_filename( bp->description_dir, "OCTAMessage.xml", NULL );
+        g_unlink( path );
+        g_free( path );
+        g_rmdir( bp->description_dir );
+        g_free( bp->description_dir );
+    }
+}
+
+/* driving and reporting */
+
+static void
+send_frame(
+        BenchPair* bp)
+{
+    GBytes* frame = frame_new( bp );
+
+    g_atomic_int_inc( &bp->outstanding );
+    if( mode == MODE_UPSTREAM ) {
+        g_async_queue_push( bp->to_ta, frame );
+    } else {
+        gsize len;
+        const guchar* data = g_bytes_get_data( frame, &len );
+        gchar* encoded = g_malloc( CTN_BASE64_ENCODED_SIZE(len) );
+        ctn_base64_encode( data, len, encoded );
+        gupnp_service_notify( bp->octa,
+                "UDCPMessage", G_TYPE_STRING, encoded,
+                NULL);
+        g_free( encoded );
+        g_bytes_unref( frame );
+    }
+}
+
+static gboolean
+pace(
+        gpointer data)
+{
+    gint64 now = g_get_monotonic_time();
+    int i;
+
+    for( i=0; i<n_pairs; i++ ) {
+        BenchPair* bp = &pairs[i];
+
+        if( rate ) {
+            bp->credit += ( now - bp->last_pace ) * rate / 1e6;
+            //don't let a stall turn into a burst
+            bp->credit = MIN( bp->credit, MAX( rate / 10.0, 1.0 ) );
+            while( bp->credit >= 1.0 ) {
+                send_frame( bp );
+                bp->credit -= 1.0;
+            }
+        } else {
+            while( g_atomic_int_get( &bp->outstanding ) < window ) {
+                send_frame( bp );
+            }
+        }
+        bp->last_pace = now;
+    }
+    return TRUE;
+}
+
+//the frame leaves as it would have from the captured pair's TA or mocur
+static void
+replay_send(
+        const CtnCaptureHeader* header,
+        const guchar* data)
+{
+    BenchPair* bp = &pairs[header->pair % n_pairs];
+    gint64* sent;
+
+    if( header->type == CTN_CAPTURE_PAIRED ) {
+        const gchar* udn = (const gchar*)data;
+        gsize udn_len = strnlen( udn, header->length );
+        gchar* port = udn_len < header->length ?
+            g_strndup( udn + udn_len + 1, header->length - udn_len - 1 ) : g_strdup( "?" );
+        g_print("replaying captured pair %u, %.*s on port %s, as pair %u\n",
+                header->pair, (int)udn_len, udn, port, bp->index);
+        g_free( port );
+        return;
+    }
+
+    sent = g_new( gint64, 1 );
+    *sent = g_get_monotonic_time();
+    g_atomic_int_inc( &bp->outstanding );
+
+    if( header->type == CTN_CAPTURE_TA_TO_MOCUR ) {
+        bp->up_sent++;
+        g_async_queue_push( bp->replay_up, sent );
+        g_async_queue_push( bp->to_ta, g_bytes_new( data, header->length ) );
+    } else if( header->type == CTN_CAPTURE_MOCUR_TO_TA ) {
+        gchar* encoded = g_malloc( CTN_BASE64_ENCODED_SIZE(header->length) );
+        bp->down_sent++;
+        g_async_queue_push( bp->replay_down, sent );
+        ctn_base64_encode( data, header->length, encoded );
+        gupnp_service_notify( bp->octa,
+                "UDCPMessage", G_TYPE_STRING, encoded,
+                NULL);
+        g_free( encoded );
+    } else {
+        g_atomic_int_add( &bp->outstanding, -1 );
+        g_free( sent );
+    }
+}
+
+static gboolean stop_measuring(gpointer data);
+
+static gboolean
+replay_step(
+        gpointer data)
+{
+    gint64 now = g_get_monotonic_time();
+    int i;
+
+    while( replay_pending ) {
+        if( replay_speed > 0 ) {
+            gint64 due = replay_start + ( replay_header.time - replay_first ) / replay_speed;
+            if( due > now ) {
+                g_timeout_add( MAX( ( due - now ) / 1000, 1 ), replay_step, NULL );
+                return FALSE;
+            }
+        } else {
+            BenchPair* bp = &pairs[replay_header.pair % n_pairs];
+            if( g_atomic_int_get( &bp->outstanding ) >= window ) {
+                g_timeout_add( 1, replay_step, NULL );
+                return FALSE;
+            }
+        }
+
+        replay_send( &replay_header, replay_data );
+        replay_pending = ctn_capture_reader_next( replay, &replay_header, &replay_data );
+    }
+
+    if( !replay_sent ) {
+        replay_sent = now;
+        g_print("replay sent in %.1f s\n", ( now - replay_start ) / 1e6);
+    }
+
+    //frames ctntad dropped never arrive, don't wait for them forever
+    for( i=0; i<n_pairs; i++ ) {
+        if( g_atomic_int_get( &pairs[i].outstanding ) &&
+                now - replay_sent < READY_TIMEOUT * G_TIME_SPAN_SECOND ) {
+            g_timeout_add( 100, replay_step, NULL );
+            return FALSE;
+        }
+    }
+    stop_measuring( NULL );
+    return FALSE;
+}
+
+static void
+print_histogram(
+        const gchar* name,
+        const CtnHistogram* h)
+{
+    g_print("\t%-10s p50 %6" G_GUINT64_FORMAT " p99 %6" G_GUINT64_FORMAT
+            " p999 %6" G_GUINT64_FORMAT " max %6" G_GUINT64_FORMAT " us\n",
+            name,
+            ctn_histogram_percentile( h, 50.0 ),
+            ctn_histogram_percentile( h, 99.0 ),
+            ctn_histogram_percentile( h, 99.9 ),
+            h->max);
+}
+
+static void
+print_flow(
+        const gchar* name,
+        guint64 sent,
+        guint64 frames,
+        guint64 bytes,
+        gdouble seconds)
+{
+    g_print("\t%-10s %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " frames, %.0f frames/s, %.2f MB/s\n",
+            name, frames, sent, frames / seconds, bytes / seconds / 1e6);
+}
+
+static void
+report(void)
+{
+    gdouble seconds = ( measure_end - measure_start ) / 1e6;
+    int i;
+
+    if( mode == MODE_REPLAY ) {
+        g_print("\nreplay of %s at %s for %.1f s\n", replay_path,
+                replay_speed > 0 ? "captured pace" : "full speed", seconds);
+        if( replay_speed > 0 && replay_speed != 1.0 ) {
+            g_print("%.2f times the captured pace\n", replay_speed);
+        }
+    } else if( rate ) {
+        g_print("\n%s, %d byte frames at %d frames/s for %.1f s\n",
+                mode_name, frame_size, rate, seconds);
+    } else {
+        g_print("\n%s, %d byte frames closed loop with %d in flight for %.1f s\n",
+                mode_name, frame_size, window, seconds);
+    }
+
+    for( i=0; i<n_pairs; i++ ) {
+        BenchPair* bp = &pairs[i];
+
+        g_print("pair %d\n", i);
+        switch( mode ) {
+            case MODE_ECHO:
+                print_flow( "mocur->ta", bp->sent, bp->down_frames, bp->down_bytes, seconds );
+                print_flow( "round trip", bp->sent, bp->round_trip.count,
+                        bp->round_trip.count * frame_size, seconds );
+                print_histogram( "mocur->ta", &bp->down );
+                print_histogram( "round trip", &bp->round_trip );
+                break;
+            case MODE_DOWNSTREAM:
+                print_flow( "mocur->ta", bp->sent, bp->down_frames, bp->down_bytes, seconds );
+                print_histogram( "mocur->ta", &bp->down );
+                break;
+            case MODE_REPLAY:
+                print_flow( "ta->mocur", bp->up_sent, bp->up_frames, bp->up_bytes, seconds );
+                print_flow( "mocur->ta", bp->down_sent, bp->down_frames, bp->down_bytes, seconds );
+                print_histogram( "ta->mocur", &bp->up );
+                print_histogram( "mocur->ta", &bp->down );
+                break;
+            case MODE_UPSTREAM:
+                //sent counts frames from TA i, received ones from whichever TA
+                //mocur i was paired with
+                g_print("\tpaired with ta %d\n", bp->peer);
+                print_flow( "ta->mocur", pairs[bp->peer].sent, bp->up_frames, bp->up_bytes, seconds );
+                print_histogram( "ta->mocur", &bp->up );
+                break;
+        }
+    }
+}
+
+static gboolean
+finish(
+        gpointer data)
+{
+    g_main_loop_quit( main_loop );
+    return FALSE;
+}
+
+static gboolean
+stop_measuring(
+        gpointer data)
+{
+    measure_end = g_get_monotonic_time();
+    g_atomic_int_set( &measuring, FALSE );
+    g_timeout_add_seconds( DRAIN_TIME, finish, NULL );
+    return FALSE;
+}
+
+static gboolean
+start_measuring(
+        gpointer data)
+{
+    measure_start = g_get_monotonic_time();
+    g_atomic_int_set( &measuring, TRUE );
+    g_timeout_add_seconds( duration, stop_measuring, NULL );
+    return FALSE;
+}
+
+static gboolean
+wait_for_pairing(
+        gpointer data)
+{
+    static gint64 started = 0;
+    gint64 now = g_get_monotonic_time();
+    int i;
+
+    if( !started ) {
+        started = now;
+    }
+
+    for( i=0; i<n_pairs; i++ ) {
+        if( !pairs[i].octa_init || !g_atomic_int_get( &pairs[i].ta_enabled ) ) {
+            if( now - started > READY_TIMEOUT * G_TIME_SPAN_SECOND ) {
+                g_printerr("pair %d not ready after %d s, mocur %s, ta %s\n",
+                        i, READY_TIMEOUT,
+                        pairs[i].octa_init ? "paired" : "waiting",
+                        pairs[i].ta_enabled ? "configured" : "waiting");
+                g_main_loop_quit( main_loop );
+                return FALSE;
+            }
+            return TRUE;
+        }
+    }
+
+    if( mode == MODE_REPLAY ) {
+        g_print("all pairs up, replaying\n");
+        measure_start = replay_start = now;
+        g_atomic_int_set( &measuring, TRUE );
+        replay_step( NULL );
+        return FALSE;
+    }
+
+    g_print("all pairs up, warming up for %d s\n", warmup);
+    for( i=0; i<n_pairs; i++ ) {
+        pairs[i].last_pace = now;
+    }
+    g_timeout_add( 1, pace, NULL );
+    g_timeout_add_seconds( warmup, start_measuring, NULL );
+    return FALSE;
+}
+
+static gboolean
+spawn_ctntad(void)
+{
+    GError* error = NULL;
+    GPtrArray* argv = g_ptr_array_new();
+    gchar** arg;
+    gboolean ok;
+
+    g_ptr_array_add( argv, ctntad_path );
+    g_ptr_array_add( argv, "-i" );
+    g_ptr_array_add( argv, interface );
+    for( arg = ctntad_args; arg && *arg; arg++ ) {
+        g_ptr_array_add( argv, *arg );
+    }
+    g_ptr_array_add( argv, NULL );
+
+    ok = g_spawn_async( NULL, (gchar**)argv->pdata, NULL,
+            G_SPAWN_DO_NOT_REAP_CHILD |
+            ( verbose ? 0 : G_SPAWN_STDOUT_TO_DEV_NULL ),
+            NULL, NULL, &ctntad_pid, &error );
+    g_ptr_array_free( argv, TRUE );
+
+    if( !ok ) {
+        g_printerr("failed to start %s: %s\n", ctntad_path, error->message);
+        g_error_free( error );
+    }
+    return ok;
+}
+
+static void
+ctntad_exited(
+        GPid pid,
+        gint status,
+        gpointer data)
+{
+    g_printerr("ctntad exited early with status %d\n", status);
+    g_spawn_close_pid( pid );
+    ctntad_pid = 0;
+    g_main_loop_quit( main_loop );
+}
+
+int main(int argc, char** argv)
+{
+    GError* error = NULL;
+    GOptionContext* option_ctx;
+    GUPnPContext* context = NULL;
+    int status = EXIT_FAILURE;
+    int i;
+
+    option_ctx = g_option_context_new( " - end to end benchmark for ctntad" );
+    g_option_context_add_main_entries( option_ctx, options, NULL );
+
+    if( !g_option_context_parse( option_ctx, &argc, &argv, &error ) ) {
+        g_print("Option parsing failed: %s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    if( replay_path ) {
+        CtnCaptureHeader header;
+        const guchar* data;
+        guint captured = 0;
+
+        mode = MODE_REPLAY;
+        mode_name = "replay";
+        replay = ctn_capture_reader_open( replay_path, &error );
+        if( !replay ) {
+            g_printerr("%s\n", error->message);
+            g_error_free( error );
+            return EXIT_FAILURE;
+        }
+
+        //one simulated pair per captured one
+        while( ctn_capture_reader_next( replay, &header, &data ) ) {
+            captured = MAX( captured, header.pair + 1u );
+        }
+        ctn_capture_reader_free( replay );
+        replay = ctn_capture_reader_open( replay_path, &error );
+        replay_pending = replay && ctn_capture_reader_next( replay, &replay_header, &replay_data );
+        if( !replay_pending ) {
+            g_printerr("%s has no frames\n", replay_path);
+            return EXIT_FAILURE;
+        }
+        replay_first = replay_header.time;
+        n_pairs = MAX( captured, 1 );
+        replay_speed = MAX( replay_speed, 0 );
+    } else if( strcmp( mode_name, "echo" ) == 0 ) {
+        mode = MODE_ECHO;
+    } else if( strcmp( mode_name, "upstream" ) == 0 ) {
+        mode = MODE_UPSTREAM;
+    } else if( strcmp( mode_name, "downstream" ) == 0 ) {
+        mode = MODE_DOWNSTREAM;
+    } else {
+        g_printerr("unknown mode %s\n", mode_name);
+        return EXIT_FAILURE;
+    }
+
+    n_pairs = MAX( n_pairs, 1 );
+    window = MAX( window, 1 );
+    rate = MAX( rate, 0 );
+    frame_size = CLAMP( frame_size, sizeof(BenchFrame), BENCH_MAX_FRAME - 1 );
+    //a multiple of the packet size would need a zero length packet to end it
+    if( frame_size % BENCH_PACKET_SIZE == 0 ) {
+        frame_size++;
+    }
+
+    if( geteuid() != 0 ) {
+        g_printerr("the emulated TA needs root for configfs and functionfs\n");
+        return EXIT_FAILURE;
+    }
+
+    pairs = g_new0( BenchPair, n_pairs );
+    main_loop = g_main_loop_new( NULL, FALSE );
+
+    context = gupnp_context_new( interface, 0, &error );
+    if( !context ) {
+        g_printerr("Error creating the GUPnP context: %s\n", error->message);
+        g_error_free( error );
+        goto out;
+    }
+
+    for( i=0; i<n_pairs; i++ ) {
+        pairs[i].index = i;
+        pairs[i].peer = i;
+        pairs[i].replay_up = g_async_queue_new_full( g_free );
+        pairs[i].replay_down = g_async_queue_new_full( g_free );
+        if( !ta_setup( &pairs[i] ) || !mocur_setup( &pairs[i], context ) ) {
+            goto out;
+        }
+    }
+
+    if( !spawn_ctntad() ) {
+        goto out;
+    }
+    g_child_watch_add( ctntad_pid, ctntad_exited, NULL );
+
+    g_timeout_add( 100, wait_for_pairing, NULL );
+    g_main_loop_run( main_loop );
+
+    if( measure_end ) {
+        report();
+        status = EXIT_SUCCESS;
+    }
+
+out:
+    if( ctntad_pid ) {
+        kill( ctntad_pid, SIGTERM );
+        g_spawn_close_pid( ctntad_pid );
+    }
+
+    for( i=0; i<n_pairs; i++ ) {
+        mocur_teardown( &pairs[i] );
+        ta_teardown( &pairs[i] );
+    }
+    ctn_capture_reader_free( replay );
+
+    if( context ) {
+        g_object_unref( context );
+    }
+    g_main_loop_unref( main_loop );
+    g_option_context_free( option_ctx );
+    return status;
+}
@@ -0,0 +1,75 @@
+#include "events.h"
+
+#include <string.h>
+
+//FNV-1a, the length goes in too so a prefix doesn't match
+static guint64
+event_fingerprint(
+        const gchar* value,
+        gsize len)
+{
+    guint64 hash = G_GUINT64_CONSTANT(14695981039346656037) ^ len;
+    gsize i;
+
+    for( i=0; i<len; i++ ) {
+        hash ^= (guchar)value[i];
+        hash *= G_GUINT64_CONSTANT(1099511628211);
+    }
+    return hash;
+}
+
+void
+ctn_event_filter_init(CtnEventFilter* f)
+{
+    memset( f, 0, sizeof(*f) );
+}
+
+void
+ctn_event_filter_subscribed(CtnEventFilter* f)
+{
+    f->seq = 0;
+}
+
+gboolean
+ctn_event_filter_get_last(const CtnEventFilter* f,
+        guint64* fingerprint)
+{
+    *fingerprint = f->last;
+    return f->seen;
+}
+
+void
+ctn_event_filter_inherit(CtnEventFilter* f,
+        guint64 fingerprint)
+{
+    f->seen = TRUE;
+    f->last = fingerprint;
+}
+
+CtnEventVerdict
+ctn_event_filter_check(CtnEventFilter* f,
+        const gchar* value,
+        gsize len,
+        gint64 now,
+        gint64 window)
+{
+    guint64 fingerprint = event_fingerprint( value, len );
+    gboolean initial = f->seq++ == 0;
+    gboolean first = !f->seen;
+    gboolean same = f->seen && fingerprint == f->last;
+    gboolean recent = f->last_time && now - f->last_time < window;
+
+    f->seen = TRUE;
+    f->last = fingerprint;
+    f->last_time = now;
+
+    if( initial && ( first || same ) ) {
+        f->stale++;
+        return CTN_EVENT_STALE;
+    }
+    if( same && recent ) {
+        f->duplicates++;
+        return CTN_EVENT_DUPLICATE;
+    }
+    return CTN_EVENT_DELIVER;
+}
@@ -0,0 +1,65 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Weeds out UDCPMessage events that shouldn't reach the TA. GUPnP checks
+ * the GENA SEQ header itself and resubscribes when an event goes missing,
+ * so what it hands over is in order, but it doesn't pass SEQ on. seq
+ * counts the events of a subscription the same way instead: event 0 is
+ * the initial event carrying the current value. On the first subscription
+ * of a pair that value predates the pairing and is dropped as stale. On a
+ * resubscription, or one taken over from another daemon, it is dropped
+ * only when it matches the last event seen, otherwise it is a frame that
+ * arrived while unsubscribed. An event repeating the one right before it
+ * within the duplicate window is dropped too. That covers resubscriptions
+ * GUPnP makes on its own, whose initial event isn't told apart, and
+ * events redelivered around renewals. A frame the card sends twice on
+ * purpose rarely comes back to back that quickly. Main loop only. */
+
+typedef enum {
+    CTN_EVENT_DELIVER,
+    CTN_EVENT_STALE,
+    CTN_EVENT_DUPLICATE,
+} CtnEventVerdict;
+
+typedef struct {
+    guint32 seq;      //events of the current subscription so far
+    gboolean seen;    //anything at all, since the pair was made
+    guint64 last;     //fingerprint of the last event, delivered or not
+    gint64 last_time; //when it came, 0 when inherited
+    guint stale;
+    guint duplicates;
+} CtnEventFilter;
+
+void
+ctn_event_filter_init (CtnEventFilter *filter);
+
+/* a subscription was (re)started, its first event is the initial one.
+ * What was delivered before is kept. */
+void
+ctn_event_filter_subscribed (CtnEventFilter *filter);
+
+/* the last event seen, FALSE when there was none */
+gboolean
+ctn_event_filter_get_last (const CtnEventFilter *filter,
+        guint64 *fingerprint);
+
+/* carries on from the last event another daemon saw for the pair */
+void
+ctn_event_filter_inherit (CtnEventFilter *filter,
+        guint64 fingerprint);
+
+/* times are monotonic microseconds, a window of 0 keeps duplicates */
+CtnEventVerdict
+ctn_event_filter_check (CtnEventFilter *filter,
+        const gchar *value,
+        gsize len,
+        gint64 now,
+        gint64 window);
+
+G_END_DECLS
+
+#endif
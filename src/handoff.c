@@ -0,0 +1,150 @@
+#include "handoff.h"
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "log.h"
+
+typedef struct {
+    GSource source;
+    CtnHandoff* handoff;
+} HandoffSource;
+
+struct _CtnHandoff {
+    CtnHandoffLink* volatile head; //newest first
+    int fd;
+    GSource* source;
+    gpointer tag;
+    CtnHandoffFunc func;
+    gpointer user_data;
+};
+
+static gboolean
+handoff_prepare(
+        GSource* source,
+        gint* timeout)
+{
+    CtnHandoff* h = ((HandoffSource*)source)->handoff;
+
+    //anything pushed since the last dispatch doesn't need the poll
+    *timeout = -1;
+    return g_atomic_pointer_get( &h->head ) != NULL;
+}
+
+static gboolean
+handoff_check(GSource* source)
+{
+    CtnHandoff* h = ((HandoffSource*)source)->handoff;
+
+    return g_atomic_pointer_get( &h->head ) != NULL ||
+        ( g_source_query_unix_fd( source, h->tag ) & G_IO_IN );
+}
+
+static gboolean
+handoff_dispatch(
+        GSource* source,
+        GSourceFunc callback,
+        gpointer user_data)
+{
+    CtnHandoff* h = ((HandoffSource*)source)->handoff;
+    CtnHandoffLink* list;
+    CtnHandoffLink* fifo = NULL;
+    guint64 count;
+
+    //drain the counter first, a push after this wakes the next iteration
+    if( read( h->fd, &count, sizeof(count) ) < 0 && errno != EAGAIN ) {
+        ctn_warning( CTN_LOG_CORE, "handoff eventfd read failed %s", g_strerror( errno ) );
+    }
+
+    do {
+        list = g_atomic_pointer_get( &h->head );
+    } while( !g_atomic_pointer_compare_and_exchange( &h->head, list, NULL ) );
+
+    while( list ) {
+        CtnHandoffLink* next = list->next;
+        list->next = fifo;
+        fifo = list;
+        list = next;
+    }
+
+    while( fifo ) {
+        CtnHandoffLink* item = fifo;
+        fifo = fifo->next;
+        h->func( item, h->user_data );
+    }
+
+    return TRUE;
+}
+
+static GSourceFuncs handoff_funcs = {
+    handoff_prepare,
+    handoff_check,
+    handoff_dispatch,
+    NULL
+};
+
+CtnHandoff*
+ctn_handoff_new(GMainContext* context,
+        gint priority,
+        CtnHandoffFunc func,
+        gpointer user_data,
+        GError** error)
+{
+    CtnHandoff* h;
+    int fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+
+    if( fd < 0 ) {
+        int errsv = errno;
+        g_set_error( error, G_IO_ERROR, g_io_error_from_errno( errsv ),
+                "eventfd failed: %s", g_strerror( errsv ) );
+        return NULL;
+    }
+
+    h = g_slice_new0( CtnHandoff );
+    h->fd = fd;
+    h->func = func;
+    h->user_data = user_data;
+
+    h->source = g_source_new( &handoff_funcs, sizeof(HandoffSource) );
+    ((HandoffSource*)h->source)->handoff = h;
+    h->tag = g_source_add_unix_fd( h->source, h->fd, G_IO_IN );
+    g_source_set_priority( h->source, priority );
+    g_source_attach( h->source, context );
+
+    return h;
+}
+
+void
+ctn_handoff_free(CtnHandoff* h)
+{
+    if( !h ) {
+        return;
+    }
+
+    g_source_destroy( h->source );
+    g_source_unref( h->source );
+    close( h->fd );
+    g_slice_free( CtnHandoff, h );
+}
+
+void
+ctn_handoff_push(CtnHandoff* h,
+        gpointer item)
+{
+    CtnHandoffLink* link = item;
+    CtnHandoffLink* head;
+    guint64 one = 1;
+
+    do {
+        head = g_atomic_pointer_get( &h->head );
+        link->next = head;
+    } while( !g_atomic_pointer_compare_and_exchange( &h->head, head, link ) );
+
+    //the consumer takes everything at once, so only the first push after a
+    //drain has to wake it
+    if( !head && write( h->fd, &one, sizeof(one) ) < 0 && errno != EAGAIN ) {
+        ctn_warning( CTN_LOG_CORE, "handoff eventfd write failed %s", g_strerror( errno ) );
+    }
+}
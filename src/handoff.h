@@ -0,0 +1,42 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Hands items from any thread to one GMainContext without taking a lock.
+ * Producers push onto a lock-free list and only the push that finds it
+ * empty writes the eventfd. The consumer source takes the whole list at
+ * once and runs func on each item in push order, at the priority it was
+ * given, so it can be dispatched ahead of everything else on the loop. */
+typedef struct _CtnHandoff CtnHandoff;
+
+/* items start with this, the handoff links them through it */
+typedef struct _CtnHandoffLink CtnHandoffLink;
+struct _CtnHandoffLink {
+    CtnHandoffLink *next;
+};
+
+typedef void (*CtnHandoffFunc) (gpointer item,
+        gpointer user_data);
+
+CtnHandoff*
+ctn_handoff_new (GMainContext *context,
+        gint priority,
+        CtnHandoffFunc func,
+        gpointer user_data,
+        GError **error);
+
+/* items still queued are dropped without calling func */
+void
+ctn_handoff_free (CtnHandoff *handoff);
+
+/* item must start with a CtnHandoffLink */
+void
+ctn_handoff_push (CtnHandoff *handoff,
+        gpointer item);
+
+G_END_DECLS
+
+#endif
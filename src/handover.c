@@ -0,0 +1,610 @@
+#include "handover.h"
+
+#include <gio/gunixconnection.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+
+//the old daemon may take a moment to let go of its TAs
+#define HANDOVER_TIMEOUT 10 //s
+
+struct _CtnHandover {
+    GSocketService* service;
+    const CtnHandoverFuncs* funcs;
+    gpointer user_data;
+    gchar* unix_path;
+
+    struct _HandoverClient* releasing; //the client that asked for the release
+    gboolean release_started;
+    gboolean released;
+    gboolean finished;
+    GPtrArray* names;
+    GPtrArray* sockets;
+};
+
+typedef struct _HandoverClient {
+    CtnHandover* h;
+    GSocketConnection* connection;
+    GDataInputStream* in;
+    GString* reply;
+} HandoverClient;
+
+struct _CtnHandoverClient {
+    GSocketConnection* connection;
+    GDataInputStream* in;
+    GHashTable* pairs;
+    GHashTable* events;  //udn to the fingerprint of the last event
+    GHashTable* sockets; //name to a list of sockets
+};
+
+static void read_command(HandoverClient* hc);
+
+//the sockets are with the new daemon, which listens on the path now
+static void
+handover_finish(
+        CtnHandover* h)
+{
+    if( h->finished ) {
+        return;
+    }
+    h->finished = TRUE;
+
+    g_socket_service_stop( h->service );
+    g_free( h->unix_path );
+    h->unix_path = NULL;
+    h->funcs->done( h->user_data );
+}
+
+static void
+client_free(HandoverClient* hc)
+{
+    CtnHandover* h = hc->h;
+
+    g_io_stream_close( G_IO_STREAM(hc->connection), NULL, NULL );
+    g_object_unref( hc->in );
+    g_object_unref( hc->connection );
+    g_string_free( hc->reply, TRUE );
+    g_slice_free( HandoverClient, hc );
+
+    //the TAs are let go either way, whoever starts next picks them up
+    if( h->releasing == hc ) {
+        h->releasing = NULL;
+        ctn_warning( CTN_LOG_CORE, "new daemon went away during the handover" );
+        if( h->released ) {
+            handover_finish( h );
+        }
+    }
+}
+
+static void
+reply_written(
+        GObject* source,
+        GAsyncResult* res,
+        gpointer user_data)
+{
+    HandoverClient* hc = user_data;
+    GError* error = NULL;
+
+    if( !g_output_stream_write_all_finish( G_OUTPUT_STREAM(source), res, NULL, &error ) ) {
+        ctn_warning( CTN_LOG_CORE, "handover write failed %s", error->message );
+        g_error_free( error );
+        error = NULL;
+        client_free( hc );
+        return;
+    }
+
+    read_command( hc );
+}
+
+static void
+send_reply(HandoverClient* hc)
+{
+    g_output_stream_write_all_async(
+            g_io_stream_get_output_stream( G_IO_STREAM(hc->connection) ),
+            hc->reply->str,
+            hc->reply->len,
+            G_PRIORITY_DEFAULT,
+            NULL,
+            reply_written,
+            hc);
+}
+
+static void
+send_sockets(HandoverClient* hc)
+{
+    CtnHandover* h = hc->h;
+    GError* error = NULL;
+    guint i;
+
+    //the new daemon binds the path as soon as it has the sockets
+    g_socket_listener_close( G_SOCKET_LISTENER(h->service) );
+
+    for( i=0; i<h->sockets->len; i++ ) {
+        GSocket* socket = g_ptr_array_index( h->sockets, i );
+        if( !g_unix_connection_send_fd( G_UNIX_CONNECTION(hc->connection),
+                    g_socket_get_fd( socket ), NULL, &error ) ) {
+            ctn_warning( CTN_LOG_CORE, "failed to pass the %s socket %s",
+                    (gchar*)g_ptr_array_index( h->names, i ), error->message );
+            g_error_free( error );
+            error = NULL;
+            break;
+        }
+    }
+
+    ctn_info( CTN_LOG_CORE, "handed over to the new daemon" );
+    h->releasing = NULL;
+    client_free( hc );
+    handover_finish( h );
+}
+
+static void
+run_command(
+        HandoverClient* hc,
+        const gchar* line)
+{
+    CtnHandover* h = hc->h;
+
+    g_string_truncate( hc->reply, 0 );
+    if( strcmp( line, "pairs" ) == 0 ) {
+        h->funcs->list_pairs( hc->reply, h->user_data );
+        g_string_append( hc->reply, "end\n" );
+    } else if( strcmp( line, "release" ) == 0 ) {
+        if( h->release_started ) {
+            g_string_append( hc->reply, "ERR already handed over\n" );
+        } else {
+            //answered by ctn_handover_released
+            ctn_info( CTN_LOG_CORE, "handing over to a new daemon" );
+            h->release_started = TRUE;
+            h->releasing = hc;
+            h->funcs->release( h->user_data );
+            return;
+        }
+    } else if( strcmp( line, "send" ) == 0 ) {
+        if( h->releasing == hc && h->released ) {
+            send_sockets( hc );
+            return;
+        }
+        g_string_append( hc->reply, "ERR nothing released\n" );
+    } else {
+        g_string_append_printf( hc->reply, "ERR unknown command %s\n", line );
+    }
+
+    send_reply( hc );
+}
+
+static void
+command_read(
+        GObject* source,
+        GAsyncResult* res,
+        gpointer user_data)
+{
+    HandoverClient* hc = user_data;
+    GError* error = NULL;
+    gchar* line = g_data_input_stream_read_line_finish( G_DATA_INPUT_STREAM(source),
+            res, NULL, &error );
+
+    if( !line ) {
+        if( error ) {
+            ctn_warning( CTN_LOG_CORE, "handover read failed %s", error->message );
+            g_error_free( error );
+            error = NULL;
+        }
+        client_free( hc );
+        return;
+    }
+
+    run_command( hc, g_strstrip( line ) );
+    g_free( line );
+}
+
+static void
+read_command(HandoverClient* hc)
+{
+    g_data_input_stream_read_line_async( hc->in,
+            G_PRIORITY_DEFAULT,
+            NULL,
+            command_read,
+            hc);
+}
+
+static gboolean
+incoming(
+        GSocketService* service,
+        GSocketConnection* connection,
+        GObject* source_object,
+        gpointer user_data)
+{
+    HandoverClient* hc = g_slice_new0( HandoverClient );
+    hc->h = user_data;
+    hc->connection = g_object_ref( connection );
+    hc->in = g_data_input_stream_new(
+            g_io_stream_get_input_stream( G_IO_STREAM(connection) ) );
+    g_data_input_stream_set_newline_type( hc->in, G_DATA_STREAM_NEWLINE_TYPE_ANY );
+    hc->reply = g_string_sized_new( 256 );
+    read_command( hc );
+    return TRUE;
+}
+
+CtnHandover*
+ctn_handover_new(const CtnHandoverFuncs* funcs,
+        gpointer user_data)
+{
+    CtnHandover* h = g_slice_new0( CtnHandover );
+    h->funcs = funcs;
+    h->user_data = user_data;
+    h->names = g_ptr_array_new_with_free_func( g_free );
+    h->sockets = g_ptr_array_new_with_free_func( g_object_unref );
+    h->service = g_socket_service_new();
+    g_signal_connect( h->service, "incoming", G_CALLBACK(incoming), h );
+    return h;
+}
+
+void
+ctn_handover_free(CtnHandover* h)
+{
+    if( !h ) {
+        return;
+    }
+
+    g_socket_service_stop( h->service );
+    g_socket_listener_close( G_SOCKET_LISTENER(h->service) );
+    g_object_unref( h->service );
+    if( h->unix_path ) {
+        g_unlink( h->unix_path );
+        g_free( h->unix_path );
+    }
+    g_ptr_array_unref( h->names );
+    g_ptr_array_unref( h->sockets );
+    g_slice_free( CtnHandover, h );
+}
+
+gboolean
+ctn_handover_listen_unix(CtnHandover* h,
+        const gchar* path,
+        GError** error)
+{
+    //whoever connects can stop the daemon
+    GSocket* socket = ctn_handover_socket_new_unix( path, 0600, error );
+    gboolean ok;
+
+    if( !socket ) {
+        return FALSE;
+    }
+
+    ok = g_socket_listener_add_socket( G_SOCKET_LISTENER(h->service), socket, NULL, error );
+    g_object_unref( socket );
+    if( !ok ) {
+        return FALSE;
+    }
+
+    h->unix_path = g_strdup( path );
+    return TRUE;
+}
+
+void
+ctn_handover_pass_socket(CtnHandover* h,
+        const gchar* name,
+        GSocket* socket)
+{
+    g_ptr_array_add( h->names, g_strdup( name ) );
+    g_ptr_array_add( h->sockets, g_object_ref( socket ) );
+}
+
+void
+ctn_handover_released(CtnHandover* h)
+{
+    HandoverClient* hc = h->releasing;
+    guint i;
+
+    h->released = TRUE;
+    if( !hc ) {
+        handover_finish( h );
+        return;
+    }
+
+    //the descriptors only go out on request, so the client isn't reading
+    //ahead of them
+    g_string_assign( hc->reply, "released" );
+    for( i=0; i<h->names->len; i++ ) {
+        g_string_append_printf( hc->reply, " %s", (gchar*)g_ptr_array_index( h->names, i ) );
+    }
+    g_string_append( hc->reply, "\n" );
+    send_reply( hc );
+}
+
+GSocket*
+ctn_handover_socket_new(GSocketAddress* address,
+        GError** error)
+{
+    GSocket* socket = g_socket_new( g_socket_address_get_family( address ),
+            G_SOCKET_TYPE_STREAM,
+            G_SOCKET_PROTOCOL_DEFAULT,
+            error);
+
+    if( !socket ) {
+        return NULL;
+    }
+
+    if( !g_socket_bind( socket, address, TRUE, error ) ||
+            !g_socket_listen( socket, error ) ) {
+        g_object_unref( socket );
+        return NULL;
+    }
+    return socket;
+}
+
+gboolean
+ctn_handover_socket_in_use(const gchar* path)
+{
+    GSocketAddress* address = g_unix_socket_address_new( path );
+    GSocket* socket = g_socket_new( G_SOCKET_FAMILY_UNIX,
+            G_SOCKET_TYPE_STREAM,
+            G_SOCKET_PROTOCOL_DEFAULT,
+            NULL );
+    gboolean in_use = socket && g_socket_connect( socket, address, NULL, NULL );
+
+    if( socket ) {
+        g_socket_close( socket, NULL );
+        g_object_unref( socket );
+    }
+    g_object_unref( address );
+    return in_use;
+}
+
+GSocket*
+ctn_handover_socket_new_unix(const gchar* path,
+        gint mode,
+        GError** error)
+{
+    GSocketAddress* address;
+    GSocket* socket;
+    gchar* dir;
+
+    if( ctn_handover_socket_in_use( path ) ) {
+        g_set_error( error, G_IO_ERROR, G_IO_ERROR_ADDRESS_IN_USE,
+                "another ctntad is listening on %s", path );
+        return NULL;
+    }
+
+    //a socket left behind by an earlier run would make the bind fail
+    g_unlink( path );
+    dir = g_path_get_dirname( path );
+    g_mkdir_with_parents( dir, 0755 );
+    g_free( dir );
+
+    address = g_unix_socket_address_new( path );
+    socket = ctn_handover_socket_new( address, error );
+    g_object_unref( address );
+
+    if( socket && mode ) {
+        g_chmod( path, mode );
+    }
+    return socket;
+}
+
+static void
+socket_list_free(GList* sockets)
+{
+    g_list_free_full( sockets, g_object_unref );
+}
+
+static gboolean
+client_send(
+        CtnHandoverClient* c,
+        const gchar* command,
+        GError** error)
+{
+    return g_output_stream_write_all(
+            g_io_stream_get_output_stream( G_IO_STREAM(c->connection) ),
+            command,
+            strlen( command ),
+            NULL,
+            NULL,
+            error);
+}
+
+//the next line, NULL with error set when it is an ERR or the old
+//daemon hung up
+static gchar*
+client_read_line(
+        CtnHandoverClient* c,
+        GError** error)
+{
+    GError* local = NULL;
+    gchar* line = g_data_input_stream_read_line( c->in, NULL, NULL, &local );
+
+    if( !line ) {
+        if( local ) {
+            g_propagate_error( error, local );
+        } else {
+            g_set_error( error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                    "the running daemon hung up" );
+        }
+        return NULL;
+    }
+
+    g_strstrip( line );
+    if( g_str_has_prefix( line, "ERR " ) ) {
+        g_set_error( error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                "the running daemon refused: %s", line + 4 );
+        g_free( line );
+        return NULL;
+    }
+    return line;
+}
+
+CtnHandoverClient*
+ctn_handover_client_connect(const gchar* path,
+        GError** error)
+{
+    CtnHandoverClient* c;
+    GSocketClient* client = g_socket_client_new();
+    GSocketAddress* address = g_unix_socket_address_new( path );
+    GSocketConnection* connection = g_socket_client_connect( client,
+            G_SOCKET_CONNECTABLE(address), NULL, error );
+    gchar* line;
+
+    g_object_unref( address );
+    g_object_unref( client );
+    if( !connection ) {
+        return NULL;
+    }
+
+    g_socket_set_timeout( g_socket_connection_get_socket( connection ), HANDOVER_TIMEOUT );
+
+    c = g_slice_new0( CtnHandoverClient );
+    c->connection = connection;
+    c->in = g_data_input_stream_new(
+            g_io_stream_get_input_stream( G_IO_STREAM(connection) ) );
+    g_data_input_stream_set_newline_type( c->in, G_DATA_STREAM_NEWLINE_TYPE_ANY );
+    c->pairs = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, g_free );
+    c->events = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, g_free );
+    c->sockets = g_hash_table_new_full( g_str_hash, g_str_equal, g_free,
+            (GDestroyNotify)socket_list_free );
+
+    if( !client_send( c, "pairs\n", error ) ) {
+        ctn_handover_client_free( c );
+        return NULL;
+    }
+
+    while( ( line = client_read_line( c, error ) ) ) {
+        gchar** words;
+
+        if( strcmp( line, "end" ) == 0 ) {
+            g_free( line );
+            return c;
+        }
+
+        words = g_strsplit( line, " ", 3 );
+        if( words[0] && words[1] ) {
+            g_hash_table_replace( c->pairs, g_strdup( words[0] ), g_strdup( words[1] ) );
+        }
+        if( words[0] && words[1] && words[2] && strcmp( words[2], "-" ) != 0 ) {
+            guint64* fingerprint = g_new( guint64, 1 );
+            *fingerprint = g_ascii_strtoull( words[2], NULL, 16 );
+            g_hash_table_replace( c->events, g_strdup( words[0] ), fingerprint );
+        }
+        g_strfreev( words );
+        g_free( line );
+    }
+
+    ctn_handover_client_free( c );
+    return NULL;
+}
+
+void
+ctn_handover_client_free(CtnHandoverClient* c)
+{
+    if( !c ) {
+        return;
+    }
+
+    g_io_stream_close( G_IO_STREAM(c->connection), NULL, NULL );
+    g_object_unref( c->in );
+    g_object_unref( c->connection );
+    g_hash_table_unref( c->pairs );
+    g_hash_table_unref( c->events );
+    g_hash_table_unref( c->sockets );
+    g_slice_free( CtnHandoverClient, c );
+}
+
+GHashTable*
+ctn_handover_client_get_pairs(CtnHandoverClient* c)
+{
+    return c->pairs;
+}
+
+gboolean
+ctn_handover_client_get_last_event(CtnHandoverClient* c,
+        const gchar* udn,
+        guint64* fingerprint)
+{
+    guint64* last = g_hash_table_lookup( c->events, udn );
+
+    if( !last ) {
+        return FALSE;
+    }
+    *fingerprint = *last;
+    return TRUE;
+}
+
+gboolean
+ctn_handover_client_release(CtnHandoverClient* c,
+        GError** error)
+{
+    gchar* line;
+    gchar** names;
+    int i;
+
+    if( !G_IS_UNIX_CONNECTION(c->connection) ) {
+        g_set_error( error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                "the handover socket can't pass descriptors" );
+        return FALSE;
+    }
+
+    if( !client_send( c, "release\n", error ) ) {
+        return FALSE;
+    }
+
+    line = client_read_line( c, error );
+    if( !line ) {
+        return FALSE;
+    }
+    if( !g_str_has_prefix( line, "released" ) ) {
+        g_set_error( error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                "unexpected handover reply %s", line );
+        g_free( line );
+        return FALSE;
+    }
+    names = g_strsplit( line, " ", -1 );
+    g_free( line );
+
+    if( !client_send( c, "send\n", error ) ) {
+        g_strfreev( names );
+        return FALSE;
+    }
+
+    for( i=1; names[i]; i++ ) {
+        GSocket* socket;
+        GList* list;
+        int fd;
+
+        if( !*names[i] ) {
+            continue;
+        }
+
+        fd = g_unix_connection_receive_fd( G_UNIX_CONNECTION(c->connection), NULL, error );
+        if( fd < 0 ) {
+            g_strfreev( names );
+            return FALSE;
+        }
+
+        socket = g_socket_new_from_fd( fd, error );
+        if( !socket ) {
+            close( fd );
+            g_strfreev( names );
+            return FALSE;
+        }
+
+        //appending leaves the head of a list that is already there alone
+        list = g_hash_table_lookup( c->sockets, names[i] );
+        if( list ) {
+            g_list_append( list, socket );
+        } else {
+            g_hash_table_insert( c->sockets, g_strdup( names[i] ), g_list_append( NULL, socket ) );
+        }
+    }
+
+    g_strfreev( names );
+    return TRUE;
+}
+
+GList*
+ctn_handover_client_get_sockets(CtnHandoverClient* c,
+        const gchar* name)
+{
+    return g_hash_table_lookup( c->sockets, name );
+}
@@ -0,0 +1,105 @@
+#ifndef HANDOVER_H
+#define HANDOVER_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Hands the pairs of a running daemon over to a new one, so an upgrade
+ * doesn't cost the tuners their SDV session. The running daemon listens
+ * on a Unix socket. The new one connects, learns the pairs, finds their
+ * mocurs and TAs and then asks for the release: the old daemon lets go
+ * of its TAs without disabling OCTA, passes its listening sockets over
+ * with SCM_RIGHTS and exits. Line protocol:
+ *
+ *   pairs            -> "<udn> <port> <event>" per pair, then "end"
+ *   release          -> "released <name>..." once the TAs are free
+ *   send             -> one file descriptor per name, in order
+ *
+ * event is the fingerprint of the last UDCPMessage event the pair saw, in
+ * hex, or "-". Errors are answered with "ERR <message>". The server side runs on the
+ * main loop, the client side blocks. */
+
+typedef struct _CtnHandover CtnHandover;
+
+typedef struct {
+    /* one "<udn> <port> <event>" line per pair */
+    void (*list_pairs) (GString *out,
+            gpointer user_data);
+    /* let go of the TAs, then ctn_handover_released */
+    void (*release) (gpointer user_data);
+    /* the sockets are gone, the daemon should exit */
+    void (*done) (gpointer user_data);
+} CtnHandoverFuncs;
+
+CtnHandover*
+ctn_handover_new (const CtnHandoverFuncs *funcs,
+        gpointer user_data);
+
+void
+ctn_handover_free (CtnHandover *handover);
+
+gboolean
+ctn_handover_listen_unix (CtnHandover *handover,
+        const gchar *path,
+        GError **error);
+
+/* passed over after the release, name is what the new daemon asks for */
+void
+ctn_handover_pass_socket (CtnHandover *handover,
+        const gchar *name,
+        GSocket *socket);
+
+void
+ctn_handover_released (CtnHandover *handover);
+
+/* a bound, listening socket, one that can be passed over later */
+GSocket*
+ctn_handover_socket_new (GSocketAddress *address,
+        GError **error);
+
+/* whether a daemon still accepts connections on path */
+gboolean
+ctn_handover_socket_in_use (const gchar *path);
+
+/* the same at path, creating its directory, mode 0 leaves the
+ * permissions to the umask. Fails rather than take the path from a
+ * daemon that is still listening on it */
+GSocket*
+ctn_handover_socket_new_unix (const gchar *path,
+        gint mode,
+        GError **error);
+
+typedef struct _CtnHandoverClient CtnHandoverClient;
+
+/* fails when no daemon is listening */
+CtnHandoverClient*
+ctn_handover_client_connect (const gchar *path,
+        GError **error);
+
+void
+ctn_handover_client_free (CtnHandoverClient *client);
+
+/* udn to port path, owned by the client */
+GHashTable*
+ctn_handover_client_get_pairs (CtnHandoverClient *client);
+
+/* the last event the old daemon saw for the pair, FALSE if none */
+gboolean
+ctn_handover_client_get_last_event (CtnHandoverClient *client,
+        const gchar *udn,
+        guint64 *fingerprint);
+
+/* returns once the old daemon has let go of its TAs */
+gboolean
+ctn_handover_client_release (CtnHandoverClient *client,
+        GError **error);
+
+/* sockets passed under name, in order, owned by the client */
+GList*
+ctn_handover_client_get_sockets (CtnHandoverClient *client,
+        const gchar *name);
+
+G_END_DECLS
+
+#endif
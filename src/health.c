@@ -0,0 +1,113 @@
+#include "health.h"
+
+#include <string.h>
+
+#define HEALTH_ERROR_STREAK 3
+//one-way frames come alone, a TA that stopped reading leaves a run of them
+#define HEALTH_UNANSWERED_WRITES 3
+//a stall within this long of a reset means the reset didn't help
+#define HEALTH_ESCALATE_WINDOW ( 120 * G_USEC_PER_SEC )
+
+void
+ctn_health_init(CtnHealth* h,
+        gint64 now)
+{
+    memset( h, 0, sizeof(*h) );
+    h->last_read = now;
+    h->last_write = now;
+}
+
+void
+ctn_health_read(CtnHealth* h,
+        gint64 now,
+        gboolean ok)
+{
+    if( ok ) {
+        h->last_read = now;
+        h->unanswered_since = 0;
+        h->unanswered_writes = 0;
+        h->read_errors = 0;
+    } else {
+        h->read_errors++;
+    }
+}
+
+void
+ctn_health_write_queued(CtnHealth* h)
+{
+    h->writes_pending++;
+}
+
+void
+ctn_health_write_done(CtnHealth* h,
+        gint64 now,
+        gboolean ok)
+{
+    if( h->writes_pending ) {
+        h->writes_pending--;
+    }
+
+    if( ok ) {
+        h->last_write = now;
+        h->write_errors = 0;
+        //the TA answers what it is sent, the clock runs from the oldest write
+        if( !h->unanswered_since ) {
+            h->unanswered_since = now;
+        }
+        h->unanswered_writes++;
+    } else {
+        h->write_errors++;
+    }
+}
+
+void
+ctn_health_write_abandoned(CtnHealth* h)
+{
+    if( h->writes_pending ) {
+        h->writes_pending--;
+    }
+}
+
+void
+ctn_health_forgive(CtnHealth* h)
+{
+    h->unanswered_since = 0;
+    h->unanswered_writes = 0;
+    h->read_errors = 0;
+    h->write_errors = 0;
+}
+
+CtnHealthAction
+ctn_health_check(CtnHealth* h,
+        gint64 now,
+        gint64 timeout,
+        const gchar** reason)
+{
+    CtnHealthAction action;
+
+    if( h->write_errors >= HEALTH_ERROR_STREAK ) {
+        *reason = "writes keep failing";
+    } else if( h->read_errors >= HEALTH_ERROR_STREAK ) {
+        *reason = "reads keep failing";
+    } else if( timeout && h->unanswered_writes >= HEALTH_UNANSWERED_WRITES &&
+            now - h->unanswered_since >= timeout ) {
+        *reason = "no reply to writes";
+    } else {
+        return CTN_HEALTH_OK;
+    }
+
+    //alternate, a reinit that didn't help either is followed by a reset
+    if( h->last_action == CTN_HEALTH_RESET &&
+            now - h->last_action_time < HEALTH_ESCALATE_WINDOW ) {
+        action = CTN_HEALTH_REINIT;
+        h->stall_reinits++;
+    } else {
+        action = CTN_HEALTH_RESET;
+        h->stall_resets++;
+    }
+
+    h->last_action = action;
+    h->last_action_time = now;
+    ctn_health_forgive( h );
+    return action;
+}
@@ -0,0 +1,75 @@
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Tracks whether a TA is still talking. The pair's I/O thread records
+ * every read and write completion and asks ctn_health_check every so
+ * often. A TA that has stopped answering, or whose reads or writes keep
+ * failing, is stalled: the first stall calls for a reset, another one
+ * soon after that reset for a fresh OCTAInit. Not thread safe, the
+ * counters may be read elsewhere for reporting. */
+
+typedef enum {
+    CTN_HEALTH_OK,
+    CTN_HEALTH_RESET,
+    CTN_HEALTH_REINIT,
+} CtnHealthAction;
+
+typedef struct {
+    gint64 last_read;
+    gint64 last_write;
+    gint64 unanswered_since; //first write completed after the last read, 0 if none
+    guint unanswered_writes; //completed since the last read
+    guint writes_pending;
+    guint read_errors;       //in a row
+    guint write_errors;      //in a row
+
+    CtnHealthAction last_action;
+    gint64 last_action_time;
+    guint stall_resets;
+    guint stall_reinits;
+} CtnHealth;
+
+/* times are monotonic microseconds */
+void
+ctn_health_init (CtnHealth *health,
+        gint64 now);
+
+void
+ctn_health_read (CtnHealth *health,
+        gint64 now,
+        gboolean ok);
+
+void
+ctn_health_write_queued (CtnHealth *health);
+
+void
+ctn_health_write_done (CtnHealth *health,
+        gint64 now,
+        gboolean ok);
+
+/* a write that ended without telling anything about the TA, cancelled or
+ * cut short by its deadline */
+void
+ctn_health_write_abandoned (CtnHealth *health);
+
+/* drops the evidence so far, for when transfers fail on purpose */
+void
+ctn_health_forgive (CtnHealth *health);
+
+/* timeout is how long a TA may go without a read completing while several
+ * writes did, 0 only looks at error streaks. A frame or two that gets no
+ * reply is no stall. reason is static and set unless OK is returned.
+ * Returning anything but OK counts as having acted on it. */
+CtnHealthAction
+ctn_health_check (CtnHealth *health,
+        gint64 now,
+        gint64 timeout,
+        const gchar **reason);
+
+G_END_DECLS
+
+#endif
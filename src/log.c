@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+
+#define LOG_RING_SIZE 4096 //a power of two
+#define LOG_MESSAGE_SIZE 232
+#define LOG_FLUSH_INTERVAL 20 //ms
+
+typedef struct {
+    volatile gint sequence;
+    guint8 domain;
+    guint8 level;
+    gint64 time;
+    gchar message[LOG_MESSAGE_SIZE];
+} LogEntry;
+
+static const gchar* domain_names[CTN_LOG_DOMAINS] = {
+    [CTN_LOG_CORE] = "core",
+    [CTN_LOG_USB] = "usb",
+    [CTN_LOG_UPNP] = "upnp",
+    [CTN_LOG_RESET] = "reset",
+    [CTN_LOG_TRAFFIC] = "traffic",
+};
+
+static const gchar* level_names[] = {
+    [CTN_LOG_LEVEL_ERROR] = "error",
+    [CTN_LOG_LEVEL_WARNING] = "warning",
+    [CTN_LOG_LEVEL_INFO] = "info",
+    [CTN_LOG_LEVEL_DEBUG] = "debug",
+};
+
+volatile gint ctn_log_levels[CTN_LOG_DOMAINS] = {
+    [CTN_LOG_CORE] = CTN_LOG_LEVEL_INFO,
+    [CTN_LOG_USB] = CTN_LOG_LEVEL_INFO,
+    [CTN_LOG_UPNP] = CTN_LOG_LEVEL_INFO,
+    [CTN_LOG_RESET] = CTN_LOG_LEVEL_INFO,
+    [CTN_LOG_TRAFFIC] = CTN_LOG_LEVEL_INFO,
+};
+
+/* A bounded queue with a sequence number per entry. A producer claims a
+ * position by CAS on enqueue_pos and publishes the entry by setting its
+ * sequence to pos + 1. The flush thread is the only consumer, and hands
+ * the entry back with pos + LOG_RING_SIZE. */
+static LogEntry ring[LOG_RING_SIZE];
+static volatile gint enqueue_pos;
+static guint dequeue_pos;
+static volatile gint dropped;
+static guint dropped_reported;
+
+static GThread* flusher;
+static GMutex flush_lock;
+static GCond flush_cond;
+static gboolean flush_stop;
+
+static void
+entry_print(
+        CtnLogDomain domain,
+        CtnLogLevel level,
+        gint64 time,
+        const gchar* message)
+{
+    FILE* out = level <= CTN_LOG_LEVEL_WARNING ? stderr : stdout;
+    time_t seconds = time / G_USEC_PER_SEC;
+    struct tm tm;
+
+    localtime_r( &seconds, &tm );
+    fprintf( out, "%02d:%02d:%02d.%03d %-7s %s: %s\n",
+            tm.tm_hour, tm.tm_min, tm.tm_sec,
+            (gint)( time % G_USEC_PER_SEC / 1000 ),
+            level_names[level], domain_names[domain], message );
+}
+
+//returns the number of entries written
+static guint
+ring_drain(void)
+{
+    guint written = 0;
+    guint lost;
+
+    for( ;; ) {
+        LogEntry* e = &ring[dequeue_pos & ( LOG_RING_SIZE - 1 )];
+        if( (gint)( g_atomic_int_get( &e->sequence ) - ( dequeue_pos + 1 ) ) < 0 ) {
+            break;
+        }
+
+        entry_print( e->domain, e->level, e->time, e->message );
+        g_atomic_int_set( &e->sequence, dequeue_pos + LOG_RING_SIZE );
+        dequeue_pos++;
+        written++;
+    }
+
+    lost = g_atomic_int_get( &dropped ) - dropped_reported;
+    if( lost ) {
+        gchar* message = g_strdup_printf( "log ring full, %u messages dropped", lost );
+        entry_print( CTN_LOG_CORE, CTN_LOG_LEVEL_WARNING, g_get_real_time(), message );
+        g_free( message );
+        dropped_reported += lost;
+    }
+
+    if( written || lost ) {
+        fflush( stdout );
+        fflush( stderr );
+    }
+    return written;
+}
+
+static gpointer
+flush_thread(gpointer data)
+{
+    g_mutex_lock( &flush_lock );
+    while( !flush_stop ) {
+        gint64 until = g_get_monotonic_time() + LOG_FLUSH_INTERVAL * G_TIME_SPAN_MILLISECOND;
+
+        g_mutex_unlock( &flush_lock );
+        ring_drain();
+        g_mutex_lock( &flush_lock );
+
+        if( !flush_stop ) {
+            g_cond_wait_until( &flush_cond, &flush_lock, until );
+        }
+    }
+    g_mutex_unlock( &flush_lock );
+
+    ring_drain();
+    return NULL;
+}
+
+void
+ctn_log_write(CtnLogDomain domain,
+        CtnLogLevel level,
+        const gchar* format,
+        ...)
+{
+    va_list args;
+    LogEntry* e;
+    guint pos;
+
+    if( !g_atomic_pointer_get( &flusher ) ) {
+        gchar message[LOG_MESSAGE_SIZE];
+        va_start( args, format );
+        g_vsnprintf( message, sizeof(message), format, args );
+        va_end( args );
+        entry_print( domain, level, g_get_real_time(), message );
+        return;
+    }
+
+    for( ;; ) {
+        pos = g_atomic_int_get( &enqueue_pos );
+        e = &ring[pos & ( LOG_RING_SIZE - 1 )];
+        gint diff = (gint)( g_atomic_int_get( &e->sequence ) - pos );
+
+        if( diff == 0 ) {
+            if( g_atomic_int_compare_and_exchange( &enqueue_pos, pos, pos + 1 ) ) {
+                break;
+            }
+        } else if( diff < 0 ) {
+            //full, never wait for the flush thread
+            g_atomic_int_inc( &dropped );
+            return;
+        }
+    }
+
+    e->domain = domain;
+    e->level = level;
+    e->time = g_get_real_time();
+    va_start( args, format );
+    g_vsnprintf( e->message, sizeof(e->message), format, args );
+    va_end( args );
+    g_atomic_int_set( &e->sequence, pos + 1 );
+
+    //problems shouldn't wait for the next flush, and neither should a
+    //burst that has filled half the ring
+    if( level <= CTN_LOG_LEVEL_WARNING || ( pos & ( LOG_RING_SIZE / 2 - 1 ) ) == 0 ) {
+        g_mutex_lock( &flush_lock );
+        g_cond_signal( &flush_cond );
+        g_mutex_unlock( &flush_lock );
+    }
+}
+
+void
+ctn_log_init(void)
+{
+    guint i;
+
+    if( flusher ) {
+        return;
+    }
+
+    for( i=0; i<LOG_RING_SIZE; i++ ) {
+        ring[i].sequence = i;
+    }
+    enqueue_pos = 0;
+    dequeue_pos = 0;
+    flush_stop = FALSE;
+
+    g_atomic_pointer_set( &flusher, g_thread_new( "log", flush_thread, NULL ) );
+}
+
+void
+ctn_log_shutdown(void)
+{
+    GThread* thread = g_atomic_pointer_get( &flusher );
+
+    if( !thread ) {
+        return;
+    }
+
+    g_mutex_lock( &flush_lock );
+    flush_stop = TRUE;
+    g_cond_signal( &flush_cond );
+    g_mutex_unlock( &flush_lock );
+
+    //a writer racing with this may leave its message in the ring
+    g_thread_join( thread );
+    g_atomic_pointer_set( &flusher, NULL );
+}
+
+void
+ctn_log_set_level(CtnLogDomain domain,
+        CtnLogLevel level)
+{
+    g_atomic_int_set( &ctn_log_levels[domain], level );
+}
+
+static gboolean
+parse_level(
+        const gchar* name,
+        CtnLogLevel* level)
+{
+    gint i;
+    for( i=0; i<G_N_ELEMENTS(level_names); i++ ) {
+        if( g_ascii_strcasecmp( name, level_names[i] ) == 0 ) {
+            *level = i;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+gboolean
+ctn_log_set_levels(const gchar* spec,
+        GError** error)
+{
+    gchar** items = g_strsplit( spec, ",", -1 );
+    gint levels[CTN_LOG_DOMAINS];
+    gboolean ok = TRUE;
+    gint i, d;
+
+    for( d=0; d<CTN_LOG_DOMAINS; d++ ) {
+        levels[d] = g_atomic_int_get( &ctn_log_levels[d] );
+    }
+
+    //checked in full before anything changes
+    for( i=0; items[i] && ok; i++ ) {
+        gchar* item = g_strstrip( items[i] );
+        gchar* eq = strchr( item, '=' );
+        CtnLogLevel level;
+
+        if( !eq ) {
+            ok = parse_level( item, &level );
+            for( d=0; ok && d<CTN_LOG_DOMAINS; d++ ) {
+                levels[d] = level;
+            }
+        } else {
+            *eq = '\0';
+            ok = parse_level( g_strstrip( eq + 1 ), &level );
+            for( d=0; ok && d<CTN_LOG_DOMAINS; d++ ) {
+                if( strcmp( g_strstrip( item ), domain_names[d] ) == 0 ) {
+                    levels[d] = level;
+                    break;
+                }
+            }
+            ok = ok && d < CTN_LOG_DOMAINS;
+        }
+    }
+
+    if( ok ) {
+        for( d=0; d<CTN_LOG_DOMAINS; d++ ) {
+            ctn_log_set_level( d, levels[d] );
+        }
+    } else {
+        g_set_error( error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                "bad log level '%s', expected a level or a list of "
+                "core|usb|upnp|reset|traffic=error|warning|info|debug", spec );
+    }
+
+    g_strfreev( items );
+    return ok;
+}
+
+guint
+ctn_log_get_dropped(void)
+{
+    return g_atomic_int_get( &dropped );
+}
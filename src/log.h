@@ -0,0 +1,72 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Leveled logging with a verbosity per subsystem. A message below its
+ * subsystem's level costs one comparison. Others are formatted by the
+ * caller into a lock-free ring and written out by a flush thread, so no
+ * caller ever blocks on stdout. When the ring is full messages are dropped
+ * and counted. Before ctn_log_init() and after ctn_log_shutdown() messages
+ * are written directly. */
+
+typedef enum {
+    CTN_LOG_CORE,
+    CTN_LOG_USB,
+    CTN_LOG_UPNP,
+    CTN_LOG_RESET,
+    CTN_LOG_TRAFFIC,
+    CTN_LOG_DOMAINS
+} CtnLogDomain;
+
+typedef enum {
+    CTN_LOG_LEVEL_ERROR,
+    CTN_LOG_LEVEL_WARNING,
+    CTN_LOG_LEVEL_INFO,
+    CTN_LOG_LEVEL_DEBUG
+} CtnLogLevel;
+
+extern volatile gint ctn_log_levels[CTN_LOG_DOMAINS];
+
+#define ctn_log(domain, level, ...) G_STMT_START { \
+    if( G_UNLIKELY( (gint)(level) <= g_atomic_int_get( &ctn_log_levels[domain] ) ) ) { \
+        ctn_log_write( (domain), (level), __VA_ARGS__ ); \
+    } \
+} G_STMT_END
+
+#define ctn_error(domain, ...) ctn_log( domain, CTN_LOG_LEVEL_ERROR, __VA_ARGS__ )
+#define ctn_warning(domain, ...) ctn_log( domain, CTN_LOG_LEVEL_WARNING, __VA_ARGS__ )
+#define ctn_info(domain, ...) ctn_log( domain, CTN_LOG_LEVEL_INFO, __VA_ARGS__ )
+#define ctn_debug(domain, ...) ctn_log( domain, CTN_LOG_LEVEL_DEBUG, __VA_ARGS__ )
+
+void
+ctn_log_write (CtnLogDomain domain,
+        CtnLogLevel level,
+        const gchar *format,
+        ...) G_GNUC_PRINTF (3, 4);
+
+/* starts the flush thread */
+void
+ctn_log_init (void);
+
+/* writes out what is left and stops the flush thread */
+void
+ctn_log_shutdown (void);
+
+void
+ctn_log_set_level (CtnLogDomain domain,
+        CtnLogLevel level);
+
+/* "debug" for every subsystem, or a list like "usb=debug,traffic=info" */
+gboolean
+ctn_log_set_levels (const gchar *spec,
+        GError **error);
+
+guint
+ctn_log_get_dropped (void);
+
+G_END_DECLS
+
+#endif
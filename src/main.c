@@ -10,7 +10,24 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "action.h"
+#include "affinity.h"
+#include "base64.h"
+#include "log.h"
+#include "metrics.h"
 #include "octa_client.h"
+#include "pool.h"
+#include "registry.h"
+#include "stats.h"
+#include "worker.h"
+#include "handoff.h"
+#include "usbbuf.h"
+#include "control.h"
+#include "health.h"
+#include "capture.h"
+#include "classify.h"
+#include "events.h"
+#include "handover.h"
 
 #define CISCO_TA_VENDOR_ID 0x05a6
 #define CISCO_TA_PRODUCT_ID 0x0008
@@ -22,35 +39,227 @@
 #define TA_TIMEOUT 10000 //ms
 #define TA_BUFFER_SIZE 16*1024
 #define TA_RECV_BUFFERS 5
+#define TA_MIN_BUFFER_SIZE 4*1024
+#define TA_MAX_BUFFER_SIZE 64*1024
+#define TA_MIN_RECV_BUFFERS 2
+#define TA_MAX_RECV_BUFFERS 16
+//bulk reads stay a multiple of the high speed packet size
+#define TA_PACKET_SIZE 512
+#define RING_ADAPT_INTERVAL 5000 //ms
+#define HEALTH_INTERVAL 1000 //ms
+#define RING_IDLE_FRAMES 5
+//frame buffers come in two sizes, the large one holds a full TA read in base64
+#define PAIR_SMALL_BUFFER 1024
+#define PAIR_POOL_SLAB 8
+#define TA_RESET_ATTEMPTS 3
+//a write about to miss its deadline still gets this long
+#define TA_MIN_WRITE_TIMEOUT 100 //ms
+//how long a taking over daemon looks for the mocurs of the running one
+#define TAKEOVER_TIMEOUT 10 //s
+//and how long the running one keeps sending frames already read
+#define HANDOVER_DRAIN 2000 //ms
 
 static guint16 g_bus = 0xFFFF;
 static guint16 g_addr = 0xFFFF;
+static gboolean pair_threads = FALSE;
+static gint usb_nice = -10;
+static gint upstream_window = 1;
+static gint upstream_queue = 16;
+static gint upstream_retries = 1;
+static gint downstream_window = 2;
+static gint downstream_queue = 32;
+static gint downstream_deadline = 5000;
+static gchar* downstream_overflow_name = NULL;
+static gint ta_buffer_size = 0;
+static gint ta_buffers = 0;
+static gboolean adaptive_ring = FALSE;
+static gint stall_timeout = 20;
+static gint event_dedup = 1000;
+static gint metrics_port = 0;
+static gchar* metrics_socket = NULL;
+static gchar* log_levels = NULL;
+static gchar* control_socket = CTN_STATE_DIR "/control";
+static gchar* handover_socket = CTN_STATE_DIR "/handover";
+static gboolean takeover = FALSE;
+static gchar* capture_path = NULL;
+static gboolean classify = FALSE;
+static gchar* message_types = NULL;
+static gchar* pairing_cache = CTN_STATE_DIR "/pairings";
+static gint pairing_grace = 30;
+static gchar* search_target = MOCUR_DEVICE_TYPE;
+static gchar** discovery_allow = NULL;
+static gchar** interfaces = NULL;
+
+typedef enum {
+    DOWNSTREAM_DROP_OLDEST,
+    DOWNSTREAM_DROP_NEWEST,
+} DownstreamOverflow;
+
+static DownstreamOverflow downstream_overflow = DOWNSTREAM_DROP_OLDEST;
+
+//SOAP actions towards the mocur, see action.h
+static CtnActionPolicy upstream_policy = { 5000, 0, 50, 1000 };
+static const CtnActionPolicy octa_init_policy = { 5000, 0, 250, 30000 };
+static const CtnActionPolicy octa_disable_policy = { 5000, 3, 250, 2000 };
+static const CtnActionPolicy usb_reset_complete_policy = { 3000, 3, 250, 2000 };
+//only the backoff is used, a lost subscription is retried until it delivers
+static const CtnActionPolicy resubscribe_policy = { 0, 0, 250, 30000 };
+
+//counters exported per action name
+static const gchar* const octa_actions[] = {
+    "SendMessageToUDCP",
+    "OCTAInit",
+    "QueryStateVariable",
+    "USBResetComplete",
+};
 
 typedef struct _Pair Pair;
 
+typedef enum {
+    TA_RESET_IDLE = 0,
+    TA_RESET_CANCEL,
+    TA_RESET_RELEASE,
+    TA_RESET_RESET,
+    TA_RESET_CLAIM,
+    TA_RESET_COMPLETE,
+    TA_RESET_STAGES
+} TAResetStage;
+
+static const struct {
+    const gchar* name;
+    guint timeout; //ms
+} ta_reset_stages[TA_RESET_STAGES] = {
+    [TA_RESET_IDLE] = { "idle", 0 },
+    [TA_RESET_CANCEL] = { "cancel", 2000 },
+    [TA_RESET_RELEASE] = { "release", 2000 },
+    [TA_RESET_RESET] = { "reset", 10000 },
+    [TA_RESET_CLAIM] = { "claim", 2000 },
+    [TA_RESET_COMPLETE] = { "reset complete", 10000 },
+};
+
+typedef struct {
+    const gchar* name;
+    guint16 vid;
+    guint16 pid;
+    gsize buffer_size;
+    guint buffers;
+} TAProfile;
+
+static const TAProfile ta_profiles[] = {
+    { "Motorola", MOT_TA_VENDOR_ID, MOT_TA_PRODUCT_ID, TA_BUFFER_SIZE, TA_RECV_BUFFERS },
+    { "Cisco", CISCO_TA_VENDOR_ID, CISCO_TA_PRODUCT_ID, TA_BUFFER_SIZE, TA_RECV_BUFFERS },
+};
+
 typedef struct {
     Pair* p;
     GCancellable* cancellable;
-    guchar buffer[TA_BUFFER_SIZE];
+    gboolean in_flight;
+    gsize size;
+    guchar* buffer;
+    gboolean pinned;
 } TABuffer;
 
 struct _Pair {
     GUPnPDeviceProxy* mocur;
     GUPnPServiceProxy* octa;
+    CtnActionQueue* actions; //the mocur's, shared with later pairings
     GUsbDevice* ta;
-    TABuffer ta_buffers[TA_RECV_BUFFERS];
+    const TAProfile* profile;
+
+    //the receive ring, only the first ta_buffer_count buffers are used
+    TABuffer ta_buffers[TA_MAX_RECV_BUFFERS];
+    guint ta_buffer_count;
+    gsize ta_buffer_size;
+    gsize ta_buffer_max;
+    GSource* ring_timer;
+    gsize ring_max_frame;
+    guint ring_frames;
+    guint ring_starved;
+
+    gint reads_pending;
+    gboolean reads_stopped;
+    guint ta_read_errors;
+    volatile gint reads_parked;
+    CtnHealth health;
+    GSource* health_timer;
+    CtnEventFilter events; //UDCPMessage events, on the main loop
+    guint resubscribe_timer;
+    guint resubscribe_attempts; //since the last delivered event
+    gboolean inherited;    //OCTA was left enabled by the daemon handing over
+    CtnCapture* capture; //NULL when not capturing or the capture failed
+    guint16 capture_id;
+    CtnMessageStats* messages; //NULL unless classifying
+    CtnWorker* worker;
+    CtnHandoff* handoff; //frames to the main loop
+
+    CtnPool* message_pool;
+    CtnPool* small_buffers;
+    CtnPool* large_buffers;
+    gsize large_buffer_size;
+
+    //frames on their way to the mocur, owned by the main loop
+    GQueue upstream[CTN_LANES];
+    GQueue upstream_sent;
+    volatile gint upstream_pending;
+    guint upstream_dropped;
+
+    //decoded frames waiting for a TA write, owned by the worker
+    GQueue downstream[CTN_LANES];
+    guint downstream_queued;
+    guint downstream_in_flight;
+    GCancellable* write_cancellable; //the writes in flight, a reset cancels them
+    guint downstream_overflows;
+    guint downstream_expired;
+
+    //upstream is only written on the main loop, downstream on the worker
+    CtnFlowStats upstream_stats;
+    CtnFlowStats downstream_stats;
+    guint ta_comm_errors;
+
+    TAResetStage reset_stage;
+    guint reset_generation;
+    guint reset_attempt;
+    gint64 reset_started;
+    GSource* reset_timeout;
+    gboolean reset_stage_running; //a release, reset or claim hasn't returned
+    gboolean reset_retry;         //the next attempt waits for it
+    guint resets;
+    gint64 last_reset_duration; //us
+    gint64 reset_duration_total; //us
+
     gint refs;
 };
 
 typedef struct {
-    GPtrArray* tas;
-    GPtrArray* mocurs;
+    CtnRegistry* registry;
+    CtnAffinity* affinity;
+    gint64 affinity_until; //devices wait for their recorded partner until then
     GMainLoop* main_loop;
-    GUPnPContext* context;
-    GUPnPControlPoint* cp;
+    GUPnPContextManager* context_manager; //NULL with fixed interfaces
+    GPtrArray* control_points;            //of fixed interfaces
+    GHashTable* standby; //UDN to the mocurs seen again on other interfaces
     GUsbContext* usb_context;
     GUsbDeviceList* usb_list;
-    GPtrArray* pairs;
+    CtnWorker* usb_worker;  //TA I/O of pairs without their own thread
+    CtnHandoff* upstream;   //TA frames from the USB threads
+    CtnCapture* capture;
+    guint captured_pairs;
+    CtnClassifier* classifier;
+    CtnMetrics* metrics;
+    CtnControl* control;
+
+    //handing over to a new daemon
+    CtnHandover* handover;
+    gboolean handed_over; //the TAs were let go, nothing is claimed any more
+    guint releasing;      //pairs still letting go of their TA
+    gint64 drain_until;
+
+    //taking over from a running one
+    CtnHandoverClient* takeover; //until it let go of its TAs
+    GPtrArray* takeover_tas;     //found meanwhile, claimed after the release
+    guint takeover_timer;
+    GHashTable* inherited;       //UDNs of the pairs taken over, to their last event
+    gint exit_status;
 } CtnTa;
 
 static void
@@ -61,11 +270,27 @@ ta_message_ready(
 
 static gboolean
 enable_octa(
-        gpointer userdata);
+        Pair* p);
 
 static gboolean
 toggle_octa(
-        gpointer userdata);
+        Pair* p);
+
+static const TAProfile*
+ta_profile_lookup(
+        GUsbDevice* device)
+{
+    guint16 vid = g_usb_device_get_vid( device );
+    guint16 pid = g_usb_device_get_pid( device );
+    int i;
+
+    for( i=0; i<G_N_ELEMENTS(ta_profiles); i++ ) {
+        if( ta_profiles[i].vid == vid && ta_profiles[i].pid == pid ) {
+            return &ta_profiles[i];
+        }
+    }
+    return NULL;
+}
 
 static Pair*
 pair_new()
@@ -75,11 +300,55 @@ pair_new()
     return p;
 }
 
+static void
+pair_print_pool(
+        GString* out,
+        CtnPool* pool)
+{
+    CtnPoolStats stats;
+    ctn_pool_get_stats( pool, &stats );
+    g_string_append_printf( out, "\t%s: %u in use, high water %u of %u (%u slabs of %" G_GSIZE_FORMAT " bytes)\n",
+            stats.name, stats.in_use, stats.high_water, stats.capacity,
+            stats.slabs, stats.object_size);
+}
+
+static void
+pair_print_actions(
+        GString* out,
+        Pair* p)
+{
+    CtnActionQueueStats stats;
+    CtnActionCounters counters;
+    int i;
+
+    ctn_action_queue_get_stats( p->actions, &stats );
+    g_string_append_printf( out, "\tmocur breaker %s, %u failures in a row, %u trips, %u actions waiting\n",
+            ctn_breaker_state_name( stats.state ), stats.consecutive_failures,
+            stats.trips, stats.parked);
+
+    for( i=0; i<G_N_ELEMENTS(octa_actions); i++ ) {
+        ctn_action_queue_get_counters( p->actions, octa_actions[i], &counters );
+        g_string_append_printf( out, "\t%s: %u attempts, %u retries, %u timeouts, %u failed\n",
+                octa_actions[i], counters.attempts, counters.retries,
+                counters.timeouts, counters.failures);
+    }
+}
+
+static void
+pair_print_pools(
+        GString* out,
+        Pair* p)
+{
+    pair_print_pool( out, p->message_pool );
+    pair_print_pool( out, p->small_buffers );
+    pair_print_pool( out, p->large_buffers );
+}
+
 static void
 pair_ref(Pair* p)
 {
     if(!p) { 
-        g_print("!pair on ref\n");        
+        ctn_warning( CTN_LOG_CORE, "!pair on ref" );
         return;
     }
 
@@ -89,460 +358,1919 @@ pair_ref(Pair* p)
 static void
 pair_unref(Pair* p)
 {
+    int i;
+
     if(!p) { 
-        g_print("!pair on unref\n");        
+        ctn_warning( CTN_LOG_CORE, "!pair on unref" );
         return;
     }
 
     if( g_atomic_int_dec_and_test( &p->refs ) ) {
-        g_free( p );
+        ctn_worker_release( p->worker );
+        if( p->message_pool ) {
+            GString* out = g_string_new( "pair pools at teardown:\n" );
+            pair_print_pools( out, p );
+            ctn_debug( CTN_LOG_CORE, "%s", out->str );
+            g_string_free( out, TRUE );
+        }
+        for( i=0; i<TA_MAX_RECV_BUFFERS; i++ ) {
+            ctn_usb_buffer_free( p->ta_buffers[i].buffer, p->ta_buffers[i].size,
+                    p->ta_buffers[i].pinned );
+            if( p->ta_buffers[i].cancellable ) {
+                g_object_unref( p->ta_buffers[i].cancellable );
+            }
+        }
+        if( p->write_cancellable ) {
+            g_object_unref( p->write_cancellable );
+        }
+        ctn_pool_destroy( p->message_pool );
+        ctn_message_stats_free( p->messages );
+        ctn_pool_destroy( p->small_buffers );
+        ctn_pool_destroy( p->large_buffers );
+        //whichever device is still there went back to the registry with its own ref
+        if( p->mocur ) {
+            g_object_unref( p->mocur );
+        }
+        if( p->ta ) {
+            g_object_unref( p->ta );
+        }
+        g_slice_free( Pair, p );
+    }
+}
+
+//run func on the pair's I/O thread, func owns a pair ref
+static void
+pair_invoke(
+        Pair* p,
+        GSourceFunc func)
+{
+    pair_ref(p);
+    ctn_worker_invoke( p->worker, func, p );
+}
+
+//frames are captured on the pair's I/O thread
+static void
+pair_capture(
+        Pair* p,
+        CtnCaptureType type,
+        gconstpointer data,
+        gsize len)
+{
+    if( p->capture && !ctn_capture_write( p->capture, p->capture_id, type, data, len ) ) {
+        ctn_warning( CTN_LOG_CORE, "capture failed, no longer capturing pair %u", p->capture_id );
+        p->capture = NULL;
+    }
+}
+
+//everything is normal unless message types are known
+static CtnLane
+pair_lane(
+        Pair* p,
+        const guchar* frame,
+        gsize len)
+{
+    if( !p->messages ) {
+        return CTN_LANE_NORMAL;
+    }
+    return ctn_classifier_get_lane( p->messages->classifier, frame, len );
+}
+
+typedef struct {
+    CtnHandoffLink link; //first, see handoff.h
+    Pair* p;
+    gchar* message;
+    gsize len;
+    CtnPool* buffer_pool;
+    CtnAction* action;
+    gint64 received; //when it came off the TA or out of GENA
+    gsize bytes;     //binary frame size, before encoding
+    CtnLane lane;
+    guint timeout;   //ms the TA write was given
+    GList node;      //in one of the pair's queues at a time
+} PairMessage;
+
+//a frame with room for size bytes, from the pair's pools when it fits
+static PairMessage*
+pair_message_new(
+        Pair* p,
+        gsize size)
+{
+    PairMessage* pm = ctn_pool_alloc0( p->message_pool );
+    pair_ref(p);
+    pm->p = p;
+    pm->node.data = pm;
+
+    if( size <= PAIR_SMALL_BUFFER ) {
+        pm->buffer_pool = p->small_buffers;
+    } else if( size <= p->large_buffer_size ) {
+        pm->buffer_pool = p->large_buffers;
+    }
+
+    if( pm->buffer_pool ) {
+        pm->message = ctn_pool_alloc( pm->buffer_pool );
+    } else {
+        pm->message = g_malloc( size );
+    }
+    return pm;
+}
+
+//the queues go by the frame's own node, nothing is allocated per frame
+static void
+pair_queue_push(
+        GQueue* queue,
+        PairMessage* pm)
+{
+    g_queue_push_tail_link( queue, &pm->node );
+}
+
+static PairMessage*
+pair_queue_pop(
+        GQueue* queue)
+{
+    GList* node = g_queue_pop_head_link( queue );
+    return node ? node->data : NULL;
+}
+
+static PairMessage*
+pair_queue_pop_tail(
+        GQueue* queue)
+{
+    GList* node = g_queue_pop_tail_link( queue );
+    return node ? node->data : NULL;
+}
+
+static void
+pair_message_free(
+        PairMessage* pm)
+{
+    Pair* p = pm->p;
+
+    if( pm->buffer_pool ) {
+        ctn_pool_release( pm->buffer_pool, pm->message );
+    } else {
+        g_free( pm->message );
+    }
+    ctn_pool_release( p->message_pool, pm );
+
+    //last, the pools go away with the pair
+    pair_unref(p);
+}
+
+static void
+submit_ta_buffer(
+        Pair* p,
+        TABuffer* tab)
+{
+    if( p->reads_stopped || !p->ta ) {
+        return;
+    }
+
+    //buffers are sized when idle, so resizing the ring never cancels a read
+    if( tab->size != p->ta_buffer_size ) {
+        ctn_usb_buffer_free( tab->buffer, tab->size, tab->pinned );
+        tab->buffer = ctn_usb_buffer_alloc( p->ta_buffer_size, &tab->pinned );
+        tab->size = p->ta_buffer_size;
+    }
+
+    if( !tab->cancellable ) {
+        tab->cancellable = g_cancellable_new();
+    } else {
+        g_cancellable_reset( tab->cancellable );
     }
+
+    pair_ref(p);
+    p->reads_pending++;
+
+    tab->p = p;
+    tab->in_flight = TRUE;
+    g_usb_device_bulk_transfer_async(
+            p->ta,
+            TA_EP_READ,
+            tab->buffer,
+            tab->size,
+            0,
+            tab->cancellable,
+            ta_message_ready,
+            tab);
 }
 
+//put every idle buffer of the ring in flight
 static void
 submit_ta_buffers(
         Pair* p)
 {
     int i;
-    for( i=0; i<TA_RECV_BUFFERS; i++ ) {
+    for( i=0; i<p->ta_buffer_count; i++ ) {
         TABuffer* tab = &p->ta_buffers[i];
-        if( !tab->cancellable ) {
-            tab->cancellable = g_cancellable_new();
-        } else {
-            g_cancellable_reset( tab->cancellable );
+        if( !tab->in_flight ) {
+            submit_ta_buffer( p, tab );
         }
+    }
+}
 
-        pair_ref(p);
+static gboolean
+upstream_backlogged(
+        Pair* p)
+{
+    return g_atomic_int_get( &p->upstream_pending ) >= upstream_queue;
+}
+
+static gboolean
+resume_ta_reads(
+        Pair* p)
+{
+    //a reset in progress resubmits every buffer once it is done
+    if( !p->reads_stopped &&
+            ( p->reset_stage == TA_RESET_IDLE || p->reset_stage == TA_RESET_COMPLETE ) ) {
+        submit_ta_buffers(p);
+    }
+
+    pair_unref(p);
+    return FALSE;
+}
 
-        tab->p = p;
-        g_usb_device_bulk_transfer_async(
-                p->ta,
-                TA_EP_READ,
-                tab->buffer,
-                TA_BUFFER_SIZE,
-                0,
-                tab->cancellable,
-                ta_message_ready,
-                tab);
+static void
+schedule_resume_ta_reads(
+        Pair* p)
+{
+    if( g_atomic_int_compare_and_exchange( &p->reads_parked, 1, 0 ) ) {
+        pair_ref(p);
+        ctn_worker_idle_add( p->worker, (GSourceFunc)resume_ta_reads, p );
     }
 }
 
-static void usb_reset_complete_finished(
-        GUPnPServiceProxy *proxy,
-        GError *error,
-        gpointer userdata)
+static void
+resubmit_ta_buffer(
+        Pair* p,
+        TABuffer* tab)
 {
-    g_print("usb reset complete finished\n");
+    if( tab - p->ta_buffers >= p->ta_buffer_count ) {
+        //the ring shrank, retire this one
+        ctn_usb_buffer_free( tab->buffer, tab->size, tab->pinned );
+        tab->buffer = NULL;
+        tab->size = 0;
+    } else if( upstream_backlogged(p) ) {
+        //the mocur isn't keeping up, stop reading until the queue drains
+        g_atomic_int_set( &p->reads_parked, 1 );
+        if( g_atomic_int_get( &p->upstream_pending ) <= upstream_queue / 2 ) {
+            schedule_resume_ta_reads(p);
+        }
+    } else {
+        submit_ta_buffer( p, tab );
+    }
 }
 
 static gboolean
-reset_ta_step2(
+ring_adapt(
         Pair* p)
 {
-    GError* error = NULL;
-    
-    if( !g_usb_device_reset( p->ta, &error ) ) {
-        g_printerr("ta reset failed %s\n", error->message);
-        g_error_free( error );
-        error = NULL;
+    guint count = p->ta_buffer_count;
+    gsize size = p->ta_buffer_size;
+
+    //a frame arrived with no other read queued behind it, go deeper
+    if( p->ring_starved ) {
+        count = MIN( count * 2, TA_MAX_RECV_BUFFERS );
+    } else if( p->ring_frames < RING_IDLE_FRAMES ) {
+        count = MAX( count - 1, TA_MIN_RECV_BUFFERS );
     }
 
-    if( !g_usb_device_claim_interface( p->ta, 0x00,
-            G_USB_DEVICE_CLAIM_INTERFACE_BIND_KERNEL_DRIVER,
-            &error) ) {
-        g_printerr("failed to claim if %s\n", error->message);
-        g_error_free(error);
+    //keep buffers well above the largest frame so none gets split
+    if( p->ring_frames ) {
+        size = TA_MIN_BUFFER_SIZE;
+        while( size < p->ring_max_frame * 4 && size < p->ta_buffer_max ) {
+            size *= 2;
+        }
+        size = MIN( size, p->ta_buffer_max );
     }
 
-    g_print("reset done\n");
-    usb_reset_complete_async( p->octa, usb_reset_complete_finished, p );
+    if( count != p->ta_buffer_count || size != p->ta_buffer_size ) {
+        ctn_info( CTN_LOG_USB, "ta ring %u x %" G_GSIZE_FORMAT " -> %u x %" G_GSIZE_FORMAT " bytes "
+                "(%u frames, largest %" G_GSIZE_FORMAT ", %u starved)",
+                p->ta_buffer_count, p->ta_buffer_size, count, size,
+                p->ring_frames, p->ring_max_frame, p->ring_starved);
+    }
 
-    submit_ta_buffers(p);
+    p->ta_buffer_size = size;
+    if( count > p->ta_buffer_count ) {
+        p->ta_buffer_count = count;
+        if( !p->reads_stopped && p->reset_stage == TA_RESET_IDLE && !upstream_backlogged(p) ) {
+            submit_ta_buffers(p);
+        }
+    } else {
+        //surplus buffers retire as their reads complete
+        p->ta_buffer_count = count;
+    }
+
+    p->ring_frames = 0;
+    p->ring_starved = 0;
+    p->ring_max_frame = 0;
+    return TRUE;
+}
+
+static void
+ring_stop(
+        Pair* p)
+{
+    if( p->ring_timer ) {
+        g_source_destroy( p->ring_timer );
+        g_source_unref( p->ring_timer );
+        p->ring_timer = NULL;
+    }
+}
+
+static void
+cancel_ta_buffers(
+        Pair* p)
+{
+    int i;
+    for( i=0; i<TA_MAX_RECV_BUFFERS; i++ ) {
+        g_cancellable_cancel(p->ta_buffers[i].cancellable);
+    }
+
+    //the transfers keep their own ref, the next write gets a fresh one
+    if( p->write_cancellable ) {
+        g_cancellable_cancel( p->write_cancellable );
+        g_object_unref( p->write_cancellable );
+        p->write_cancellable = NULL;
+    }
+}
+
+//a reset goes past CANCEL once nothing is left in flight on the TA
+static gboolean
+ta_transfers_done(
+        Pair* p)
+{
+    return p->reads_pending == 0 && p->downstream_in_flight == 0;
+}
+
+typedef struct {
+    Pair* p;
+    TAResetStage stage;
+    guint generation;
+} ResetStep;
+
+static void
+reset_enter(
+        Pair* p,
+        TAResetStage stage);
+
+static void downstream_pump(
+        Pair* p);
+
+static ResetStep*
+reset_step_new(
+        Pair* p)
+{
+    ResetStep* step = g_slice_new(ResetStep);
+    pair_ref(p);
+    step->p = p;
+    step->stage = p->reset_stage;
+    step->generation = p->reset_generation;
+    return step;
+}
+
+static void
+reset_step_free(
+        ResetStep* step)
+{
+    pair_unref( step->p );
+    g_slice_free( ResetStep, step );
+}
+
+//a step is stale once its stage timed out or the reset was abandoned
+static gboolean
+reset_step_current(
+        ResetStep* step)
+{
+    return step->generation == step->p->reset_generation &&
+        step->stage == step->p->reset_stage;
+}
+
+static void
+reset_clear_timeout(
+        Pair* p)
+{
+    if( p->reset_timeout ) {
+        g_source_destroy( p->reset_timeout );
+        g_source_unref( p->reset_timeout );
+        p->reset_timeout = NULL;
+    }
+}
+
+static void
+reset_end(
+        Pair* p)
+{
+    reset_clear_timeout(p);
+    p->reset_stage = TA_RESET_IDLE;
+    p->reset_retry = FALSE;
+    p->reset_generation++;
+    //the writes held back during the reset
+    downstream_pump(p);
     pair_unref(p);
-    return FALSE;
+}
+
+static void
+reset_finish(
+        Pair* p)
+{
+    p->last_reset_duration = g_get_monotonic_time() - p->reset_started;
+    p->reset_duration_total += p->last_reset_duration;
+    p->resets++;
+    ctn_info( CTN_LOG_RESET, "ta reset done in %" G_GINT64_FORMAT " ms",
+            p->last_reset_duration / G_TIME_SPAN_MILLISECOND);
+    reset_end(p);
+}
+
+//drop a running reset, used when the pair is being torn down
+static void
+reset_abort(
+        Pair* p)
+{
+    if( p->reset_stage != TA_RESET_IDLE ) {
+        ctn_info( CTN_LOG_RESET, "ta reset aborted in %s", ta_reset_stages[p->reset_stage].name );
+        reset_end(p);
+    }
 }
 
 static gboolean
-reset_ta(
+reset_stage_timed_out(
         Pair* p)
 {
-    g_print("reset ta\n");
-    //TODO move this to async call
+    TAResetStage stage = p->reset_stage;
+    ctn_warning( CTN_LOG_RESET, "ta reset %s timed out", ta_reset_stages[stage].name );
+
+    //the transfers are already back in flight, only the card is late
+    if( stage == TA_RESET_COMPLETE ) {
+        reset_finish(p);
+        return FALSE;
+    }
+
+    //anything still running for this attempt is ignored from now on
+    p->reset_generation++;
+    if( p->reset_attempt < TA_RESET_ATTEMPTS ) {
+        p->reset_attempt++;
+        if( p->reset_stage_running ) {
+            //libusb still has the TA, reset_stage_done starts the next attempt
+            p->reset_retry = TRUE;
+        } else {
+            reset_enter( p, TA_RESET_CANCEL );
+        }
+    } else {
+        ctn_error( CTN_LOG_RESET, "ta reset failed after %d attempts", p->reset_attempt );
+        reset_end(p);
+    }
+    return FALSE;
+}
+
+static void
+reset_stage_thread(
+        GTask* task,
+        gpointer source,
+        gpointer task_data,
+        GCancellable* cancellable)
+{
+    ResetStep* step = task_data;
+    GUsbDevice* ta = source;
     GError* error = NULL;
-    int i;
+    gboolean ret = FALSE;
+
+    switch( step->stage ) {
+    case TA_RESET_RELEASE:
+        ret = g_usb_device_release_interface( ta, 0x00,
+                G_USB_DEVICE_CLAIM_INTERFACE_BIND_KERNEL_DRIVER,
+                &error );
+        break;
+    case TA_RESET_RESET:
+        ret = g_usb_device_reset( ta, &error );
+        break;
+    case TA_RESET_CLAIM:
+        ret = g_usb_device_claim_interface( ta, 0x00,
+                G_USB_DEVICE_CLAIM_INTERFACE_BIND_KERNEL_DRIVER,
+                &error );
+        break;
+    default:
+        ret = TRUE;
+        break;
+    }
 
-    //cancel outstanding transfers
-    for( i=0; i<TA_RECV_BUFFERS; i++ ) {
-        g_cancellable_cancel(p->ta_buffers[i].cancellable);
+    if( ret ) {
+        g_task_return_boolean( task, TRUE );
+    } else {
+        g_task_return_error( task, error );
     }
+}
 
-    g_usb_device_release_interface(
-            p->ta,
-            0,
-            G_USB_DEVICE_CLAIM_INTERFACE_BIND_KERNEL_DRIVER,
-            &error);
+static void
+reset_stage_done(
+        GObject* source,
+        GAsyncResult* res,
+        gpointer user_data)
+{
+    ResetStep* step = g_task_get_task_data( G_TASK(res) );
+    Pair* p = step->p;
+    GError* error = NULL;
 
-    if( error ) {
-        g_printerr("failed to release device %s\n", error->message);
+    p->reset_stage_running = FALSE;
+    if( !g_task_propagate_boolean( G_TASK(res), &error ) ) {
+        ctn_warning( CTN_LOG_RESET, "ta %s failed %s", ta_reset_stages[step->stage].name, error->message );
         g_error_free( error );
         error = NULL;
     }
 
-    g_idle_add( (GSourceFunc)reset_ta_step2, p );
-    return FALSE;
+    //like before, a failed step doesn't stop the sequence
+    if( reset_step_current(step) ) {
+        reset_enter( p, step->stage + 1 );
+    } else if( p->reset_retry ) {
+        p->reset_retry = FALSE;
+        reset_enter( p, TA_RESET_CANCEL );
+    }
 }
 
-static void
-schedule_ta_reset(Pair* p)
-{
+//libusb has no async release/reset/claim, run them off the loop
+static void
+reset_run_stage_in_thread(
+        Pair* p)
+{
+    GTask* task = g_task_new( p->ta, NULL, reset_stage_done, NULL );
+    p->reset_stage_running = TRUE;
+    g_task_set_task_data( task, reset_step_new(p), (GDestroyNotify)reset_step_free );
+    g_task_run_in_thread( task, reset_stage_thread );
+    g_object_unref( task );
+}
+
+static gboolean
+usb_reset_complete_done(
+        ResetStep* step)
+{
+    if( reset_step_current(step) ) {
+        reset_finish( step->p );
+    }
+    reset_step_free(step);
+    return FALSE;
+}
+
+static void usb_reset_complete_finished(
+        GUPnPServiceProxy *proxy,
+        GError *error,
+        gpointer userdata)
+{
+    ResetStep* step = userdata;
+
+    if( error ) {
+        ctn_warning( CTN_LOG_RESET, "usb reset complete failed %s", error->message );
+        g_error_free( error );
+        error = NULL;
+    } else {
+        ctn_info( CTN_LOG_RESET, "usb reset complete finished" );
+    }
+
+    ctn_worker_invoke( step->p->worker, (GSourceFunc)usb_reset_complete_done, step );
+}
+
+static gboolean
+send_usb_reset_complete(
+        ResetStep* step)
+{
+    Pair* p = step->p;
+    if( p->octa ) {
+        usb_reset_complete_async( p->actions, p->octa, &usb_reset_complete_policy,
+                usb_reset_complete_finished, step );
+    } else {
+        ctn_worker_invoke( p->worker, (GSourceFunc)usb_reset_complete_done, step );
+    }
+    return FALSE;
+}
+
+static void
+reset_enter(
+        Pair* p,
+        TAResetStage stage)
+{
+    guint timeout = ta_reset_stages[stage].timeout;
+
+    reset_clear_timeout(p);
+    p->reset_stage = stage;
+    if( timeout ) {
+        p->reset_timeout = ctn_worker_timeout_add( p->worker, timeout,
+                (GSourceFunc)reset_stage_timed_out, p );
+    }
+
+    switch( stage ) {
+    case TA_RESET_CANCEL:
+        //moves on from ta_message_ready once the last read is back
+        cancel_ta_buffers(p);
+        if( ta_transfers_done(p) ) {
+            reset_enter( p, TA_RESET_RELEASE );
+        }
+        break;
+    case TA_RESET_RELEASE:
+    case TA_RESET_RESET:
+    case TA_RESET_CLAIM:
+        reset_run_stage_in_thread(p);
+        break;
+    case TA_RESET_COMPLETE:
+        ctn_info( CTN_LOG_RESET, "reset done, resubmitting buffers" );
+        submit_ta_buffers(p);
+        //SOAP actions belong to the GUPnP context on the main loop
+        ctn_worker_invoke( NULL, (GSourceFunc)send_usb_reset_complete, reset_step_new(p) );
+        break;
+    default:
+        break;
+    }
+}
+
+static gboolean
+reset_ta(
+        Pair* p)
+{
+    if( p->reset_stage != TA_RESET_IDLE ) {
+        ctn_info( CTN_LOG_RESET, "ta reset already in progress (%s)", ta_reset_stages[p->reset_stage].name );
+        pair_unref(p);
+        return FALSE;
+    }
+    //an abandoned attempt may still be in libusb
+    if( p->reset_stage_running ) {
+        ctn_info( CTN_LOG_RESET, "ta reset still waiting for the last one to return" );
+        pair_unref(p);
+        return FALSE;
+    }
+
+    //the pair ref taken by schedule_ta_reset is held until reset_end
+    ctn_info( CTN_LOG_RESET, "reset ta" );
+    p->reset_started = g_get_monotonic_time();
+    p->reset_attempt = 1;
+    //whatever was in flight is lost, don't take the TA coming back for a reply
+    if( p->messages ) {
+        ctn_message_stats_forget( p->messages );
+    }
+    p->reset_generation++;
+    reset_enter( p, TA_RESET_CANCEL );
+    return FALSE;
+}
+
+static void
+schedule_ta_reset(Pair* p)
+{
+    pair_invoke( p, (GSourceFunc)reset_ta );
+}
+
+static void
+ta_communication_error_changed(
+        GUPnPServiceProxy *proxy,
+        gboolean ta_communication_error,
+        gpointer userdata)
+{
+    Pair* p = userdata;
+    ctn_info( CTN_LOG_UPNP, "ta comm error %d", ta_communication_error );
+    if( ta_communication_error ) {
+        p->ta_comm_errors++;
+        schedule_ta_reset(p);
+    }
+}
+
+//a renewal failed, GUPnP has stopped listening for events
+static gboolean
+octa_resubscribe(
+        Pair* p)
+{
+    p->resubscribe_timer = 0;
+    ctn_event_filter_subscribed( &p->events );
+    gupnp_service_proxy_set_subscribed( p->octa, TRUE );
+    return FALSE;
+}
+
+static void
+octa_subscription_lost(
+        GUPnPServiceProxy* proxy,
+        GError* reason,
+        gpointer userdata)
+{
+    Pair* p = userdata;
+    guint delay;
+
+    if( p->resubscribe_timer ) {
+        return;
+    }
+
+    //the card may be rebooting, don't hammer it
+    delay = ctn_action_backoff( &resubscribe_policy, ++p->resubscribe_attempts );
+    ctn_warning( CTN_LOG_UPNP, "event subscription lost %s, resubscribing in %ums",
+            reason->message, delay );
+    p->resubscribe_timer = g_timeout_add( delay, (GSourceFunc)octa_resubscribe, p );
+}
+
+static void
+resubscribe_cancel(
+        Pair* p)
+{
+    if( p->resubscribe_timer ) {
+        g_source_remove( p->resubscribe_timer );
+        p->resubscribe_timer = 0;
+    }
+}
+
+static void
+udcp_message_sent(
+        GObject* source,
+        GAsyncResult* res,
+        gpointer user_data)
+{
+    PairMessage* pm = user_data;
+    Pair* p = pm->p;
+    CtnFlowStats* stats = &p->downstream_stats;
+    GError* error = NULL;
+    g_usb_device_bulk_transfer_finish( G_USB_DEVICE(source), res, &error );
+
+    if( g_error_matches( error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_CANCELLED ) ) {
+        //the TA is being reset or let go, that's no sign of a stall
+        ctn_debug( CTN_LOG_USB, "ta write cancelled" );
+        ctn_health_write_abandoned( &p->health );
+        g_error_free( error );
+        error = NULL;
+    } else if( error ) {
+        ctn_warning( CTN_LOG_USB, "ta write failed %s", error->message );
+        stats->errors++;
+        //a write cut short by its deadline only says the TA is slow
+        if( pm->timeout < TA_TIMEOUT &&
+                g_error_matches( error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_TIMED_OUT ) ) {
+            ctn_health_write_abandoned( &p->health );
+        } else {
+            ctn_health_write_done( &p->health, g_get_monotonic_time(), FALSE );
+        }
+        g_error_free( error );
+        error = NULL;
+    } else {
+        ctn_health_write_done( &pm->p->health, g_get_monotonic_time(), TRUE );
+        stats->messages++;
+        stats->bytes += pm->bytes;
+        ctn_histogram_record( &stats->latency, g_get_monotonic_time() - pm->received );
+    }
+
+    //the frame may hold the last ref
+    pair_ref(p);
+    pair_message_free( pm );
+    p->downstream_in_flight--;
+    if( p->reset_stage == TA_RESET_CANCEL && ta_transfers_done(p) ) {
+        reset_enter( p, TA_RESET_RELEASE );
+    }
+    downstream_pump(p);
+    pair_unref(p);
+}
+
+//the next queued frames to the TA, urgent ones first
+static void
+downstream_pump(
+        Pair* p)
+{
+    //held while the TA is reset or let go, reset_end pumps again
+    if( p->reset_stage != TA_RESET_IDLE || p->reads_stopped || !p->ta ) {
+        return;
+    }
+
+    //expired frames may hold the last refs
+    pair_ref(p);
+    if( !p->write_cancellable ) {
+        p->write_cancellable = g_cancellable_new();
+    }
+    while( p->downstream_in_flight < downstream_window ) {
+        PairMessage* pm = pair_queue_pop( &p->downstream[CTN_LANE_URGENT] );
+        gint64 waited;
+        guint timeout = TA_TIMEOUT;
+
+        if( !pm ) {
+            pm = pair_queue_pop( &p->downstream[CTN_LANE_NORMAL] );
+        }
+        if( !pm ) {
+            break;
+        }
+        p->downstream_queued--;
+
+        waited = g_get_monotonic_time() - pm->received;
+        if( downstream_deadline ) {
+            gint64 left = downstream_deadline - waited / 1000;
+            if( left <= 0 ) {
+                ctn_debug( CTN_LOG_TRAFFIC, "mocur -> ta: dropping frame, queued for %"
+                        G_GINT64_FORMAT " ms", waited / 1000 );
+                p->downstream_expired++;
+                pair_message_free( pm );
+                continue;
+            }
+            timeout = CLAMP( left, TA_MIN_WRITE_TIMEOUT, TA_TIMEOUT );
+        }
+
+        //the frame goes with the transfer and is freed in udcp_message_sent
+        ctn_histogram_record( &p->downstream_stats.queued, waited );
+        ctn_health_write_queued( &p->health );
+        pm->timeout = timeout;
+        p->downstream_in_flight++;
+        g_usb_device_bulk_transfer_async( p->ta,
+                TA_EP_WRITE,
+                (guchar*)pm->message,
+                pm->bytes,
+                timeout,
+                p->write_cancellable,
+                udcp_message_sent,
+                pm);
+    }
+    pair_unref(p);
+}
+
+//the frame to give up when the queue is full, an urgent one only ever
+//makes way for another urgent one
+static PairMessage*
+downstream_victim(
+        Pair* p,
+        PairMessage* incoming)
+{
+    GQueue* normal = &p->downstream[CTN_LANE_NORMAL];
+    GQueue* own = &p->downstream[incoming->lane];
+    PairMessage* pm;
+
+    if( downstream_overflow == DOWNSTREAM_DROP_NEWEST ) {
+        pm = incoming->lane == CTN_LANE_URGENT ? pair_queue_pop_tail( normal ) : NULL;
+    } else {
+        pm = pair_queue_pop( normal );
+        if( !pm ) {
+            pm = pair_queue_pop( own );
+        }
+    }
+
+    if( !pm ) {
+        return incoming;
+    }
+    p->downstream_queued--;
+    return pm;
+}
+
+//drop the frames still waiting, the TA or the mocur is going away
+static void
+downstream_flush(
+        Pair* p)
+{
+    int lane;
+
+    for( lane=0; lane<CTN_LANES; lane++ ) {
+        PairMessage* pm;
+        while( ( pm = pair_queue_pop( &p->downstream[lane] ) ) ) {
+            pair_message_free( pm );
+        }
+    }
+    p->downstream_queued = 0;
+}
+
+static gboolean
+write_message_to_ta(
+        PairMessage* pm)
+{
+    Pair* p = pm->p;
+    //decoded in place, the binary frame is never longer than its base64
+    guchar* message = (guchar*)pm->message;
+    gsize len = ctn_base64_decode( pm->message, pm->len, message );
+    ctn_debug( CTN_LOG_TRAFFIC, "mocur -> ta: %" G_GSIZE_FORMAT " bytes", len );
+
+    //events may still arrive after the TA was let go
+    if( !len || p->reads_stopped ) {
+        pair_message_free( pm );
+        return FALSE;
+    }
+
+    pair_capture( p, CTN_CAPTURE_MOCUR_TO_TA, message, len );
+    if( p->messages ) {
+        ctn_message_stats_record( p->messages, CTN_DIRECTION_DOWNSTREAM,
+                message, len, pm->received );
+    }
+
+    pm->bytes = len;
+    pm->lane = pair_lane( p, message, len );
+
+    if( p->downstream_queued >= downstream_queue ) {
+        PairMessage* victim = downstream_victim( p, pm );
+        ctn_debug( CTN_LOG_TRAFFIC, "mocur -> ta: queue full, dropping the %s frame",
+                victim == pm ? "new" : "oldest" );
+        p->downstream_overflows++;
+        pair_message_free( victim );
+        if( victim == pm ) {
+            return FALSE;
+        }
+    }
+
+    pair_queue_push( &p->downstream[pm->lane], pm );
+    p->downstream_queued++;
+    downstream_pump(p);
+
+    return FALSE;
+}
+
+static void
+udcp_message_changed(
+        GUPnPServiceProxy* proxy,
+        const gchar *udcp_message,
+        gpointer userdata)
+{
+    Pair* p = userdata;
+    gsize len = strlen( udcp_message );
+    gint64 now = g_get_monotonic_time();
+    PairMessage* pm;
+
+    switch( ctn_event_filter_check( &p->events, udcp_message, len, now,
+                (gint64)event_dedup * 1000 ) ) {
+    case CTN_EVENT_STALE:
+        ctn_debug( CTN_LOG_UPNP, "dropping initial UDCPMessage event" );
+        return;
+    case CTN_EVENT_DUPLICATE:
+        ctn_debug( CTN_LOG_UPNP, "dropping duplicate UDCPMessage event" );
+        return;
+    case CTN_EVENT_DELIVER:
+        break;
+    }
+    p->resubscribe_attempts = 0;
+
+    pm = pair_message_new( p, len + 1 );
+    pm->received = now;
+    memcpy( pm->message, udcp_message, len + 1 );
+    pm->len = len;
+    ctn_worker_invoke( p->worker, (GSourceFunc)write_message_to_ta, pm );
+}
+
+//the proxy may outlive the pair, held by a pending action, so nothing it
+//raises may reach the pair any more
+static void
+octa_unsubscribe(
+        Pair* p)
+{
+    g_signal_handlers_disconnect_by_data( p->octa, p );
+    udcp_message_remove_notify( p->octa, udcp_message_changed, p );
+    ta_communication_error_remove_notify( p->octa, ta_communication_error_changed, p );
+    resubscribe_cancel( p );
+    gupnp_service_proxy_set_subscribed( p->octa, FALSE );
+}
+
+//a frame has left the upstream pipeline, sent or dropped
+static void
+upstream_release(
+        PairMessage* pm)
+{
+    Pair* p = pm->p;
+
+    if( g_atomic_int_add( &p->upstream_pending, -1 ) - 1 <= upstream_queue / 2 ) {
+        schedule_resume_ta_reads(p);
+    }
+
+    pair_message_free( pm );
+}
+
+static void message_to_udcp_sent(
+        GUPnPServiceProxy *proxy,
+        GError *error,
+        gpointer userdata);
+
+static void
+upstream_pump(
+        Pair* p)
+{
+    while( p->octa && p->upstream_sent.length < upstream_window ) {
+        PairMessage* pm = pair_queue_pop( &p->upstream[CTN_LANE_URGENT] );
+        if( !pm ) {
+            pm = pair_queue_pop( &p->upstream[CTN_LANE_NORMAL] );
+        }
+        if( !pm ) {
+            break;
+        }
+
+        ctn_histogram_record( &p->upstream_stats.queued,
+                g_get_monotonic_time() - pm->received );
+        pair_queue_push( &p->upstream_sent, pm );
+        pm->action = send_message_to_udcp_async(
+                p->actions,
+                p->octa,
+                &upstream_policy,
+                pm->message,
+                message_to_udcp_sent,
+                pm);
+    }
+}
+
+static void message_to_udcp_sent(
+        GUPnPServiceProxy *proxy,
+        GError *error,
+        gpointer userdata)
+{
+    PairMessage* pm = userdata;
+    Pair* p = pm->p;
+
+    pair_ref(p);
+    g_queue_unlink( &p->upstream_sent, &pm->node );
+    pm->action = NULL;
+
+    if( error ) {
+        //flushed, don't send anything else
+        if( g_error_matches( error, G_IO_ERROR, G_IO_ERROR_CANCELLED ) ) {
+            g_error_free( error );
+            upstream_release( pm );
+            pair_unref(p);
+            return;
+        }
+
+        //the scheduler has already retried it
+        ctn_warning( CTN_LOG_UPNP, "dropping frame, send to mocur failed %s", error->message );
+        g_error_free( error );
+        error = NULL;
+        p->upstream_stats.errors++;
+        p->upstream_dropped++;
+        upstream_release( pm );
+    } else {
+        p->upstream_stats.messages++;
+        p->upstream_stats.bytes += pm->bytes;
+        ctn_histogram_record( &p->upstream_stats.latency,
+                g_get_monotonic_time() - pm->received );
+        upstream_release( pm );
+    }
+
+    upstream_pump(p);
+    pair_unref(p);
+}
+
+//drop everything queued or in flight, the mocur is going away
+static void
+upstream_flush(
+        Pair* p)
+{
+    PairMessage* pm;
+    int lane;
+
+    //the cancelled callback takes it off upstream_sent and releases it
+    while( ( pm = g_queue_peek_head( &p->upstream_sent ) ) ) {
+        ctn_action_cancel( pm->action );
+    }
+
+    for( lane=0; lane<CTN_LANES; lane++ ) {
+        while( ( pm = pair_queue_pop( &p->upstream[lane] ) ) ) {
+            upstream_release( pm );
+        }
+    }
+}
+
+static gboolean
+send_message_upstream(
+        PairMessage* pm)
+{
+    Pair* p = pm->p;
+
+    //the mocur may have gone away while this was queued
+    if( p->octa ) {
+        pair_queue_push( &p->upstream[pm->lane], pm );
+        upstream_pump(p);
+    } else {
+        upstream_release( pm );
+    }
+
+    return FALSE;
+}
+
+static void
+upstream_handoff_cb(
+        gpointer item,
+        gpointer user_data)
+{
+    send_message_upstream( item );
+}
+
+
+static void
+ta_message_ready(
+        GObject* source,
+        GAsyncResult* res,
+        gpointer user_data)
+{
+    GError* error = NULL;
+    TABuffer* tab = user_data;
+    Pair* p = tab->p;
+    gboolean resubmit = TRUE;
+    gssize len = g_usb_device_bulk_transfer_finish( G_USB_DEVICE(source), res, &error );
+
+    if( error ) {
+        gint code = error->code;
+        if( code == G_USB_DEVICE_ERROR_CANCELLED ||
+                code == G_USB_DEVICE_ERROR_NO_DEVICE ) {
+            resubmit = FALSE;
+        } else {
+            ctn_warning( CTN_LOG_USB, "ta read failed %s", error->message );
+            p->ta_read_errors++;
+            ctn_health_read( &p->health, g_get_monotonic_time(), FALSE );
+        }
+        g_error_free( error );
+        goto done;
+    }
+
+    if( adaptive_ring ) {
+        p->ring_frames++;
+        p->ring_max_frame = MAX( p->ring_max_frame, len );
+        if( p->reads_pending == 1 ) {
+            p->ring_starved++;
+        }
+
+        //a full buffer may mean a split frame, go straight back to full size
+        if( len == tab->size && p->ta_buffer_size < p->ta_buffer_max ) {
+            ctn_info( CTN_LOG_USB, "ta read filled its %" G_GSIZE_FORMAT " byte buffer", tab->size );
+            p->ta_buffer_size = p->ta_buffer_max;
+        }
+    }
+
+    pair_capture( p, CTN_CAPTURE_TA_TO_MOCUR, tab->buffer, len );
+
+    PairMessage* pm = pair_message_new( p, CTN_BASE64_ENCODED_SIZE(len) );
+    pm->received = g_get_monotonic_time();
+    if( p->messages ) {
+        ctn_message_stats_record( p->messages, CTN_DIRECTION_UPSTREAM,
+                tab->buffer, len, pm->received );
+    }
+    ctn_health_read( &p->health, pm->received, TRUE );
+    pm->bytes = len;
+    pm->lane = pair_lane( p, tab->buffer, len );
+    pm->len = ctn_base64_encode( tab->buffer, len, pm->message );
+
+    ctn_debug( CTN_LOG_TRAFFIC, "ta -> mocur: %" G_GSSIZE_FORMAT " bytes", len );
+
+    //SOAP actions belong to the GUPnP context on the main loop
+    g_atomic_int_inc( &p->upstream_pending );
+    ctn_handoff_push( p->handoff, pm );
+
+done:
+    tab->in_flight = FALSE;
+    p->reads_pending--;
+
+    //stopped while this read was completing, the TA may be gone or
+    //belong to someone else by now
+    if( p->reads_stopped || !p->ta ) {
+        resubmit = FALSE;
+    }
+
+    if( p->reset_stage == TA_RESET_CANCEL ) {
+        if( ta_transfers_done(p) ) {
+            reset_enter( p, TA_RESET_RELEASE );
+        }
+    } else if( resubmit ) {
+        resubmit_ta_buffer( p, tab );
+    }
+    pair_unref(p);
+}
+
+//the OCTAInit sequence carries a pair ref from step to step, the scheduler
+//retries each step until the pairing goes away and cancels it
+static void
+octa_init_failed(
+        Pair* p,
+        GError* error)
+{
+    if( !g_error_matches( error, G_IO_ERROR, G_IO_ERROR_CANCELLED ) ) {
+        ctn_warning( CTN_LOG_UPNP, "octa init failed %s", error->message );
+    }
+    g_error_free(error);
+    pair_unref(p);
+}
+
+static void
+octa_init_complete(
+        GUPnPServiceProxy *proxy,
+        GError *error,
+        gpointer userdata)
+{
+    Pair* p = userdata;
+
+    if( error ) {
+        octa_init_failed( p, error );
+        return;
+    }
+    ctn_info( CTN_LOG_UPNP, "octa init complete" );
+    pair_unref(p);
+}
+
+static gboolean
+enable_octa(
+        Pair* p)
+{
+    //the mocur went away while this was scheduled
+    if( !p->octa ) {
+        pair_unref(p);
+        return FALSE;
+    }
+
+    octa_init_async(p->actions, p->octa, &octa_init_policy, TRUE, octa_init_complete, p);
+    return FALSE;
+}
+
+static void
+octa_init_complete_disable(
+        GUPnPServiceProxy *proxy,
+        GError *error,
+        gpointer userdata)
+{
+    if( error ) {
+        ctn_warning( CTN_LOG_UPNP, "octa init failed %s", error->message );
+        g_error_free(error);
+        error = NULL;
+        return;
+    }
+
+    ctn_info( CTN_LOG_UPNP, "disable octa complete" );
+}
+
+//not tied to the pair, it goes out while the pair is torn down
+static gboolean
+disable_octa(
+        CtnActionQueue* actions,
+        GUPnPServiceProxy* octa)
+{
+    octa_init_async(actions, octa, &octa_disable_policy, FALSE, octa_init_complete_disable, NULL);
+    return FALSE;
+}
+
+
+static void
+octa_init_complete_toggle(
+        GUPnPServiceProxy *proxy,
+        GError *error,
+        gpointer userdata)
+{
+    Pair* p = userdata;
+
+    if( error ) {
+        octa_init_failed( p, error );
+        return;
+    }
+
+    ctn_info( CTN_LOG_UPNP, "disable octa complete, scheduling re-enable" );
+    g_timeout_add_seconds(1, (GSourceFunc)enable_octa, p);
+}
+
+
+static gboolean
+toggle_octa(
+        Pair* p)
+{
+    if( !p->octa ) {
+        pair_unref(p);
+        return FALSE;
+    }
+
+    octa_init_async(p->actions, p->octa, &octa_init_policy, FALSE, octa_init_complete_toggle, p);
+    return FALSE;
+}
+
+static void
+octa_get_enable_octa_complete(
+        GUPnPServiceProxy* proxy,
+        gboolean octa_enable,
+        GError* error,
+        gpointer userdata)
+{
+    Pair* p = userdata;
+
+    if( error ) {
+        octa_init_failed( p, error );
+        return;
+    }
+
+    ctn_info( CTN_LOG_UPNP, "octa_enable was %d", octa_enable );
+
+    //an upgrade shouldn't restart the card's SDV session
+    if( octa_enable && p->inherited ) {
+        ctn_info( CTN_LOG_UPNP, "octa left enabled by the previous daemon" );
+        pair_unref(p);
+        return;
+    }
+
+    if( octa_enable ) {
+        toggle_octa(p);
+    } else {
+        enable_octa(p);
+    }
+}
+
+static gboolean
+health_check(
+        Pair* p)
+{
+    gint64 now = g_get_monotonic_time();
+    const gchar* reason = NULL;
+
+    //resets and paused reads fail or hold back transfers on purpose
+    if( p->reset_stage != TA_RESET_IDLE || p->reads_stopped ||
+            g_atomic_int_get( &p->reads_parked ) ) {
+        ctn_health_forgive( &p->health );
+        return TRUE;
+    }
+
+    switch( ctn_health_check( &p->health, now, (gint64)stall_timeout * G_USEC_PER_SEC, &reason ) ) {
+    case CTN_HEALTH_RESET:
+        ctn_warning( CTN_LOG_RESET, "ta stalled, %s, resetting it", reason );
+        schedule_ta_reset(p);
+        break;
+    case CTN_HEALTH_REINIT:
+        //SOAP actions belong to the GUPnP context on the main loop
+        ctn_warning( CTN_LOG_RESET, "ta stalled again after a reset, %s, redoing OCTAInit", reason );
+        pair_ref(p);
+        ctn_worker_invoke( NULL, (GSourceFunc)toggle_octa, p );
+        break;
+    default:
+        break;
+    }
+
+    return TRUE;
+}
+
+static void
+health_stop(
+        Pair* p)
+{
+    if( p->health_timer ) {
+        g_source_destroy( p->health_timer );
+        g_source_unref( p->health_timer );
+        p->health_timer = NULL;
+    }
+}
+
+static gboolean
+start_ta_io(
+        Pair* p)
+{
+    if( adaptive_ring ) {
+        p->ring_timer = ctn_worker_timeout_add( p->worker, RING_ADAPT_INTERVAL,
+                (GSourceFunc)ring_adapt, p );
+    }
+    ctn_health_init( &p->health, g_get_monotonic_time() );
+    p->health_timer = ctn_worker_timeout_add( p->worker, HEALTH_INTERVAL,
+            (GSourceFunc)health_check, p );
+    submit_ta_buffers(p);
+    pair_unref(p);
+    return FALSE;
+}
+
+static gboolean
+stop_ta_io(
+        Pair* p)
+{
+    p->reads_stopped = TRUE;
+    ring_stop(p);
+    health_stop(p);
+    reset_abort(p);
+    cancel_ta_buffers(p);
+    downstream_flush(p);
+    pair_unref(p);
+    return FALSE;
+}
+
+static gboolean
+detach_ta(
+        Pair* p)
+{
+    GError* error = NULL;
+
+    //cancel outstanding transfers
+    p->reads_stopped = TRUE;
+    ring_stop(p);
+    health_stop(p);
+    reset_abort(p);
+    cancel_ta_buffers(p);
+    downstream_flush(p);
+
+    g_usb_device_release_interface(
+            p->ta,
+            0,
+            G_USB_DEVICE_CLAIM_INTERFACE_BIND_KERNEL_DRIVER,
+            &error);
+
+    if( error ) {
+        ctn_warning( CTN_LOG_USB, "failed to release device %s", error->message );
+        g_error_free( error );
+        error = NULL;
+    }
+
+    g_object_unref( p->ta );
+    p->ta = NULL;
+    pair_unref(p);
+    return FALSE;
+}
+
+//the service of the first embedded OCTA device, NULL if there is none
+static GUPnPServiceProxy*
+mocur_get_octa(
+        GUPnPDeviceProxy* mocur)
+{
+    GUPnPServiceProxy* octa = NULL;
+    GList* devices = gupnp_device_info_list_devices( GUPNP_DEVICE_INFO(mocur) );
+    GList* i;
+
+    for( i=devices; i && !octa; i=i->next ) {
+        GUPnPDeviceInfo* sub_device = GUPNP_DEVICE_INFO(i->data);
+        if( strcmp( gupnp_device_info_get_device_type( sub_device ), OCTA_DEVICE_TYPE ) == 0 ) {
+            octa = GUPNP_SERVICE_PROXY(gupnp_device_info_get_service( sub_device, OCTA_SERVICE_TYPE ));
+        }
+    }
+    g_list_free_full( devices, g_object_unref );
+    return octa;
+}
+
+//takes over the caller's refs on both devices
+static void
+pair_devices(
+        CtnTa* ct,
+        GUPnPDeviceProxy* mocur,
+        GUsbDevice* ta)
+{
+    Pair* p = pair_new();
+    p->mocur = mocur;
+    p->ta = ta;
+    p->profile = ta_profile_lookup( ta );
+
+    p->ta_buffer_max = ta_buffer_size ? ta_buffer_size : p->profile->buffer_size;
+    p->ta_buffer_size = p->ta_buffer_max;
+    p->ta_buffer_count = ta_buffers ? ta_buffers : p->profile->buffers;
+    p->large_buffer_size = CTN_BASE64_ENCODED_SIZE(p->ta_buffer_max);
+
+    p->message_pool = ctn_pool_new( "frames", sizeof(PairMessage), PAIR_POOL_SLAB );
+    p->small_buffers = ctn_pool_new( "small buffers", PAIR_SMALL_BUFFER, PAIR_POOL_SLAB );
+    p->large_buffers = ctn_pool_new( "large buffers", p->large_buffer_size, PAIR_POOL_SLAB );
+
+    p->octa = mocur_get_octa( p->mocur );
+    p->actions = ctn_action_queue_for_device( p->mocur );
+
+    
+    const char* udn = gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(p->mocur) );
+    guint16 bus = g_usb_device_get_bus( p->ta );
+    guint16 address = g_usb_device_get_address( p->ta );
+    gpointer last_event;
+
+    gchar* port = ctn_usb_port_path( p->ta );
+    ctn_info( CTN_LOG_CORE, "paired '%s' and %x:%x on port %s", udn, bus, address, port );
+    ctn_affinity_set( ct->affinity, udn, port );
+    if( ct->capture && ct->captured_pairs <= G_MAXUINT16 ) {
+        //"udn\0port", so a replay can tell the pairs apart
+        gsize udn_len = strlen( udn ) + 1;
+        gsize port_len = strlen( port );
+        gchar* paired = g_malloc( udn_len + port_len );
+        memcpy( paired, udn, udn_len );
+        memcpy( paired + udn_len, port, port_len );
+        p->capture = ct->capture;
+        p->capture_id = ct->captured_pairs++;
+        pair_capture( p, CTN_CAPTURE_PAIRED, paired, udn_len + port_len );
+        g_free( paired );
+    }
+    g_free( port );
+    ctn_info( CTN_LOG_CORE, "%s ta ring %u x %" G_GSIZE_FORMAT " bytes%s",
+            p->profile->name, p->ta_buffer_count, p->ta_buffer_size,
+            adaptive_ring ? ", adaptive" : "");
+
+    if( pair_threads ) {
+        gchar* name = g_strdup_printf( "pair-%x:%x", bus, address );
+        p->worker = ctn_worker_new( name );
+        ctn_worker_set_nice( p->worker, usb_nice );
+        g_free( name );
+    } else {
+        p->worker = ctn_worker_ref( ct->usb_worker );
+    }
+    p->handoff = ct->upstream;
+    if( ct->classifier ) {
+        p->messages = ctn_message_stats_new( ct->classifier );
+    }
+    ctn_event_filter_init( &p->events );
+    if( g_hash_table_lookup_extended( ct->inherited, udn, NULL, &last_event ) ) {
+        //the initial event is new to the TA unless the old daemon saw it
+        if( last_event ) {
+            ctn_event_filter_inherit( &p->events, *(guint64*)last_event );
+        }
+        p->inherited = TRUE;
+        g_hash_table_remove( ct->inherited, udn );
+    }
+
+    ctn_registry_add_pair( ct->registry, p, p->mocur, p->ta );
+
+    g_signal_connect( p->octa, "subscription-lost",
+            G_CALLBACK(octa_subscription_lost), p );
+    gupnp_service_proxy_set_subscribed( p->octa, TRUE );
+
+    ta_communication_error_add_notify(p->octa,
+            ta_communication_error_changed,
+            p);
+
+    udcp_message_add_notify(p->octa,
+            udcp_message_changed,
+            p);
+
+    pair_invoke( p, (GSourceFunc)start_ta_io );
     pair_ref(p);
-    g_idle_add((GSourceFunc)reset_ta, p);
+    octa_get_enable_octa_async(p->actions, p->octa, &octa_init_policy,
+            octa_get_enable_octa_complete, p);
 }
 
-static void
-ta_communication_error_changed(
-        GUPnPServiceProxy *proxy,
-        gboolean ta_communication_error,
-        gpointer userdata)
+static const gchar*
+mocur_udn(
+        GUPnPDeviceProxy* mocur)
 {
-    Pair* p = userdata;
-    g_print("ta comm error %d\n", ta_communication_error);
-    if( ta_communication_error ) {
-        schedule_ta_reset(p);
-    }
+    return gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(mocur) );
 }
 
-typedef struct {
-    Pair* p;
-    guchar* buffer; 
-} SendContext;
-
 static void
-udcp_message_sent(
-        GObject* source,
-        GAsyncResult* res,
-        gpointer user_data)
+pair(CtnTa* ct)
 {
-    SendContext* sc = user_data;
-    GError* error = NULL;
-    Pair* p = sc->p;
-    g_usb_device_bulk_transfer_finish( p->ta, res, &error );
+    gboolean grace = g_get_monotonic_time() < ct->affinity_until;
+    GList* l;
+    GList* next;
 
-    g_free( sc->buffer );
-    g_slice_free1( sizeof(SendContext), sc );
-    pair_unref(p);
+    if( ct->handed_over ) {
+        return;
+    }
 
-    if( error ) {
-        g_printerr("ta write failed %s\n", error->message);
-        g_error_free( error );
-        error = NULL;
+    //pairings from the cache first
+    for( l=ctn_registry_get_mocurs( ct->registry ); l; l=next ) {
+        const gchar* udn = mocur_udn( l->data );
+        const gchar* port = ctn_affinity_lookup_port( ct->affinity, udn );
+        GUsbDevice* ta;
+
+        next = l->next;
+        if( port && ( ta = ctn_registry_take_ta_port( ct->registry, port ) ) ) {
+            pair_devices( ct, ctn_registry_take_mocur( ct->registry, udn ), ta );
+        }
     }
-}
 
-static void
-udcp_message_changed(
-        GUPnPServiceProxy* proxy,
-        const gchar *udcp_message,
-        gpointer userdata)
-{
-    Pair* p = userdata;
-    gsize len = 0;
-    guchar* message = g_base64_decode( udcp_message, &len );
-    g_print("mocur -> ta: %d bytes\n", len);
+    //then in arrival order. Until the grace period is over, devices with a
+    //recorded partner keep waiting for it.
+    for( ;; ) {
+        GUPnPDeviceProxy* mocur = NULL;
+        GUsbDevice* ta = NULL;
 
-    if( strlen( message ) ) {
-        SendContext* sc = g_slice_new(SendContext);
-        pair_ref(p);
-        sc->p = p;
-        sc->buffer = message;
+        for( l=ctn_registry_get_mocurs( ct->registry ); l && !mocur; l=l->next ) {
+            if( !grace || !ctn_affinity_lookup_port( ct->affinity, mocur_udn( l->data ) ) ) {
+                mocur = l->data;
+            }
+        }
+        for( l=ctn_registry_get_tas( ct->registry ); l && !ta; l=l->next ) {
+            if( !grace || !ctn_affinity_lookup_udn( ct->affinity,
+                        ctn_registry_get_ta_port( ct->registry, l->data ) ) ) {
+                ta = l->data;
+            }
+        }
+        if( !mocur || !ta ) {
+            break;
+        }
 
-        g_usb_device_bulk_transfer_async( p->ta,
-                TA_EP_WRITE,
-                message,
-                len,
-                TA_TIMEOUT,
-                NULL,
-                udcp_message_sent,
-                sc);
+        pair_devices( ct,
+                ctn_registry_take_mocur( ct->registry, mocur_udn( mocur ) ),
+                ctn_registry_take_ta( ct->registry,
+                    g_usb_device_get_bus( ta ), g_usb_device_get_address( ta ) ) );
     }
 }
 
-
-static void message_to_udcp_sent(
-        GUPnPServiceProxy *proxy,
-        GError *error,
-        gpointer userdata)
+static gboolean
+affinity_grace_over(
+        CtnTa* ct)
 {
+    ctn_info( CTN_LOG_CORE, "pairing grace period over, %u mocurs and %u TAs waiting",
+            ctn_registry_n_mocurs( ct->registry ), ctn_registry_n_tas( ct->registry ) );
+    pair( ct );
+    return FALSE;
 }
 
+static void takeover_check(
+        CtnTa* ct);
 
+//the same card seen on another interface, kept to fail over to when the
+//interface in use goes down
 static void
-ta_message_ready(
-        GObject* source,
-        GAsyncResult* res,
-        gpointer user_data)
+standby_add(
+        CtnTa* ct,
+        GUPnPDeviceProxy* mocur)
 {
-    GError* error = NULL;
-    TABuffer* tab = user_data;
-    Pair* p = tab->p;
-    gssize len = g_usb_device_bulk_transfer_finish( p->ta, res, &error );
+    const char* udn = gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(mocur) );
+    GPtrArray* mocurs = g_hash_table_lookup( ct->standby, udn );
 
-    if( error ) {
-        gint code = error->code;
-        if( code == G_USB_DEVICE_ERROR_CANCELLED ||
-                code == G_USB_DEVICE_ERROR_NO_DEVICE ) {
-            g_error_free( error );
-            pair_unref(p);
-            return;
-        }
-        g_printerr("ta read failed %s\n", error->message);
-        g_error_free( error );
-        goto resubmit;
+    if( !mocurs ) {
+        mocurs = g_ptr_array_new_with_free_func( g_object_unref );
+        g_hash_table_insert( ct->standby, g_strdup( udn ), mocurs );
     }
+    g_ptr_array_add( mocurs, g_object_ref( mocur ) );
+}
 
-    gchar* encoded = g_base64_encode( tab->buffer, len );
+static gboolean
+standby_remove(
+        CtnTa* ct,
+        GUPnPDeviceProxy* mocur)
+{
+    const char* udn = gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(mocur) );
+    GPtrArray* mocurs = g_hash_table_lookup( ct->standby, udn );
 
-    g_print("ta -> mocur: %d bytes\n", len);
+    if( !mocurs || !g_ptr_array_remove( mocurs, mocur ) ) {
+        return FALSE;
+    }
+    if( mocurs->len == 0 ) {
+        g_hash_table_remove( ct->standby, udn );
+    }
+    return TRUE;
+}
 
-    send_message_to_udcp_async(
-            p->octa,
-            encoded,
-            message_to_udcp_sent,
-            p);
+//the caller owns the ref
+static GUPnPDeviceProxy*
+standby_take(
+        CtnTa* ct,
+        const char* udn)
+{
+    GPtrArray* mocurs = g_hash_table_lookup( ct->standby, udn );
+    GUPnPDeviceProxy* mocur;
 
-resubmit:
-    g_usb_device_bulk_transfer_async(
-            p->ta,
-            TA_EP_READ,
-            tab->buffer,
-            TA_BUFFER_SIZE,
-            0,
-            tab->cancellable,
-            ta_message_ready,
-            tab);
+    if( !mocurs ) {
+        return NULL;
+    }
+    mocur = g_object_ref( g_ptr_array_index( mocurs, 0 ) );
+    g_ptr_array_remove_index( mocurs, 0 );
+    if( mocurs->len == 0 ) {
+        g_hash_table_remove( ct->standby, udn );
+    }
+    return mocur;
 }
 
 static void
-octa_init_complete(
-        GUPnPServiceProxy *proxy,
-        GError *error,
-        gpointer userdata)
+device_proxy_available_cb(GUPnPControlPoint* cp, GUPnPDeviceProxy* proxy, gpointer user_data)
 {
-    if( error ) {
-        g_printerr("octa init failed %s\n", error->message);
-        g_error_free(error);
-        error = NULL;
-        g_timeout_add( 1, enable_octa, userdata );
+    CtnTa* ct = user_data;
+    GUPnPServiceProxy* octa;
+    const char* udn;
+    const char* device_type = gupnp_device_info_get_device_type( GUPNP_DEVICE_INFO(proxy) );
+    ctn_debug( CTN_LOG_UPNP, "device found type: '%s'", device_type );
+    if( strcmp( device_type, MOCUR_DEVICE_TYPE ) != 0 ) {
         return;
     }
-    g_print("octa init complete\n");
-}
 
-static gboolean
-enable_octa(
-        gpointer userdata)
-{
-    GUPnPServiceProxy* octa = userdata;
-    octa_init_async(octa, TRUE, octa_init_complete, userdata);
-    return FALSE;
+    //the embedded OCTA device answers a search for the same type
+    octa = mocur_get_octa( proxy );
+    if( !octa ) {
+        ctn_debug( CTN_LOG_UPNP, "'%s' has no OCTA device",
+                gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(proxy) ) );
+        return;
+    }
+    g_object_unref( octa );
+
+    //seen on another interface already
+    udn = gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(proxy) );
+    if( ctn_registry_lookup_pair_udn( ct->registry, udn ) ||
+            ctn_registry_lookup_mocur( ct->registry, udn ) ) {
+        ctn_debug( CTN_LOG_UPNP, "'%s' already known, on standby", udn );
+        standby_add( ct, proxy );
+        return;
+    }
+
+    ctn_info( CTN_LOG_UPNP, "mocur found" );
+    ctn_registry_add_mocur( ct->registry, proxy );
+    if( ct->takeover ) {
+        takeover_check( ct );
+    }
+    pair( ct );
 }
 
 static void
-octa_init_complete_disable(
-        GUPnPServiceProxy *proxy,
-        GError *error,
-        gpointer userdata)
+remove_mocur(
+        CtnTa* ct,
+        GUPnPDeviceProxy* mocur)
 {
-    if( error ) {
-        g_printerr("octa init failed %s\n", error->message);
-        g_error_free(error);
-        error = NULL;
+    const char* udn = gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(mocur) );
+    Pair* p = ctn_registry_lookup_pair_udn( ct->registry, udn );
+    GUPnPDeviceProxy* standby;
+
+    //a duplicate on another interface was never registered
+    if( standby_remove( ct, mocur ) || ( p && p->mocur != mocur ) ) {
+        return;
+    }
+
+    if( p ) {
+        ctn_registry_remove_pair( ct->registry, p );
+
+        ctn_registry_add_ta( ct->registry, p->ta );
+        upstream_flush( p );
+        octa_unsubscribe( p );
+        ctn_action_cancel_proxy( p->actions, p->octa );
+        g_object_unref( p->octa );
+        g_object_unref( p->mocur );
+        p->octa = NULL;
+        p->mocur = NULL;
+        p->actions = NULL;
+
+        pair_invoke( p, (GSourceFunc)stop_ta_io );
+        pair_unref( p );
+    } else if( ctn_registry_lookup_mocur( ct->registry, udn ) == mocur ) {
+        g_object_unref( ctn_registry_take_mocur( ct->registry, udn ) );
+    } else {
         return;
     }
 
-    g_print("disable octa complete\n");
-    g_object_unref( proxy );
+    //the card may still be reachable on another interface, its SSDP entry
+    //there won't be announced again until it expires
+    standby = standby_take( ct, udn );
+    if( standby ) {
+        ctn_info( CTN_LOG_UPNP, "'%s' still reachable on %s", udn,
+                gssdp_client_get_interface( GSSDP_CLIENT(
+                        gupnp_device_info_get_context( GUPNP_DEVICE_INFO(standby) ) ) ) );
+        ctn_registry_add_mocur( ct->registry, standby );
+        g_object_unref( standby );
+    }
+
+    //the TA may have another mocur waiting for it
+    pair( ct );
 }
 
-static gboolean
-disable_octa(
-        GUPnPServiceProxy* octa)
+static void
+device_proxy_unavailable_cb(GUPnPControlPoint* cp, GUPnPDeviceProxy* proxy, gpointer user_data)
 {
-    octa_init_async(octa, FALSE, octa_init_complete_disable, NULL);
-    return FALSE;
+    CtnTa* ct = user_data;
+    remove_mocur( ct, proxy );
 }
 
-
-static void
-octa_init_complete_toggle(
-        GUPnPServiceProxy *proxy,
-        GError *error,
-        gpointer userdata)
+//host of a description URL, brackets stripped from IPv6 literals
+static gchar*
+location_host(
+        const gchar* location)
 {
-    if( error ) {
-        g_printerr("octa init failed %s\n", error->message);
-        g_error_free(error);
-        error = NULL;
-        //retry
-        g_timeout_add( 1, toggle_octa, userdata );
-        return;
+    const gchar* start = strstr( location, "://" );
+    const gchar* end;
+
+    if( !start ) {
+        return NULL;
     }
 
-    g_print("disable octa complete, scheduling re-enable\n");
-    g_timeout_add_seconds(1, enable_octa, userdata);
+    start += 3;
+    if( *start == '[' ) {
+        end = strchr( ++start, ']' );
+    } else {
+        end = start + strcspn( start, ":/" );
+    }
+    return end ? g_strndup( start, end - start ) : NULL;
 }
 
-
 static gboolean
-toggle_octa(
-        gpointer userdata)
+discovery_allowed(
+        const gchar* usn,
+        GList* locations)
 {
-    GUPnPServiceProxy* octa = userdata;
-    octa_init_async(octa, FALSE, octa_init_complete_toggle, userdata);
-    return FALSE;
-}
-
-static void
-octa_get_enable_octa_complete(
-        GUPnPServiceProxy* proxy,
-        gboolean octa_enable,
-        GError* error,
-        gpointer userdata)
-{
-    if( error ) {
-        g_printerr("failed to get octa_enable %s\n", error->message);
-        g_error_free( error );
-        error = NULL;
-        return;
+    const gchar* const* allow = (const gchar* const*)discovery_allow;
+    const gchar* suffix;
+    gchar* udn;
+    gboolean allowed;
+    GList* l;
+
+    if( !allow ) {
+        return TRUE;
     }
 
-    g_print("octa_enable was %d\n", octa_enable);
+    suffix = strstr( usn, "::" );
+    udn = suffix ? g_strndup( usn, suffix - usn ) : g_strdup( usn );
+    allowed = g_strv_contains( allow, udn );
+    g_free( udn );
 
-    if( octa_enable ) {
-        g_timeout_add( 1, toggle_octa, proxy );
-    } else {
-        g_timeout_add( 1, enable_octa, proxy );
+    for( l=locations; l && !allowed; l=l->next ) {
+        gchar* host = location_host( l->data );
+        allowed = host && g_strv_contains( allow, host );
+        g_free( host );
     }
+
+    return allowed;
 }
 
+//runs ahead of the control point's class handler, stopping the emission
+//keeps it from fetching the description
 static void
-pair(CtnTa* ct)
+resource_available_cb(
+        GSSDPResourceBrowser* browser,
+        const gchar* usn,
+        GList* locations,
+        gpointer user_data)
 {
-    while( ct->mocurs->len && ct->tas->len ) {
-        GUPnPDeviceProxy* mocur = g_ptr_array_index( ct->mocurs, 0 );
-        GUsbDevice* ta = g_ptr_array_index( ct->tas, 0 );
-
-        Pair* p = pair_new();
-        p->mocur = mocur;
-        p->ta = ta;
-
-        //get first octa instance
-        GList* devices = gupnp_device_info_list_devices( GUPNP_DEVICE_INFO(p->mocur) );
-        GList* i = devices;
-        for( ; i; i = g_list_next(i) ) {
-            GUPnPDeviceProxy* sub_device = GUPNP_DEVICE_PROXY(i->data);
-            const char* type = gupnp_device_info_get_device_type( GUPNP_DEVICE_INFO(sub_device) );
-            if( strcmp( type, OCTA_DEVICE_TYPE ) == 0 ) {
-                p->octa = GUPNP_SERVICE_PROXY(gupnp_device_info_get_service( GUPNP_DEVICE_INFO(sub_device), OCTA_SERVICE_TYPE ));
-                break;
-            }
-        }
-        g_list_free(devices);
+    if( !discovery_allowed( usn, locations ) ) {
+        ctn_debug( CTN_LOG_UPNP, "ignoring %s", usn );
+        g_signal_stop_emission_by_name( browser, "resource-available" );
+    }
+}
 
-        
-        const char* udn = gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(p->mocur) );
-        guint16 bus = g_usb_device_get_bus( p->ta );
-        guint16 address = g_usb_device_get_address( p->ta );
+//one per context, mocurs and their pairs belong to the context they were found on
+static GUPnPControlPoint*
+control_point_new(
+        CtnTa* ct,
+        GUPnPContext* context)
+{
+    GUPnPControlPoint* cp = gupnp_control_point_new( context, search_target );
 
-        g_print("paired '%s' and %x:%x\n", udn, bus, address);
-     
-        g_ptr_array_remove_index( ct->mocurs, 0 );
-        g_ptr_array_remove_index( ct->tas, 0 );
-        g_ptr_array_add( ct->pairs, p );
+    ctn_info( CTN_LOG_UPNP, "discovering on %s (%s)",
+            gssdp_client_get_interface( GSSDP_CLIENT(context) ),
+            gssdp_client_get_host_ip( GSSDP_CLIENT(context) ) );
 
-        gupnp_service_proxy_set_subscribed( p->octa, TRUE );
+    g_signal_connect( cp, "resource-available",
+            G_CALLBACK(resource_available_cb),
+            ct );
 
-        ta_communication_error_add_notify(p->octa,
-                ta_communication_error_changed,
-                p);
+    g_signal_connect( cp, "device-proxy-available",
+            G_CALLBACK(device_proxy_available_cb),
+            ct );
 
-        udcp_message_add_notify(p->octa,
-                udcp_message_changed,
-                p);
+    g_signal_connect( cp, "device-proxy-unavailable",
+            G_CALLBACK(device_proxy_unavailable_cb),
+            ct );
 
-        submit_ta_buffers(p);
-        octa_get_enable_octa_async(p->octa, octa_get_enable_octa_complete, NULL);
-    }
+    gssdp_resource_browser_set_active( GSSDP_RESOURCE_BROWSER(cp), TRUE );
+    return cp;
 }
 
 static void
-device_proxy_available_cb(GUPnPControlPoint* cp, GUPnPDeviceProxy* proxy, gpointer user_data)
+context_available_cb(
+        GUPnPContextManager* manager,
+        GUPnPContext* context,
+        gpointer user_data)
 {
     CtnTa* ct = user_data;
-    GError* error = NULL;
-    const char* device_type = gupnp_device_info_get_device_type( GUPNP_DEVICE_INFO(proxy) );
-    g_print("root device found type: '%s'\n", device_type);
-    if( strcmp( device_type, "urn:schemas-cetoncorp-com:device:SecureContainer:1" ) == 0 ) {
-        g_print("mocur found\n");
-        g_ptr_array_add( ct->mocurs, proxy );
-        pair( ct );
-    }
+    GUPnPControlPoint* cp = control_point_new( ct, context );
+
+    //the manager drops it when the context goes away
+    gupnp_context_manager_manage_control_point( manager, cp );
+    g_object_unref( cp );
 }
 
+//no byebye comes for mocurs on an interface that went down
 static void
-remove_mocur(
-        CtnTa* ct,
-        GUPnPDeviceProxy* mocur)
+context_unavailable_cb(
+        GUPnPContextManager* manager,
+        GUPnPContext* context,
+        gpointer user_data)
 {
+    CtnTa* ct = user_data;
+    GPtrArray* gone = g_ptr_array_new_with_free_func( g_object_unref );
+    GPtrArray* standby_gone = g_ptr_array_new_with_free_func( g_object_unref );
+    GHashTableIter iter;
+    gpointer mocurs;
+    GList* l;
     int i;
-    const char* udn_remove = gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(mocur) );
 
-    //first check pairings
-    for( i=0; i<ct->pairs->len; i++ ) {
-        Pair* p = g_ptr_array_index( ct->pairs, i );
-        const char* udn = gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(p->mocur) );
-        if( strcmp( udn, udn_remove ) == 0 ) {
-            g_ptr_array_remove_index_fast( ct->pairs, i );
+    ctn_info( CTN_LOG_UPNP, "%s gone", gssdp_client_get_interface( GSSDP_CLIENT(context) ) );
 
-            g_ptr_array_add( ct->tas, p->ta );
-            g_object_unref( p->octa );
-            g_object_unref( p->mocur );
-            pair_unref( p );
-            break;
+    //the stand-ins on this interface go first, so none is failed over to
+    g_hash_table_iter_init( &iter, ct->standby );
+    while( g_hash_table_iter_next( &iter, NULL, &mocurs ) ) {
+        for( i=0; i<((GPtrArray*)mocurs)->len; i++ ) {
+            gpointer mocur = g_ptr_array_index( (GPtrArray*)mocurs, i );
+            if( gupnp_device_info_get_context( GUPNP_DEVICE_INFO(mocur) ) == context ) {
+                g_ptr_array_add( standby_gone, g_object_ref( mocur ) );
+            }
         }
     }
+    for( i=0; i<standby_gone->len; i++ ) {
+        standby_remove( ct, g_ptr_array_index( standby_gone, i ) );
+    }
+    g_ptr_array_unref( standby_gone );
 
-    for( i=0; i<ct->mocurs->len; i++ ) {
-        GUPnPDeviceProxy* m = g_ptr_array_index( ct->mocurs, i );
-        const char* udn = gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(m) );
-        if( strcmp( udn, udn_remove ) == 0 ) {
-            g_ptr_array_remove_index_fast( ct->mocurs, i );
-            break;
+    for( l=ctn_registry_get_pairs( ct->registry ); l; l=l->next ) {
+        Pair* p = l->data;
+        if( gupnp_device_info_get_context( GUPNP_DEVICE_INFO(p->mocur) ) == context ) {
+            g_ptr_array_add( gone, g_object_ref( p->mocur ) );
+        }
+    }
+    for( l=ctn_registry_get_mocurs( ct->registry ); l; l=l->next ) {
+        if( gupnp_device_info_get_context( GUPNP_DEVICE_INFO(l->data) ) == context ) {
+            g_ptr_array_add( gone, g_object_ref( l->data ) );
         }
     }
-}
 
-static void
-device_proxy_unavailable_cb(GUPnPControlPoint* cp, GUPnPDeviceProxy* proxy, gpointer user_data)
-{
-    CtnTa* ct = user_data;
-    remove_mocur( ct, proxy );
+    for( i=0; i<gone->len; i++ ) {
+        remove_mocur( ct, g_ptr_array_index( gone, i ) );
+    }
+    g_ptr_array_unref( gone );
 }
 
-static void
-setup_upnp(CtnTa* ct)
+//named interfaces get fixed contexts, a context manager would leave out
+//loopback. Otherwise every interface is followed as it comes and goes.
+static gboolean
+setup_upnp(
+        CtnTa* ct,
+        GError** error)
 {
-    ct->cp = gupnp_control_point_new( ct->context, "upnp:rootdevice" );
-
-    g_signal_connect( ct->cp, "device-proxy-available",
-            G_CALLBACK(device_proxy_available_cb),
-            ct );
+    int i;
 
-    g_signal_connect( ct->cp, "device-proxy-unavailable",
-            G_CALLBACK(device_proxy_unavailable_cb),
-            ct );
+    if( !interfaces ) {
+        ct->context_manager = gupnp_context_manager_create( 0 );
+        g_signal_connect( ct->context_manager, "context-available",
+                G_CALLBACK(context_available_cb),
+                ct );
+        g_signal_connect( ct->context_manager, "context-unavailable",
+                G_CALLBACK(context_unavailable_cb),
+                ct );
+        return TRUE;
+    }
 
-    gssdp_resource_browser_set_active( GSSDP_RESOURCE_BROWSER(ct->cp), TRUE );
+    ct->control_points = g_ptr_array_new_with_free_func( g_object_unref );
+    for( i=0; interfaces[i]; i++ ) {
+        GUPnPContext* context = gupnp_context_new( interfaces[i], 0, error );
+        if( !context ) {
+            return FALSE;
+        }
+        g_ptr_array_add( ct->control_points, control_point_new( ct, context ) );
+        g_object_unref( context );
+    }
+    return TRUE;
 }
 
 static void
@@ -551,27 +2279,33 @@ check_for_ta(
         GUsbDevice* device)
 {
     GError* error = NULL;
-    guint16 vid = g_usb_device_get_vid( device );
-    guint16 pid = g_usb_device_get_pid( device );
-    if( ( vid == MOT_TA_VENDOR_ID && pid == MOT_TA_PRODUCT_ID ) ||
-            ( vid == CISCO_TA_VENDOR_ID && pid == CISCO_TA_PRODUCT_ID ) ) {
+    if( ta_profile_lookup( device ) ) {
 
         guint16 bus = g_usb_device_get_bus(device);
         guint16 addr = g_usb_device_get_address(device);
 
         if( (g_bus == 0xFFFF || g_bus == bus) && (g_addr == 0xFFFF || g_addr == addr) ) {
-            g_print("found ta on bus %d addr %d\n", bus, addr);
+            ctn_info( CTN_LOG_USB, "found ta on bus %d addr %d", bus, addr );
+
+            //still claimed by the daemon handing over, or no longer ours
+            if( ct->takeover ) {
+                g_ptr_array_add( ct->takeover_tas, g_object_ref( device ) );
+                return;
+            }
+            if( ct->handed_over ) {
+                return;
+            }
 
             gboolean ret = g_usb_device_open( device, &error );
             if( !ret ) {
-                g_printerr("failed to open device %s\n", error->message);
+                ctn_error( CTN_LOG_USB, "failed to open device %s", error->message );
                 g_error_free( error );
                 return;
             }
 
             ret = g_usb_device_set_configuration( device, 0x01, &error );
             if( !ret ) {
-                g_printerr("failed to set config %s\n", error->message);
+                ctn_error( CTN_LOG_USB, "failed to set config %s", error->message );
                 g_error_free(error);
                 return;
             }
@@ -580,14 +2314,14 @@ check_for_ta(
                     G_USB_DEVICE_CLAIM_INTERFACE_BIND_KERNEL_DRIVER,
                     &error);
             if( !ret ) {
-                g_printerr("failed to claim if %s\n", error->message);
+                ctn_error( CTN_LOG_USB, "failed to claim if %s", error->message );
                 g_error_free(error);
                 return;
             }
 
 
-            g_ptr_array_add( ct->tas, device );
-            pair( ct ); 
+            ctn_registry_add_ta( ct->registry, device );
+            pair( ct );
         }
     }
 }
@@ -599,7 +2333,7 @@ usb_device_list_added_cb(
         gpointer user_data)
 {
     CtnTa* ct = user_data;
-    g_print("device %s added %x:%x\n",
+    ctn_debug( CTN_LOG_USB, "device %s added %x:%x",
             g_usb_device_get_platform_id( device ),
             g_usb_device_get_bus( device ),
             g_usb_device_get_address( device ));
@@ -611,58 +2345,29 @@ check_for_removed_ta(
         CtnTa* ct,
         GUsbDevice* device)
 {
-    guint16 bus_remove = g_usb_device_get_bus( device );
-    guint16 address_remove = g_usb_device_get_address( device );
-
-    int i,j;
-    GError* error = NULL;
-    //check pairings for this usb device first
-    for( i=0; i<ct->pairs->len; i++ ) {
-        Pair* p = g_ptr_array_index( ct->pairs, i );
-        guint16 bus = g_usb_device_get_bus( p->ta );
-        guint16 address = g_usb_device_get_address( p->ta );
-        if( ( bus == bus_remove ) && ( address == address_remove ) ) {
+    guint16 bus = g_usb_device_get_bus( device );
+    guint16 address = g_usb_device_get_address( device );
+    Pair* p = ctn_registry_lookup_pair_usb( ct->registry, bus, address );
 
-            g_print("ta %x.%x gone\n", bus, address);
+    if( p ) {
+        ctn_info( CTN_LOG_USB, "ta %x.%x gone", bus, address );
 
-            g_object_ref( p->octa );
-            disable_octa( p->octa );
-
-            g_ptr_array_remove_index_fast( ct->pairs, i );
-
-            g_ptr_array_add( ct->mocurs, p->mocur );
-            g_object_unref( p->octa );
-
-            //cancel outstanding transfers
-            for( j=0; j<TA_RECV_BUFFERS; j++ ) {
-                g_cancellable_cancel(p->ta_buffers[i].cancellable);
-            }
-
-            g_usb_device_release_interface(
-                    p->ta,
-                    0,
-                    G_USB_DEVICE_CLAIM_INTERFACE_BIND_KERNEL_DRIVER,
-                    &error);
-
-            if( error ) {
-                g_printerr("failed to release device %s\n", error->message);
-                g_error_free( error );
-                error = NULL;
-            }
-
-            g_object_unref( p->ta );
-            pair_unref( p );
-            break;
-        }
-    }
+        ctn_registry_remove_pair( ct->registry, p );
 
-    for( i=0; i<ct->tas->len; i++ ) {
-        GUsbDevice* d = g_ptr_array_index( ct->tas, i );
-        guint16 bus = g_usb_device_get_bus( d );
-        guint16 address = g_usb_device_get_address( d );
-        if( ( bus == bus_remove ) && ( address == address_remove ) ) {
-            g_ptr_array_remove_index_fast( ct->tas, i );
-        }
+        ctn_registry_add_mocur( ct->registry, p->mocur );
+        upstream_flush( p );
+        octa_unsubscribe( p );
+        ctn_action_cancel_proxy( p->actions, p->octa );
+        disable_octa( p->actions, p->octa );
+        g_object_unref( p->octa );
+        p->octa = NULL;
+
+        pair_invoke( p, (GSourceFunc)detach_ta );
+        pair_unref( p );
+
+        pair( ct );
+    } else if( ( device = ctn_registry_take_ta( ct->registry, bus, address ) ) ) {
+        g_object_unref( device );
     }
 }
 
@@ -673,7 +2378,7 @@ usb_device_list_removed_cb(
         gpointer user_data)
 {
     CtnTa* ct = user_data;
-    g_print("device %s removed %x:%x\n",
+    ctn_debug( CTN_LOG_USB, "device %s removed %x:%x",
             g_usb_device_get_platform_id( device ),
             g_usb_device_get_bus( device ),
             g_usb_device_get_address( device ));
@@ -707,50 +2412,365 @@ setup_usb(CtnTa* ct)
     g_ptr_array_unref( devices );
 }
 
-static gboolean
-stdin_cb(
-        GIOChannel* iochannel, GIOCondition condition, gpointer data)
+typedef struct {
+    const gchar* name;
+    const gchar* type;
+    const gchar* help;
+    gdouble (*value)(Pair* p);
+} PairMetric;
+
+static gdouble pair_ta_read_errors(Pair* p) { return p->ta_read_errors; }
+static gdouble pair_ta_comm_errors(Pair* p) { return p->ta_comm_errors; }
+static gdouble pair_upstream_dropped(Pair* p) { return p->upstream_dropped; }
+static gdouble pair_upstream_queued(Pair* p) { return g_atomic_int_get( &p->upstream_pending ); }
+static gdouble pair_downstream_queued(Pair* p) { return p->downstream_queued; }
+static gdouble pair_downstream_in_flight(Pair* p) { return p->downstream_in_flight; }
+static gdouble pair_downstream_overflows(Pair* p) { return p->downstream_overflows; }
+static gdouble pair_downstream_expired(Pair* p) { return p->downstream_expired; }
+static gdouble pair_resets(Pair* p) { return p->resets; }
+static gdouble pair_reset_seconds(Pair* p) { return p->reset_duration_total / 1e6; }
+static gdouble pair_last_reset_seconds(Pair* p) { return p->last_reset_duration / 1e6; }
+static gdouble pair_stall_resets(Pair* p) { return p->health.stall_resets; }
+static gdouble pair_stall_reinits(Pair* p) { return p->health.stall_reinits; }
+static gdouble pair_events_stale(Pair* p) { return p->events.stale; }
+static gdouble pair_events_duplicate(Pair* p) { return p->events.duplicates; }
+static gdouble pair_breaker_state(Pair* p)
 {
-    CtnTa* ct = data;
+    CtnActionQueueStats stats;
+    ctn_action_queue_get_stats( p->actions, &stats );
+    return stats.state;
+}
+static gdouble pair_breaker_trips(Pair* p)
+{
+    CtnActionQueueStats stats;
+    ctn_action_queue_get_stats( p->actions, &stats );
+    return stats.trips;
+}
+
+static const PairMetric pair_metrics[] = {
+    { "ctntad_ta_read_errors_total", "counter", "Failed TA bulk reads", pair_ta_read_errors },
+    { "ctntad_ta_communication_errors_total", "counter", "TACommunicationError events from the mocur", pair_ta_comm_errors },
+    { "ctntad_upstream_dropped_total", "counter", "Frames dropped after exhausting their retries", pair_upstream_dropped },
+    { "ctntad_upstream_queued", "gauge", "Frames queued or in flight towards the mocur", pair_upstream_queued },
+    { "ctntad_downstream_queued", "gauge", "Frames waiting for a TA write", pair_downstream_queued },
+    { "ctntad_downstream_in_flight", "gauge", "TA writes in progress", pair_downstream_in_flight },
+    { "ctntad_downstream_overflows_total", "counter", "Frames dropped because the TA write queue was full", pair_downstream_overflows },
+    { "ctntad_downstream_expired_total", "counter", "Frames dropped because they waited past their deadline", pair_downstream_expired },
+    { "ctntad_resets_total", "counter", "Completed TA resets", pair_resets },
+    { "ctntad_reset_seconds_total", "counter", "Time spent in completed TA resets", pair_reset_seconds },
+    { "ctntad_last_reset_seconds", "gauge", "Duration of the last completed TA reset", pair_last_reset_seconds },
+    { "ctntad_stall_resets_total", "counter", "TA resets started because the TA stalled", pair_stall_resets },
+    { "ctntad_stall_reinits_total", "counter", "OCTAInits redone because the TA stalled again after a reset", pair_stall_reinits },
+    { "ctntad_events_stale_total", "counter", "Initial UDCPMessage events of a subscription not sent to the TA", pair_events_stale },
+    { "ctntad_events_duplicate_total", "counter", "Repeated UDCPMessage events not sent to the TA", pair_events_duplicate },
+    { "ctntad_mocur_breaker_state", "gauge", "Mocur circuit breaker, 0 closed, 1 open, 2 half-open", pair_breaker_state },
+    { "ctntad_mocur_breaker_trips_total", "counter", "Times the mocur circuit breaker opened", pair_breaker_trips },
+};
+
+static const struct {
+    const gchar* name;
+    const gchar* help;
+} action_metrics[] = {
+    { "ctntad_action_attempts_total", "SOAP action attempts sent to the mocur" },
+    { "ctntad_action_retries_total", "SOAP action attempts that were retries" },
+    { "ctntad_action_timeouts_total", "SOAP action attempts that timed out" },
+    { "ctntad_action_failures_total", "SOAP actions that gave up" },
+};
+
+static const struct {
+    const gchar* name;
+    const gchar* type;
+    const gchar* help;
+} flow_metrics[] = {
+    { "ctntad_messages_total", "counter", "Frames delivered" },
+    { "ctntad_bytes_total", "counter", "Binary frame bytes delivered" },
+    { "ctntad_transfer_errors_total", "counter", "Failed SendMessageToUDCP actions and TA writes" },
+    { "ctntad_queue_seconds", "summary", "Time from arrival until a frame is handed on" },
+    { "ctntad_latency_seconds", "summary", "Time from arrival until a frame is delivered" },
+};
+
+static const struct {
+    const gchar* name;
+    const gchar* type;
+    const gchar* help;
+} message_metrics[] = {
+    { "ctntad_message_frames_total", "counter", "Frames by message type, with --classify" },
+    { "ctntad_message_bytes_total", "counter", "Frame bytes by message type, with --classify" },
+    { "ctntad_message_reply_seconds", "summary", "Time from a frame until the first frame back, by message type" },
+};
+
+//counters written on a pair thread are read here without locking, a
+//scrape may see them a frame behind
+static void
+metrics_collect(
+        GString* out,
+        gpointer user_data)
+{
+    CtnTa* ct = user_data;
+    GPtrArray* pairs = g_ptr_array_new();
+    GPtrArray* labels = g_ptr_array_new_with_free_func( g_free );
+    GList* l;
+    int i, j, d;
+
+    for( l=ctn_registry_get_pairs( ct->registry ); l; l=l->next ) {
+        Pair* p = l->data;
+        gchar* udn = g_strescape( gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(p->mocur) ), NULL );
+        g_ptr_array_add( labels, g_strdup_printf( "udn=\"%s\",ta=\"%x:%x\"",
+                    udn,
+                    g_usb_device_get_bus( p->ta ),
+                    g_usb_device_get_address( p->ta ) ) );
+        g_free( udn );
+        g_ptr_array_add( pairs, p );
+    }
+
+    ctn_metrics_family( out, "ctntad_pairs", "gauge", "Paired mocurs and TAs" );
+    ctn_metrics_value( out, "ctntad_pairs", NULL, pairs->len );
+
+    for( j=0; j<G_N_ELEMENTS(pair_metrics); j++ ) {
+        const PairMetric* metric = &pair_metrics[j];
+        ctn_metrics_family( out, metric->name, metric->type, metric->help );
+        for( i=0; i<pairs->len; i++ ) {
+            ctn_metrics_value( out, metric->name, g_ptr_array_index( labels, i ),
+                    metric->value( g_ptr_array_index( pairs, i ) ) );
+        }
+    }
+
+    for( j=0; j<G_N_ELEMENTS(flow_metrics); j++ ) {
+        ctn_metrics_family( out, flow_metrics[j].name, flow_metrics[j].type, flow_metrics[j].help );
+        for( i=0; i<pairs->len; i++ ) {
+            Pair* p = g_ptr_array_index( pairs, i );
+            for( d=0; d<2; d++ ) {
+                const CtnFlowStats* stats = d ? &p->downstream_stats : &p->upstream_stats;
+                gchar* series = g_strdup_printf( "%s,direction=\"%s\"",
+                        (gchar*)g_ptr_array_index( labels, i ),
+                        d ? "downstream" : "upstream" );
+                switch( j ) {
+                    case 0: ctn_metrics_value( out, flow_metrics[j].name, series, stats->messages ); break;
+                    case 1: ctn_metrics_value( out, flow_metrics[j].name, series, stats->bytes ); break;
+                    case 2: ctn_metrics_value( out, flow_metrics[j].name, series, stats->errors ); break;
+                    case 3: ctn_metrics_summary( out, flow_metrics[j].name, series, &stats->queued ); break;
+                    case 4: ctn_metrics_summary( out, flow_metrics[j].name, series, &stats->latency ); break;
+                }
+                g_free( series );
+            }
+        }
+    }
 
-    if( condition & G_IO_ERR ) {
-        g_print("stdin error\n");
-        goto error;
+    for( j=0; j<G_N_ELEMENTS(action_metrics); j++ ) {
+        ctn_metrics_family( out, action_metrics[j].name, "counter", action_metrics[j].help );
+        for( i=0; i<pairs->len; i++ ) {
+            Pair* p = g_ptr_array_index( pairs, i );
+            for( d=0; d<G_N_ELEMENTS(octa_actions); d++ ) {
+                CtnActionCounters counters;
+                gchar* series = g_strdup_printf( "%s,action=\"%s\"",
+                        (gchar*)g_ptr_array_index( labels, i ), octa_actions[d] );
+                ctn_action_queue_get_counters( p->actions, octa_actions[d], &counters );
+                switch( j ) {
+                    case 0: ctn_metrics_value( out, action_metrics[j].name, series, counters.attempts ); break;
+                    case 1: ctn_metrics_value( out, action_metrics[j].name, series, counters.retries ); break;
+                    case 2: ctn_metrics_value( out, action_metrics[j].name, series, counters.timeouts ); break;
+                    case 3: ctn_metrics_value( out, action_metrics[j].name, series, counters.failures ); break;
+                }
+                g_free( series );
+            }
+        }
+    }
+
+    if( ct->classifier ) {
+        for( j=0; j<G_N_ELEMENTS(message_metrics); j++ ) {
+            ctn_metrics_family( out, message_metrics[j].name, message_metrics[j].type, message_metrics[j].help );
+            for( i=0; i<pairs->len; i++ ) {
+                Pair* p = g_ptr_array_index( pairs, i );
+                for( d=0; d<CTN_DIRECTIONS; d++ ) {
+                    int t;
+                    for( t=0; t<256; t++ ) {
+                        const CtnMessageTypeStats* ts = ctn_message_stats_get( p->messages, d, t );
+                        gchar* series;
+                        if( !ts ) {
+                            continue;
+                        }
+                        series = g_strdup_printf( "%s,direction=\"%s\",type=\"%s\"",
+                                (gchar*)g_ptr_array_index( labels, i ),
+                                ctn_direction_name( d ),
+                                ctn_classifier_get_name( ct->classifier, t ) );
+                        switch( j ) {
+                            case 0: ctn_metrics_value( out, message_metrics[j].name, series, ts->frames ); break;
+                            case 1: ctn_metrics_value( out, message_metrics[j].name, series, ts->bytes ); break;
+                            case 2: ctn_metrics_summary( out, message_metrics[j].name, series, &ts->reply ); break;
+                        }
+                        g_free( series );
+                    }
+                }
+            }
+        }
     }
 
-    if( condition & G_IO_IN ) {
-        GIOStatus status;
-        GError* error = NULL;
-        gchar buffer[1024] = {};
-        gsize bytes_read;
+    g_ptr_array_unref( labels );
+    g_ptr_array_unref( pairs );
+}
 
-        status = g_io_channel_read_chars(iochannel, buffer, sizeof(buffer), &bytes_read, &error);
+//a pair by UDN, USB port path or hex bus:address as in the logs, the only
+//pair when there is just one
+static Pair*
+control_find_pair(
+        CtnTa* ct,
+        const gchar* target,
+        GError** error)
+{
+    Pair* p = NULL;
 
-        if( status != G_IO_STATUS_NORMAL ) {
-            g_print("failed to read stdin\n");
-            goto error;
+    if( !target ) {
+        if( ctn_registry_n_pairs( ct->registry ) == 1 ) {
+            return ctn_registry_get_pairs( ct->registry )->data;
         }
+        g_set_error( error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                "%u pairs, name one by UDN or bus:address",
+                ctn_registry_n_pairs( ct->registry ) );
+        return NULL;
+    }
 
-        if( bytes_read == 0 ) {
-            goto error;
+    p = ctn_registry_lookup_pair_udn( ct->registry, target );
+    if( !p && strchr( target, '-' ) ) {
+        p = ctn_registry_lookup_pair_port( ct->registry, target );
+    }
+    if( !p && !g_str_has_prefix( target, "uuid:" ) ) {
+        gchar* end;
+        guint64 bus = g_ascii_strtoull( target, &end, 16 );
+        if( end != target && *end == ':' ) {
+            const gchar* a = end + 1;
+            guint64 address = g_ascii_strtoull( a, &end, 16 );
+            if( end != a && !*end && bus <= G_MAXUINT16 && address <= G_MAXUINT16 ) {
+                p = ctn_registry_lookup_pair_usb( ct->registry, bus, address );
+            }
         }
+    }
+
+    if( !p ) {
+        g_set_error( error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "no pair %s", target );
+    }
+    return p;
+}
+
+static void
+control_list(
+        CtnTa* ct,
+        GString* out)
+{
+    GList* l;
+
+    for( l=ctn_registry_get_pairs( ct->registry ); l; l=l->next ) {
+        Pair* p = l->data;
+        gchar* port = ctn_usb_port_path( p->ta );
+        g_string_append_printf( out, "pair %s %x:%x port %s %s reset %s\n",
+                gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(p->mocur) ),
+                g_usb_device_get_bus( p->ta ), g_usb_device_get_address( p->ta ),
+                port, p->profile->name,
+                ta_reset_stages[p->reset_stage].name );
+        g_free( port );
+    }
+    for( l=ctn_registry_get_mocurs( ct->registry ); l; l=l->next ) {
+        g_string_append_printf( out, "mocur %s waiting\n",
+                gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(l->data) ) );
+    }
+    for( l=ctn_registry_get_tas( ct->registry ); l; l=l->next ) {
+        GUsbDevice* ta = l->data;
+        g_string_append_printf( out, "ta %x:%x port %s waiting\n",
+                g_usb_device_get_bus( ta ), g_usb_device_get_address( ta ),
+                ctn_registry_get_ta_port( ct->registry, ta ) );
+    }
+}
+
+static void
+control_stats(
+        Pair* p,
+        GString* out)
+{
+    g_string_append_printf( out, "pair %x:%x, ta ring %u x %" G_GSIZE_FORMAT " bytes\n",
+            g_usb_device_get_bus( p->ta ),
+            g_usb_device_get_address( p->ta ),
+            p->ta_buffer_count, p->ta_buffer_size );
+    ctn_flow_stats_print( out, "ta -> mocur", &p->upstream_stats );
+    ctn_flow_stats_print( out, "mocur -> ta", &p->downstream_stats );
+    g_string_append_printf( out, "\tta writes: %u queued, %u in flight, %u overflowed, %u expired\n",
+            p->downstream_queued, p->downstream_in_flight,
+            p->downstream_overflows, p->downstream_expired );
+    g_string_append_printf( out, "\tstalls: %u resets, %u reinits, %u writes pending\n",
+            p->health.stall_resets, p->health.stall_reinits, p->health.writes_pending );
+    g_string_append_printf( out, "\tevents dropped: %u stale, %u duplicate\n",
+            p->events.stale, p->events.duplicates );
+    if( p->messages ) {
+        ctn_message_stats_print( out, p->messages );
+    }
+    pair_print_actions( out, p );
+    pair_print_pools( out, p );
+}
+
+//commands only look things up and schedule work, so the bridging path
+//never waits on them
+static gboolean
+control_command(
+        gchar** argv,
+        GString* out,
+        gpointer data,
+        GError** error)
+{
+    CtnTa* ct = data;
+    const gchar* cmd = argv[0];
+    const gchar* arg = argv[1];
+    Pair* p;
 
-        if( strncmp( buffer, "reset", strlen("reset") ) == 0 ) {
-            if( ct->pairs->len ) {
-                Pair* p = g_ptr_array_index( ct->pairs, 0 );
-                schedule_ta_reset(p);
-            } else {
-                g_print("No pair found\n");
+    if( g_strcmp0( cmd, "list" ) == 0 ) {
+        control_list( ct, out );
+    } else if( g_strcmp0( cmd, "reset" ) == 0 ) {
+        if( !( p = control_find_pair( ct, arg, error ) ) ) {
+            return FALSE;
+        }
+        ctn_info( CTN_LOG_CORE, "ta reset requested over the control socket" );
+        schedule_ta_reset(p);
+    } else if( g_strcmp0( cmd, "reinit" ) == 0 ) {
+        if( !( p = control_find_pair( ct, arg, error ) ) ) {
+            return FALSE;
+        }
+        ctn_info( CTN_LOG_CORE, "octa re-init requested over the control socket" );
+        pair_ref(p);
+        toggle_octa(p);
+    } else if( g_strcmp0( cmd, "stats" ) == 0 ) {
+        if( arg ) {
+            if( !( p = control_find_pair( ct, arg, error ) ) ) {
+                return FALSE;
             }
+            control_stats( p, out );
         } else {
-            g_print("Commands available:\n");
-            g_print("\treset\n");
+            GList* l;
+            for( l=ctn_registry_get_pairs( ct->registry ); l; l=l->next ) {
+                control_stats( l->data, out );
+            }
+            g_string_append( out, "octa client\n" );
+            pair_print_pool( out, octa_client_get_pool() );
+        }
+    } else if( g_strcmp0( cmd, "log" ) == 0 ) {
+        if( !arg ) {
+            g_set_error( error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                    "log needs a level spec" );
+            return FALSE;
         }
+        if( !ctn_log_set_levels( arg, error ) ) {
+            return FALSE;
+        }
+    } else if( g_strcmp0( cmd, "help" ) == 0 ) {
+        g_string_append( out,
+                "list\n"
+                "reset [UDN|BUS:ADDRESS|PORT]\n"
+                "reinit [UDN|BUS:ADDRESS|PORT]\n"
+                "stats [UDN|BUS:ADDRESS|PORT]\n"
+                "log core|usb|upnp|reset|traffic=LEVEL,...\n" );
+    } else {
+        g_set_error( error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                "unknown command %s, try help", cmd );
+        return FALSE;
     }
 
     return TRUE;
-error:
-    return FALSE;
 }
 
 static void
@@ -768,20 +2788,12 @@ list_usb(CtnTa* ct)
     for( i=0; i<devices->len; i++ ) {
         device = g_ptr_array_index( devices, i );
 
-        guint16 vid = g_usb_device_get_vid( device );
-        guint16 pid = g_usb_device_get_pid( device );
-        if( ( vid == MOT_TA_VENDOR_ID && pid == MOT_TA_PRODUCT_ID ) ||
-                ( vid == CISCO_TA_VENDOR_ID && pid == CISCO_TA_PRODUCT_ID ) ) {
+        const TAProfile* profile = ta_profile_lookup( device );
+        if( profile ) {
             guint16 bus = g_usb_device_get_bus(device);
             guint16 addr = g_usb_device_get_address(device);
 
-            if(vid == MOT_TA_VENDOR_ID) {
-                g_print("Found Motorola Tuning Adapter on bus %d address %d\n", bus, addr);
-            } else if(vid == CISCO_TA_VENDOR_ID) {
-                g_print("Found Cisco Tuning Adapter on bus %d address %d\n", bus, addr);
-            } else {
-                g_print("Found Unknown Tuning Adapter on bus %d address %d\n", bus, addr);
-            }
+            g_print("Found %s Tuning Adapter on bus %d address %d\n", profile->name, bus, addr);
             found = 1;
         }
     }
@@ -793,16 +2805,376 @@ list_usb(CtnTa* ct)
     g_ptr_array_unref( devices );
 }
 
-static gchar* interface = NULL;
 static gboolean list_tas = FALSE;
 static gint i_bus = -1;
 static gint i_addr = -1;
 
+//handing over to a new daemon, see handover.h
+
+static void
+handover_list_pairs(
+        GString* out,
+        gpointer user_data)
+{
+    CtnTa* ct = user_data;
+    GList* l;
+
+    for( l=ctn_registry_get_pairs( ct->registry ); l; l=l->next ) {
+        Pair* p = l->data;
+        gchar* port = ctn_usb_port_path( p->ta );
+        guint64 last;
+
+        g_string_append_printf( out, "%s %s ",
+                gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(p->mocur) ), port );
+        if( ctn_event_filter_get_last( &p->events, &last ) ) {
+            g_string_append_printf( out, "%" G_GINT64_MODIFIER "x\n", last );
+        } else {
+            g_string_append( out, "-\n" );
+        }
+        g_free( port );
+    }
+}
+
+typedef struct {
+    CtnTa* ct;
+    Pair* p;
+} PairRelease;
+
+static gboolean
+handover_ta_released(
+        PairRelease* pr)
+{
+    CtnTa* ct = pr->ct;
+
+    pair_unref( pr->p );
+    g_slice_free( PairRelease, pr );
+    if( --ct->releasing == 0 ) {
+        ctn_handover_released( ct->handover );
+    }
+    return FALSE;
+}
+
+//like detach_ta, but the TA is left as it is for the new daemon to claim
+static gboolean
+handover_release_ta(
+        PairRelease* pr)
+{
+    Pair* p = pr->p;
+    GError* error = NULL;
+
+    p->reads_stopped = TRUE;
+    ring_stop(p);
+    health_stop(p);
+    reset_abort(p);
+    cancel_ta_buffers(p);
+    downstream_flush(p);
+
+    g_usb_device_release_interface(
+            p->ta,
+            0,
+            G_USB_DEVICE_CLAIM_INTERFACE_NONE,
+            &error);
+
+    if( error ) {
+        ctn_warning( CTN_LOG_USB, "failed to release device %s", error->message );
+        g_error_free( error );
+        error = NULL;
+    }
+
+    ctn_worker_invoke( NULL, (GSourceFunc)handover_ta_released, pr );
+    return FALSE;
+}
+
+static void
+handover_release(
+        gpointer user_data)
+{
+    CtnTa* ct = user_data;
+    GSocket* socket = ct->control ? ctn_control_hand_over( ct->control ) : NULL;
+    GError* error = NULL;
+    GList* l;
+
+    ct->handed_over = TRUE;
+
+    if( socket ) {
+        ctn_handover_pass_socket( ct->handover, "control", socket );
+    }
+    if( ct->metrics ) {
+        for( l=ctn_metrics_hand_over( ct->metrics ); l; l=l->next ) {
+            ctn_handover_pass_socket( ct->handover, "metrics", l->data );
+        }
+    }
+
+    //waiting TAs are claimed but idle
+    for( l=ctn_registry_get_tas( ct->registry ); l; l=l->next ) {
+        g_usb_device_release_interface( l->data, 0, G_USB_DEVICE_CLAIM_INTERFACE_NONE, &error );
+        if( error ) {
+            ctn_warning( CTN_LOG_USB, "failed to release device %s", error->message );
+            g_error_free( error );
+            error = NULL;
+        }
+    }
+
+    for( l=ctn_registry_get_pairs( ct->registry ); l; l=l->next ) {
+        Pair* p = l->data;
+        PairRelease* pr = g_slice_new( PairRelease );
+
+        //the new daemon subscribes for itself, OCTA stays enabled
+        octa_unsubscribe( p );
+
+        pair_ref(p);
+        pr->ct = ct;
+        pr->p = p;
+        ct->releasing++;
+        ctn_worker_invoke( p->worker, (GSourceFunc)handover_release_ta, pr );
+    }
+
+    if( !ct->releasing ) {
+        ctn_handover_released( ct->handover );
+    }
+}
+
+//frames read before the release still go out
+static gboolean
+handover_drained(
+        CtnTa* ct)
+{
+    GList* l;
+
+    if( g_get_monotonic_time() < ct->drain_until ) {
+        for( l=ctn_registry_get_pairs( ct->registry ); l; l=l->next ) {
+            Pair* p = l->data;
+            if( g_atomic_int_get( &p->upstream_pending ) ) {
+                return TRUE;
+            }
+        }
+    }
+
+    ctn_info( CTN_LOG_CORE, "handed over, exiting" );
+    g_main_loop_quit( ct->main_loop );
+    return FALSE;
+}
+
+static void
+handover_done(
+        gpointer user_data)
+{
+    CtnTa* ct = user_data;
+
+    ct->drain_until = g_get_monotonic_time() + (gint64)HANDOVER_DRAIN * 1000;
+    g_timeout_add( 100, (GSourceFunc)handover_drained, ct );
+}
+
+static const CtnHandoverFuncs handover_funcs = {
+    handover_list_pairs,
+    handover_release,
+    handover_done,
+};
+
+//metrics, control and handover sockets, the first two passed over by the
+//daemon handing over when there is one
+static gboolean
+start_services(
+        CtnTa* ct,
+        GError** error)
+{
+    GError* local_error = NULL;
+    GList* passed;
+    GList* l;
+
+    if( metrics_port || metrics_socket ) {
+        ct->metrics = ctn_metrics_new( metrics_collect, ct );
+        passed = ct->takeover ? ctn_handover_client_get_sockets( ct->takeover, "metrics" ) : NULL;
+        for( l=passed; l; l=l->next ) {
+            GSocket* socket = l->data;
+            const gchar* path = g_socket_get_family( socket ) == G_SOCKET_FAMILY_UNIX ?
+                metrics_socket : NULL;
+            if( !ctn_metrics_listen_socket( ct->metrics, socket, path, error ) ) {
+                g_prefix_error( error, "serving metrics: " );
+                return FALSE;
+            }
+        }
+        if( !passed && metrics_port &&
+                !ctn_metrics_listen_port( ct->metrics, metrics_port, error ) ) {
+            g_prefix_error( error, "serving metrics on port %d: ", metrics_port );
+            return FALSE;
+        }
+        if( !passed && metrics_socket &&
+                !ctn_metrics_listen_unix( ct->metrics, metrics_socket, error ) ) {
+            g_prefix_error( error, "serving metrics on %s: ", metrics_socket );
+            return FALSE;
+        }
+    }
+
+    //the state dir may not be there or writable, the pairs work without both
+    if( *control_socket ) {
+        ct->control = ctn_control_new( control_command, ct );
+        passed = ct->takeover ? ctn_handover_client_get_sockets( ct->takeover, "control" ) : NULL;
+        if( passed ? !ctn_control_listen_socket( ct->control, passed->data, control_socket, &local_error ) :
+                !ctn_control_listen_unix( ct->control, control_socket, &local_error ) ) {
+            ctn_warning( CTN_LOG_CORE, "not accepting commands on %s %s",
+                    control_socket, local_error->message );
+            g_error_free( local_error );
+            local_error = NULL;
+            ctn_control_free( ct->control );
+            ct->control = NULL;
+        }
+    }
+
+    if( *handover_socket ) {
+        ct->handover = ctn_handover_new( &handover_funcs, ct );
+        if( !ctn_handover_listen_unix( ct->handover, handover_socket, &local_error ) ) {
+            ctn_warning( CTN_LOG_CORE, "not accepting handovers on %s %s",
+                    handover_socket, local_error->message );
+            g_error_free( local_error );
+            local_error = NULL;
+            ctn_handover_free( ct->handover );
+            ct->handover = NULL;
+        }
+    }
+
+    return TRUE;
+}
+
+//taking over from a running daemon
+
+static void
+takeover_finish(
+        CtnTa* ct)
+{
+    GError* error = NULL;
+    guint i;
+
+    if( ct->takeover_timer ) {
+        g_source_remove( ct->takeover_timer );
+        ct->takeover_timer = 0;
+    }
+
+    if( !ctn_handover_client_release( ct->takeover, &error ) ) {
+        ctn_warning( CTN_LOG_CORE, "handover failed %s", error->message );
+        g_error_free( error );
+        error = NULL;
+        //no telling what the running daemon left behind
+        g_hash_table_remove_all( ct->inherited );
+        ctn_handover_client_free( ct->takeover );
+        ct->takeover = NULL;
+
+        //it still holds its TAs and sockets, starting next to it would fight over both
+        if( ctn_handover_socket_in_use( handover_socket ) ) {
+            ctn_error( CTN_LOG_CORE, "the running ctntad didn't let go, exiting" );
+            ct->exit_status = EXIT_FAILURE;
+            g_main_loop_quit( ct->main_loop );
+            return;
+        }
+    }
+
+    if( !start_services( ct, &error ) ) {
+        ctn_error( CTN_LOG_CORE, "%s", error->message );
+        g_error_free( error );
+        error = NULL;
+        //the same as on a plain start, keeps the TAs unclaimed until then
+        ct->exit_status = EXIT_FAILURE;
+        g_main_loop_quit( ct->main_loop );
+        return;
+    }
+    ctn_handover_client_free( ct->takeover );
+    ct->takeover = NULL;
+
+    //the TAs are free now
+    for( i=0; i<ct->takeover_tas->len; i++ ) {
+        check_for_ta( ct, g_ptr_array_index( ct->takeover_tas, i ) );
+    }
+    g_ptr_array_set_size( ct->takeover_tas, 0 );
+}
+
+//the release waits until the mocurs are found, so pairing is immediate
+static void
+takeover_check(
+        CtnTa* ct)
+{
+    GHashTableIter iter;
+    gpointer udn;
+
+    g_hash_table_iter_init( &iter, ct->inherited );
+    while( g_hash_table_iter_next( &iter, &udn, NULL ) ) {
+        if( !ctn_registry_lookup_mocur( ct->registry, udn ) ) {
+            return;
+        }
+    }
+
+    ctn_info( CTN_LOG_CORE, "found the mocurs of the running daemon, taking over" );
+    takeover_finish( ct );
+}
+
+static gboolean
+takeover_timeout(
+        CtnTa* ct)
+{
+    ct->takeover_timer = 0;
+    ctn_warning( CTN_LOG_CORE, "not all mocurs of the running daemon found, taking over anyway" );
+    takeover_finish( ct );
+    return FALSE;
+}
+
+static void
+takeover_start(
+        CtnTa* ct)
+{
+    GHashTableIter iter;
+    gpointer udn;
+    gpointer port;
+
+    g_hash_table_iter_init( &iter, ctn_handover_client_get_pairs( ct->takeover ) );
+    while( g_hash_table_iter_next( &iter, &udn, &port ) ) {
+        guint64* last = NULL;
+        guint64 fingerprint;
+
+        ctn_affinity_set( ct->affinity, udn, port );
+        if( ctn_handover_client_get_last_event( ct->takeover, udn, &fingerprint ) ) {
+            last = g_new( guint64, 1 );
+            *last = fingerprint;
+        }
+        g_hash_table_insert( ct->inherited, g_strdup( udn ), last );
+    }
+    ctn_info( CTN_LOG_CORE, "taking over %u pairs", g_hash_table_size( ct->inherited ) );
+
+    ct->takeover_tas = g_ptr_array_new_with_free_func( g_object_unref );
+    ct->takeover_timer = g_timeout_add_seconds( TAKEOVER_TIMEOUT, (GSourceFunc)takeover_timeout, ct );
+    takeover_check( ct );
+}
+
 static GOptionEntry options[] = {
-    { "interface", 'i', 0, G_OPTION_ARG_STRING, &interface, "IP interface to bind to", "I" },
+    { "interface", 'i', 0, G_OPTION_ARG_STRING_ARRAY, &interfaces, "IP interface to bind to, may be repeated, default all of them as they come and go", "I" },
     { "bus", 'b', 0, G_OPTION_ARG_INT, &i_bus, "bus of the TA you want to use", NULL },
     { "address", 'a', 0, G_OPTION_ARG_INT, &i_addr, "address of the TA you want to use", NULL },
     { "list-tas", 'l', 0, G_OPTION_ARG_NONE, &list_tas, "List the TAs found", NULL },
+    { "upstream-window", 0, 0, G_OPTION_ARG_INT, &upstream_window, "SendMessageToUDCP actions in flight per pair, 1 keeps frames strictly ordered", "N" },
+    { "upstream-queue", 0, 0, G_OPTION_ARG_INT, &upstream_queue, "frames queued per pair before TA reads are paused", "N" },
+    { "downstream-window", 0, 0, G_OPTION_ARG_INT, &downstream_window, "TA writes in flight per pair, urgent frames only overtake those still queued", "N" },
+    { "downstream-queue", 0, 0, G_OPTION_ARG_INT, &downstream_queue, "frames waiting for a TA write per pair before the overflow policy applies (default 32)", "N" },
+    { "downstream-deadline", 0, 0, G_OPTION_ARG_INT, &downstream_deadline, "drop frames not written to the TA this long after they arrived, 0 for no deadline (default 5000)", "MS" },
+    { "downstream-overflow", 0, 0, G_OPTION_ARG_STRING, &downstream_overflow_name, "frame to drop when the TA write queue is full, drop-oldest or drop-newest (default drop-oldest)", "POLICY" },
+    { "upstream-retries", 0, 0, G_OPTION_ARG_INT, &upstream_retries, "times a failed SendMessageToUDCP is retried before the frame is dropped", "N" },
+    { "ta-buffer-size", 0, 0, G_OPTION_ARG_INT, &ta_buffer_size, "size of each TA read, defaults to the TA model's", "BYTES" },
+    { "ta-buffers", 0, 0, G_OPTION_ARG_INT, &ta_buffers, "TA reads kept in flight, defaults to the TA model's", "N" },
+    { "adaptive-ring", 0, 0, G_OPTION_ARG_NONE, &adaptive_ring, "resize the TA receive ring to the observed traffic", NULL },
+    { "event-dedup", 0, 0, G_OPTION_ARG_INT, &event_dedup, "drop a UDCPMessage event repeating the one right before it within this long, 0 to keep them (default 1000)", "MS" },
+    { "stall-timeout", 0, 0, G_OPTION_ARG_INT, &stall_timeout, "reset a TA that reads nothing this long while several writes went out, 0 to only act on failing transfers (default 20)", "SECONDS" },
+    { "pair-threads", 't', 0, G_OPTION_ARG_NONE, &pair_threads, "Run the USB I/O of each pair on its own thread", NULL },
+    { "usb-nice", 0, 0, G_OPTION_ARG_INT, &usb_nice, "nice value of the USB I/O threads (default -10)", "N" },
+    { "metrics-port", 0, 0, G_OPTION_ARG_INT, &metrics_port, "serve Prometheus metrics on this loopback port", "PORT" },
+    { "metrics-socket", 0, 0, G_OPTION_ARG_FILENAME, &metrics_socket, "serve Prometheus metrics on this Unix socket", "PATH" },
+    { "classify", 0, 0, G_OPTION_ARG_NONE, &classify, "count frames and time replies by message type", NULL },
+    { "message-types", 0, 0, G_OPTION_ARG_FILENAME, &message_types, "names of the message types and where the type is, implies --classify", "FILE" },
+    { "capture", 0, 0, G_OPTION_ARG_FILENAME, &capture_path, "record every bridged frame to this file, see ctntad-bench --replay", "FILE" },
+    { "handover-socket", 0, 0, G_OPTION_ARG_FILENAME, &handover_socket, "hand the pairs over to a daemon started with --takeover on this Unix socket, empty to not (default " CTN_STATE_DIR "/handover)", "PATH" },
+    { "takeover", 0, 0, G_OPTION_ARG_NONE, &takeover, "take the pairs over from the daemon running on the handover socket without interrupting tuning", NULL },
+    { "control-socket", 0, 0, G_OPTION_ARG_FILENAME, &control_socket, "accept commands on this Unix socket, empty to not (default " CTN_STATE_DIR "/control)", "PATH" },
+    { "pairing-cache", 0, 0, G_OPTION_ARG_FILENAME, &pairing_cache, "where mocur and TA pairings are kept across restarts, empty to not keep them (default " CTN_STATE_DIR "/pairings)", "FILE" },
+    { "pairing-grace", 0, 0, G_OPTION_ARG_INT, &pairing_grace, "seconds after startup that devices wait for the partner they were last paired with", "SECONDS" },
+    { "search-target", 0, 0, G_OPTION_ARG_STRING, &search_target, "SSDP search target for mocurs (default " MOCUR_DEVICE_TYPE ")", "ST" },
+    { "allow", 0, 0, G_OPTION_ARG_STRING_ARRAY, &discovery_allow, "only use this mocur, by UDN or address, may be repeated", "UDN|ADDRESS" },
+    { "log-level", 0, 0, G_OPTION_ARG_STRING, &log_levels, "error, warning, info or debug, per subsystem as core|usb|upnp|reset|traffic=LEVEL,...", "SPEC" },
     { NULL }
 };
 
@@ -819,14 +3191,33 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
-    g_print("Starting %s\n", PACKAGE_STRING);
+    if( log_levels && !ctn_log_set_levels( log_levels, &error ) ) {
+        g_print("Option parsing failed: %s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    if( downstream_overflow_name ) {
+        if( strcmp( downstream_overflow_name, "drop-newest" ) == 0 ) {
+            downstream_overflow = DOWNSTREAM_DROP_NEWEST;
+        } else if( strcmp( downstream_overflow_name, "drop-oldest" ) != 0 ) {
+            g_print("Option parsing failed: unknown overflow policy %s\n", downstream_overflow_name);
+            return EXIT_FAILURE;
+        }
+    }
+
+    //0 is no metrics, anything else has to fit a port
+    if( metrics_port < 0 || metrics_port > G_MAXUINT16 ) {
+        g_print("Option parsing failed: metrics port %d out of range\n", metrics_port);
+        return EXIT_FAILURE;
+    }
+
+    ctn_info( CTN_LOG_CORE, "Starting %s", PACKAGE_STRING );
 
     CtnTa* ct = g_slice_new0( CtnTa );
 
-    ct->mocurs = g_ptr_array_new();
-    ct->tas = g_ptr_array_new();
-    ct->pairs = g_ptr_array_new();
-    ct->context = gupnp_context_new( interface, 0, &error );
+    ct->registry = ctn_registry_new();
+    ct->standby = g_hash_table_new_full( g_str_hash, g_str_equal, g_free,
+            (GDestroyNotify)g_ptr_array_unref );
 
     if(i_bus != -1) {
         g_bus = (guint16)i_bus;
@@ -836,11 +3227,21 @@ int main(int argc, char** argv)
         g_addr = (guint16)i_addr;
     }
 
-    if( error ) {
-        g_printerr("Error creating the GUPnP context: %s\n",
-                error->message);
-        g_error_free(error);
-        return EXIT_FAILURE;
+    upstream_window = MAX( upstream_window, 1 );
+    downstream_window = MAX( downstream_window, 1 );
+    downstream_queue = MAX( downstream_queue, 1 );
+    downstream_deadline = MAX( downstream_deadline, 0 );
+    upstream_queue = MAX( upstream_queue, 1 );
+    stall_timeout = MAX( stall_timeout, 0 );
+    event_dedup = MAX( event_dedup, 0 );
+    upstream_policy.attempts = MAX( upstream_retries, 0 ) + 1;
+
+    if( ta_buffer_size ) {
+        ta_buffer_size = CLAMP( ta_buffer_size, TA_MIN_BUFFER_SIZE, TA_MAX_BUFFER_SIZE );
+        ta_buffer_size = ( ta_buffer_size + TA_PACKET_SIZE - 1 ) / TA_PACKET_SIZE * TA_PACKET_SIZE;
+    }
+    if( ta_buffers ) {
+        ta_buffers = CLAMP( ta_buffers, 1, TA_MAX_RECV_BUFFERS );
     }
 
     ct->usb_context = g_usb_context_new( &error );
@@ -856,32 +3257,101 @@ int main(int argc, char** argv)
         list_usb(ct);
     } else {
 
-        GIOChannel* in = g_io_channel_unix_new(fileno(stdin));
-        g_io_add_watch(in, G_IO_IN | G_IO_ERR | G_IO_HUP | G_IO_NVAL,
-                stdin_cb, ct);
-
         ct->main_loop = g_main_loop_new( NULL, FALSE );
+        ctn_log_init();
+
+        if( classify || message_types ) {
+            ct->classifier = ctn_classifier_load( message_types, &error );
+            if( !ct->classifier ) {
+                g_printerr("Error loading message types: %s\n", error->message);
+                g_error_free(error);
+                return EXIT_FAILURE;
+            }
+        }
 
-        setup_upnp(ct);
+        if( capture_path ) {
+            ct->capture = ctn_capture_open( capture_path, &error );
+            if( !ct->capture ) {
+                g_printerr("Error starting the capture: %s\n", error->message);
+                g_error_free(error);
+                return EXIT_FAILURE;
+            }
+        }
+
+        //an empty path keeps the pairings for this run only
+        ct->affinity = ctn_affinity_load( *pairing_cache ? pairing_cache : NULL );
+        if( pairing_grace > 0 ) {
+            ct->affinity_until = g_get_monotonic_time() + (gint64)pairing_grace * G_USEC_PER_SEC;
+            g_timeout_add_seconds( pairing_grace, (GSourceFunc)affinity_grace_over, ct );
+        }
+
+        //the running daemon keeps its TAs and sockets until we are ready
+        ct->inherited = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, g_free );
+        if( takeover && *handover_socket ) {
+            ct->takeover = ctn_handover_client_connect( handover_socket, &error );
+            if( !ct->takeover ) {
+                ctn_warning( CTN_LOG_CORE, "nothing to take over on %s: %s",
+                        handover_socket, error->message );
+                g_error_free(error);
+                error = NULL;
+            }
+        }
+        if( ct->takeover ) {
+            takeover_start( ct );
+        } else if( !start_services( ct, &error ) ) {
+            g_printerr("Error %s\n", error->message);
+            g_error_free(error);
+            return EXIT_FAILURE;
+        }
+
+        //TA completions and frame handling stay off the main loop, frames
+        //come back ahead of SSDP, GENA and SOAP work
+        ct->usb_worker = ctn_worker_new( "usb" );
+        ctn_worker_set_nice( ct->usb_worker, usb_nice );
+        ct->upstream = ctn_handoff_new( NULL, G_PRIORITY_HIGH, upstream_handoff_cb, ct, &error );
+        if( !ct->upstream ) {
+            g_printerr("Error creating the USB handoff: %s\n",
+                    error->message);
+            g_error_free(error);
+            return EXIT_FAILURE;
+        }
+
+        if( !setup_upnp( ct, &error ) ) {
+            g_printerr("Error creating the GUPnP context: %s\n",
+                    error->message);
+            g_error_free(error);
+            return EXIT_FAILURE;
+        }
         setup_usb(ct);
 
         g_main_loop_run(ct->main_loop);
 
+        ctn_handoff_free( ct->upstream );
+        ctn_worker_release( ct->usb_worker );
+        ctn_handover_client_free( ct->takeover );
+        ctn_handover_free( ct->handover );
+        ctn_control_free( ct->control );
+        ctn_capture_close( ct->capture );
+        ctn_metrics_free( ct->metrics );
         g_main_loop_unref( ct->main_loop );
+        ctn_log_shutdown();
     }
 
-    if( ct->cp ) {
-        g_object_unref( ct->cp );
+    if( ct->context_manager ) {
+        g_object_unref( ct->context_manager );
+    }
+    if( ct->control_points ) {
+        g_ptr_array_unref( ct->control_points );
     }
 
-    g_object_unref( ct->context );
     g_object_unref( ct->usb_list );
     g_object_unref( ct->usb_context );
-    g_ptr_array_unref( ct->mocurs );
-    g_ptr_array_unref( ct->tas );
-    g_ptr_array_unref( ct->pairs );
+    ctn_registry_free( ct->registry );
+    g_hash_table_unref( ct->standby );
+    ctn_affinity_free( ct->affinity );
 
+    gint exit_status = ct->exit_status;
     g_slice_free( CtnTa, ct );
 
-    return EXIT_SUCCESS;
+    return exit_status;
 }
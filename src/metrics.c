@@ -0,0 +1,308 @@
+#include "metrics.h"
+
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "handover.h"
+#include "log.h"
+
+#define METRICS_REQUEST_SIZE 2048
+
+struct _CtnMetrics {
+    GSocketService* service;
+    CtnMetricsCollect collect;
+    gpointer user_data;
+    gchar* unix_path;
+    GList* sockets;
+};
+
+typedef struct {
+    CtnMetrics* m;
+    GSocketConnection* connection;
+    gchar request[METRICS_REQUEST_SIZE];
+    gsize len;
+    GString* response;
+} MetricsClient;
+
+static void
+client_free(MetricsClient* c)
+{
+    g_io_stream_close( G_IO_STREAM(c->connection), NULL, NULL );
+    g_object_unref( c->connection );
+    if( c->response ) {
+        g_string_free( c->response, TRUE );
+    }
+    g_slice_free( MetricsClient, c );
+}
+
+static void
+response_written(
+        GObject* source,
+        GAsyncResult* res,
+        gpointer user_data)
+{
+    MetricsClient* c = user_data;
+    GError* error = NULL;
+
+    if( !g_output_stream_write_all_finish( G_OUTPUT_STREAM(source), res, NULL, &error ) ) {
+        ctn_warning( CTN_LOG_CORE, "metrics write failed %s", error->message );
+        g_error_free( error );
+        error = NULL;
+    }
+
+    client_free( c );
+}
+
+static void
+respond(MetricsClient* c)
+{
+    GString* body = g_string_sized_new( 4096 );
+    const gchar* status = "200 OK";
+
+    //anything that isn't a GET of the page itself gets an empty 404
+    if( strncmp( c->request, "GET /metrics ", strlen("GET /metrics ") ) == 0 ||
+            strncmp( c->request, "GET / ", strlen("GET / ") ) == 0 ) {
+        c->m->collect( body, c->m->user_data );
+    } else {
+        status = "404 Not Found";
+    }
+
+    c->response = g_string_sized_new( body->len + 128 );
+    g_string_printf( c->response,
+            "HTTP/1.0 %s\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+            "Connection: close\r\n"
+            "\r\n",
+            status, body->len );
+    g_string_append_len( c->response, body->str, body->len );
+    g_string_free( body, TRUE );
+
+    g_output_stream_write_all_async(
+            g_io_stream_get_output_stream( G_IO_STREAM(c->connection) ),
+            c->response->str,
+            c->response->len,
+            G_PRIORITY_DEFAULT,
+            NULL,
+            response_written,
+            c);
+}
+
+static void request_read(
+        GObject* source,
+        GAsyncResult* res,
+        gpointer user_data);
+
+static void
+read_request(MetricsClient* c)
+{
+    g_input_stream_read_async(
+            g_io_stream_get_input_stream( G_IO_STREAM(c->connection) ),
+            c->request + c->len,
+            sizeof(c->request) - 1 - c->len,
+            G_PRIORITY_DEFAULT,
+            NULL,
+            request_read,
+            c);
+}
+
+static void
+request_read(
+        GObject* source,
+        GAsyncResult* res,
+        gpointer user_data)
+{
+    MetricsClient* c = user_data;
+    GError* error = NULL;
+    gssize n = g_input_stream_read_finish( G_INPUT_STREAM(source), res, &error );
+
+    if( n <= 0 ) {
+        if( error ) {
+            ctn_warning( CTN_LOG_CORE, "metrics read failed %s", error->message );
+            g_error_free( error );
+            error = NULL;
+        }
+        client_free( c );
+        return;
+    }
+
+    c->len += n;
+    c->request[c->len] = '\0';
+
+    //wait for the end of the headers, a full buffer is answered as is
+    if( !strstr( c->request, "\r\n\r\n" ) && !strstr( c->request, "\n\n" ) &&
+            c->len < sizeof(c->request) - 1 ) {
+        read_request( c );
+        return;
+    }
+
+    respond( c );
+}
+
+static gboolean
+incoming(
+        GSocketService* service,
+        GSocketConnection* connection,
+        GObject* source_object,
+        gpointer user_data)
+{
+    MetricsClient* c = g_slice_new0( MetricsClient );
+    c->m = user_data;
+    c->connection = g_object_ref( connection );
+    read_request( c );
+    return TRUE;
+}
+
+CtnMetrics*
+ctn_metrics_new(CtnMetricsCollect collect,
+        gpointer user_data)
+{
+    CtnMetrics* m = g_slice_new0( CtnMetrics );
+    m->collect = collect;
+    m->user_data = user_data;
+    m->service = g_socket_service_new();
+    g_signal_connect( m->service, "incoming", G_CALLBACK(incoming), m );
+    return m;
+}
+
+void
+ctn_metrics_free(CtnMetrics* m)
+{
+    if( !m ) {
+        return;
+    }
+
+    g_socket_service_stop( m->service );
+    g_socket_listener_close( G_SOCKET_LISTENER(m->service) );
+    g_object_unref( m->service );
+    g_list_free_full( m->sockets, g_object_unref );
+    if( m->unix_path ) {
+        g_unlink( m->unix_path );
+        g_free( m->unix_path );
+    }
+    g_slice_free( CtnMetrics, m );
+}
+
+static gboolean
+listen_address(
+        CtnMetrics* m,
+        GSocketAddress* address,
+        GError** error)
+{
+    GSocket* socket = ctn_handover_socket_new( address, error );
+    gboolean ok;
+
+    g_object_unref( address );
+    if( !socket ) {
+        return FALSE;
+    }
+
+    ok = ctn_metrics_listen_socket( m, socket, NULL, error );
+    g_object_unref( socket );
+    return ok;
+}
+
+gboolean
+ctn_metrics_listen_port(CtnMetrics* m,
+        guint16 port,
+        GError** error)
+{
+    //loopback only, the page is for a local scraper
+    return listen_address( m, g_inet_socket_address_new_from_string( "127.0.0.1", port ), error );
+}
+
+gboolean
+ctn_metrics_listen_unix(CtnMetrics* m,
+        const gchar* path,
+        GError** error)
+{
+    GSocket* socket = ctn_handover_socket_new_unix( path, 0, error );
+    gboolean ok;
+
+    if( !socket ) {
+        return FALSE;
+    }
+
+    ok = ctn_metrics_listen_socket( m, socket, path, error );
+    g_object_unref( socket );
+    return ok;
+}
+
+gboolean
+ctn_metrics_listen_socket(CtnMetrics* m,
+        GSocket* socket,
+        const gchar* path,
+        GError** error)
+{
+    if( !g_socket_listener_add_socket( G_SOCKET_LISTENER(m->service), socket, NULL, error ) ) {
+        return FALSE;
+    }
+
+    m->sockets = g_list_append( m->sockets, g_object_ref( socket ) );
+    if( path ) {
+        g_free( m->unix_path );
+        m->unix_path = g_strdup( path );
+    }
+    return TRUE;
+}
+
+GList*
+ctn_metrics_hand_over(CtnMetrics* m)
+{
+    g_socket_service_stop( m->service );
+
+    //the path belongs to the new daemon now
+    g_free( m->unix_path );
+    m->unix_path = NULL;
+    return m->sockets;
+}
+
+void
+ctn_metrics_family(GString* out,
+        const gchar* name,
+        const gchar* type,
+        const gchar* help)
+{
+    g_string_append_printf( out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type );
+}
+
+void
+ctn_metrics_value(GString* out,
+        const gchar* name,
+        const gchar* labels,
+        gdouble value)
+{
+    if( labels ) {
+        g_string_append_printf( out, "%s{%s} %.17g\n", name, labels, value );
+    } else {
+        g_string_append_printf( out, "%s %.17g\n", name, value );
+    }
+}
+
+void
+ctn_metrics_summary(GString* out,
+        const gchar* name,
+        const gchar* labels,
+        const CtnHistogram* h)
+{
+    static const gdouble quantiles[] = { 0.5, 0.99, 0.999 };
+    gchar* series;
+    int i;
+
+    for( i=0; i<G_N_ELEMENTS(quantiles); i++ ) {
+        g_string_append_printf( out, "%s{%s%squantile=\"%g\"} %.17g\n",
+                name,
+                labels ? labels : "",
+                labels ? "," : "",
+                quantiles[i],
+                ctn_histogram_percentile( h, quantiles[i] * 100.0 ) / 1e6 );
+    }
+
+    series = g_strconcat( name, "_sum", NULL );
+    ctn_metrics_value( out, series, labels, h->sum / 1e6 );
+    g_free( series );
+
+    series = g_strconcat( name, "_count", NULL );
+    ctn_metrics_value( out, series, labels, h->count );
+    g_free( series );
+}
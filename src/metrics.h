@@ -0,0 +1,71 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <gio/gio.h>
+
+#include "stats.h"
+
+G_BEGIN_DECLS
+
+/* Read-only metrics page in the Prometheus text format, served over HTTP
+ * on a loopback port or a Unix socket. The page is built on the main loop
+ * by the collect function each time it is scraped. */
+
+typedef struct _CtnMetrics CtnMetrics;
+
+typedef void (*CtnMetricsCollect) (GString *out,
+        gpointer user_data);
+
+CtnMetrics*
+ctn_metrics_new (CtnMetricsCollect collect,
+        gpointer user_data);
+
+void
+ctn_metrics_free (CtnMetrics *metrics);
+
+gboolean
+ctn_metrics_listen_port (CtnMetrics *metrics,
+        guint16 port,
+        GError **error);
+
+gboolean
+ctn_metrics_listen_unix (CtnMetrics *metrics,
+        const gchar *path,
+        GError **error);
+
+/* a socket passed over by a daemon handing over, path is where it
+ * listens when it is a Unix socket */
+gboolean
+ctn_metrics_listen_socket (CtnMetrics *metrics,
+        GSocket *socket,
+        const gchar *path,
+        GError **error);
+
+/* stops serving, the listening sockets stay open for the new daemon
+ * until the metrics are freed. Owned by the metrics. */
+GList*
+ctn_metrics_hand_over (CtnMetrics *metrics);
+
+/* formatting helpers, labels is the text between the braces or NULL */
+void
+ctn_metrics_family (GString *out,
+        const gchar *name,
+        const gchar *type,
+        const gchar *help);
+
+void
+ctn_metrics_value (GString *out,
+        const gchar *name,
+        const gchar *labels,
+        gdouble value);
+
+/* a summary in seconds of a histogram recorded in microseconds */
+void
+ctn_metrics_summary (GString *out,
+        const gchar *name,
+        const gchar *labels,
+        const CtnHistogram *histogram);
+
+G_END_DECLS
+
+#endif
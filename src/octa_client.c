@@ -1,7 +1,72 @@
 #include "octa_client.h"
+#include "log.h"
 
 typedef struct {GCallback cb; gpointer userdata; } GUPnPAsyncData;
 
+/* arguments and reply of one scheduled action, kept across its retries */
+typedef struct {
+    GCallback cb;
+    gpointer userdata;
+    const gchar *octa_message;
+    gboolean enable_octa;
+} OctaCall;
+
+#define ASYNC_DATA_SLAB 32
+
+/* recycles the OctaCall of actions, notify data lives forever */
+CtnPool*
+octa_client_get_pool (void)
+{
+    static CtnPool *pool = NULL;
+
+    if (g_once_init_enter (&pool)) {
+        g_once_init_leave (&pool,
+                ctn_pool_new ("octa calls", sizeof (OctaCall), ASYNC_DATA_SLAB));
+    }
+
+    return pool;
+}
+
+static OctaCall *
+_octa_call_new (GCallback callback,
+        gpointer userdata)
+{
+    OctaCall *call;
+
+    call = (OctaCall *) ctn_pool_alloc0 (octa_client_get_pool ());
+    call->cb = callback;
+    call->userdata = userdata;
+
+    return call;
+}
+
+/* actions without out arguments */
+static gboolean
+_octa_call_end (GUPnPServiceProxy *proxy,
+        GUPnPServiceProxyAction *action,
+        gpointer data,
+        GError **error)
+{
+    return gupnp_service_proxy_end_action
+        (proxy, action, error,
+         NULL);
+}
+
+/* SendMessageToUDCP, OCTAInit and USBResetComplete share a reply type */
+static void
+_octa_call_done (GUPnPServiceProxy *proxy,
+        GError *error,
+        gpointer data)
+{
+    OctaCall *call = (OctaCall *) data;
+
+    ((octa_init_reply)call->cb)
+        (proxy,
+         error, call->userdata);
+
+    ctn_pool_release (octa_client_get_pool (), call);
+}
+
 /* action SendMessageToUDCP */
 
 gboolean
@@ -16,82 +81,94 @@ send_message_to_udcp (GUPnPServiceProxy *proxy,
          NULL);
 }
 
-static void _send_message_to_udcp_async_callback (GUPnPServiceProxy *proxy,
-        GUPnPServiceProxyAction *action,
+static GUPnPServiceProxyAction *
+_send_message_to_udcp_begin (GUPnPServiceProxy *proxy,
+        gpointer data,
+        GUPnPServiceProxyActionCallback callback,
         gpointer user_data)
 {
-    GUPnPAsyncData *cbdata;
-    GError *error = NULL;
+    OctaCall *call = (OctaCall *) data;
 
-    cbdata = (GUPnPAsyncData *) user_data;
-    gupnp_service_proxy_end_action
-        (proxy, action, &error,
+    return gupnp_service_proxy_begin_action
+        (proxy, "SendMessageToUDCP",
+         callback, user_data,
+         "OCTAMessage", GUPNP_TYPE_BIN_BASE64, call->octa_message,
          NULL);
-    ((send_message_to_udcp_reply)cbdata->cb)
-        (proxy,
-         error, cbdata->userdata);
-
-    g_slice_free1 (sizeof (*cbdata), cbdata);
 }
 
-GUPnPServiceProxyAction *
-send_message_to_udcp_async (GUPnPServiceProxy *proxy,
+CtnAction *
+send_message_to_udcp_async (CtnActionQueue *queue,
+        GUPnPServiceProxy *proxy,
+        const CtnActionPolicy *policy,
         const gchar *in_octa_message,
         send_message_to_udcp_reply callback,
         gpointer userdata)
 {
-    GUPnPServiceProxyAction* action;
-    GUPnPAsyncData *cbdata;
+    OctaCall *call;
 
-    cbdata = (GUPnPAsyncData *) g_slice_alloc (sizeof (*cbdata));
-    cbdata->cb = G_CALLBACK (callback);
-    cbdata->userdata = userdata;
-    action = gupnp_service_proxy_begin_action
-        (proxy, "SendMessageToUDCP",
-         _send_message_to_udcp_async_callback, cbdata,
-         "OCTAMessage", GUPNP_TYPE_BIN_BASE64, in_octa_message,
-         NULL);
+    call = _octa_call_new (G_CALLBACK (callback), userdata);
+    call->octa_message = in_octa_message;
 
-    return action;
+    return ctn_action_submit
+        (queue, proxy, "SendMessageToUDCP", policy,
+         _send_message_to_udcp_begin, _octa_call_end, _octa_call_done,
+         call);
 }
 
-static void _octa_get_enable_octa_async_callback(GUPnPServiceProxy* proxy,
-        GUPnPServiceProxyAction* action,
-        gpointer userdata)
+/* query A_ARG_TYPE_OCTA_ENABLE */
+
+static GUPnPServiceProxyAction *
+_octa_get_enable_octa_begin (GUPnPServiceProxy *proxy,
+        gpointer data,
+        GUPnPServiceProxyActionCallback callback,
+        gpointer user_data)
 {
-    GUPnPAsyncData* cbdata = userdata;
-    GError* error = NULL;
-    gboolean octa_enable = FALSE;
+    return gupnp_service_proxy_begin_action
+        (proxy, "QueryStateVariable",
+         callback, user_data,
+         "varName", G_TYPE_STRING, "A_ARG_TYPE_OCTA_ENABLE",
+         NULL);
+}
 
-    gupnp_service_proxy_end_action(
-            proxy, action, &error,
-            "return", G_TYPE_BOOLEAN, &octa_enable,
-            NULL);
+static gboolean
+_octa_get_enable_octa_end (GUPnPServiceProxy *proxy,
+        GUPnPServiceProxyAction *action,
+        gpointer data,
+        GError **error)
+{
+    OctaCall *call = (OctaCall *) data;
 
-    ((get_octa_enable_reply)cbdata->cb)(
-        proxy, octa_enable, error, cbdata->userdata);
+    return gupnp_service_proxy_end_action
+        (proxy, action, error,
+         "return", G_TYPE_BOOLEAN, &call->enable_octa,
+         NULL);
+}
 
-    g_slice_free1(sizeof(*cbdata), cbdata);
+static void
+_octa_get_enable_octa_done (GUPnPServiceProxy *proxy,
+        GError *error,
+        gpointer data)
+{
+    OctaCall *call = (OctaCall *) data;
+
+    ((get_octa_enable_reply)call->cb)
+        (proxy, call->enable_octa,
+         error, call->userdata);
+
+    ctn_pool_release (octa_client_get_pool (), call);
 }
 
-GUPnPServiceProxyAction*
-octa_get_enable_octa_async(GUPnPServiceProxy* proxy,
+CtnAction *
+octa_get_enable_octa_async (CtnActionQueue *queue,
+        GUPnPServiceProxy *proxy,
+        const CtnActionPolicy *policy,
         get_octa_enable_reply callback,
         gpointer userdata)
 {
-    GUPnPServiceProxyAction* action;
-    GUPnPAsyncData* cbdata;
-    
-    cbdata = g_slice_alloc(sizeof(*cbdata));
-    cbdata->cb = G_CALLBACK(callback);
-    cbdata->userdata = userdata;
-    action = gupnp_service_proxy_begin_action(
-            proxy, "QueryStateVariable",
-            _octa_get_enable_octa_async_callback, cbdata,
-            "varName", G_TYPE_STRING, "A_ARG_TYPE_OCTA_ENABLE",
-            NULL);
-
-    return action;
+    return ctn_action_submit
+        (queue, proxy, "QueryStateVariable", policy,
+         _octa_get_enable_octa_begin, _octa_get_enable_octa_end, _octa_get_enable_octa_done,
+         _octa_call_new (G_CALLBACK (callback), userdata));
 }
 
 /* action OCTAInit */
@@ -108,44 +185,39 @@ octa_init (GUPnPServiceProxy *proxy,
          NULL);
 }
 
-static void _octa_init_async_callback (GUPnPServiceProxy *proxy,
-        GUPnPServiceProxyAction *action,
+static GUPnPServiceProxyAction *
+_octa_init_begin (GUPnPServiceProxy *proxy,
+        gpointer data,
+        GUPnPServiceProxyActionCallback callback,
         gpointer user_data)
 {
-    GUPnPAsyncData *cbdata;
-    GError *error = NULL;
+    OctaCall *call = (OctaCall *) data;
 
-    cbdata = (GUPnPAsyncData *) user_data;
-    gupnp_service_proxy_end_action
-        (proxy, action, &error,
+    ctn_debug (CTN_LOG_UPNP, "OCTAInit %d", call->enable_octa);
+    return gupnp_service_proxy_begin_action
+        (proxy, "OCTAInit",
+         callback, user_data,
+         "EnableOCTA", G_TYPE_BOOLEAN, call->enable_octa,
          NULL);
-    ((octa_init_reply)cbdata->cb)
-        (proxy,
-         error, cbdata->userdata);
-
-    g_slice_free1 (sizeof (*cbdata), cbdata);
 }
 
-GUPnPServiceProxyAction *
-octa_init_async (GUPnPServiceProxy *proxy,
+CtnAction *
+octa_init_async (CtnActionQueue *queue,
+        GUPnPServiceProxy *proxy,
+        const CtnActionPolicy *policy,
         const gboolean in_enable_octa,
         octa_init_reply callback,
         gpointer userdata)
 {
-    GUPnPServiceProxyAction* action;
-    GUPnPAsyncData *cbdata;
+    OctaCall *call;
 
-    cbdata = (GUPnPAsyncData *) g_slice_alloc (sizeof (*cbdata));
-    cbdata->cb = G_CALLBACK (callback);
-    cbdata->userdata = userdata;
-    g_print("OCTAInit %d\n", in_enable_octa);
-    action = gupnp_service_proxy_begin_action
-        (proxy, "OCTAInit",
-         _octa_init_async_callback, cbdata,
-         "EnableOCTA", G_TYPE_BOOLEAN, in_enable_octa,
-         NULL);
+    call = _octa_call_new (G_CALLBACK (callback), userdata);
+    call->enable_octa = in_enable_octa;
 
-    return action;
+    return ctn_action_submit
+        (queue, proxy, "OCTAInit", policy,
+         _octa_init_begin, _octa_call_end, _octa_call_done,
+         call);
 }
 
 /* action USBResetComplete */
@@ -160,42 +232,96 @@ usb_reset_complete (GUPnPServiceProxy *proxy,
          NULL);
 }
 
-
-static void _usb_reset_complete_async_callback (GUPnPServiceProxy *proxy,
-        GUPnPServiceProxyAction *action,
+static GUPnPServiceProxyAction *
+_usb_reset_complete_begin (GUPnPServiceProxy *proxy,
+        gpointer data,
+        GUPnPServiceProxyActionCallback callback,
         gpointer user_data)
 {
-    GUPnPAsyncData *cbdata;
-    GError *error = NULL;
-
-    cbdata = (GUPnPAsyncData *) user_data;
-    gupnp_service_proxy_end_action
-        (proxy, action, &error,
+    return gupnp_service_proxy_begin_action
+        (proxy, "USBResetComplete",
+         callback, user_data,
          NULL);
-    ((usb_reset_complete_reply)cbdata->cb)
-        (proxy,
-         error, cbdata->userdata);
-
-    g_slice_free1 (sizeof (*cbdata), cbdata);
 }
 
-GUPnPServiceProxyAction *
-usb_reset_complete_async (GUPnPServiceProxy *proxy,
+CtnAction *
+usb_reset_complete_async (CtnActionQueue *queue,
+        GUPnPServiceProxy *proxy,
+        const CtnActionPolicy *policy,
         usb_reset_complete_reply callback,
         gpointer userdata)
 {
-    GUPnPServiceProxyAction* action;
+    return ctn_action_submit
+        (queue, proxy, "USBResetComplete", policy,
+         _usb_reset_complete_begin, _octa_call_end, _octa_call_done,
+         _octa_call_new (G_CALLBACK (callback), userdata));
+}
+
+/* the cbdata of every notify added to a proxy, so it can be found again
+ * by callback and userdata to remove the notify */
+#define NOTIFIES_KEY "ctn-notifies"
+
+static void
+notify_data_free (gpointer data)
+{
+    g_slice_free (GUPnPAsyncData, data);
+}
+
+static gboolean
+add_notify (GUPnPServiceProxy *proxy,
+        const gchar *variable,
+        GType type,
+        GUPnPServiceProxyNotifyCallback notify,
+        GCallback callback,
+        gpointer userdata)
+{
     GUPnPAsyncData *cbdata;
+    GList *notifies;
 
-    cbdata = (GUPnPAsyncData *) g_slice_alloc (sizeof (*cbdata));
-    cbdata->cb = G_CALLBACK (callback);
+    cbdata = g_slice_new (GUPnPAsyncData);
+    cbdata->cb = callback;
     cbdata->userdata = userdata;
-    action = gupnp_service_proxy_begin_action
-        (proxy, "USBResetComplete",
-         _usb_reset_complete_async_callback, cbdata,
-         NULL);
 
-    return action;
+    notifies = g_object_steal_data (G_OBJECT (proxy), NOTIFIES_KEY);
+    notifies = g_list_prepend (notifies, cbdata);
+    g_object_set_data_full (G_OBJECT (proxy), NOTIFIES_KEY, notifies,
+            (GDestroyNotify) g_list_free);
+
+    return gupnp_service_proxy_add_notify_full
+        (proxy,
+         variable,
+         type,
+         notify,
+         cbdata,
+         notify_data_free);
+}
+
+static gboolean
+remove_notify (GUPnPServiceProxy *proxy,
+        const gchar *variable,
+        GUPnPServiceProxyNotifyCallback notify,
+        GCallback callback,
+        gpointer userdata)
+{
+    GList *notifies;
+    GList *l;
+    gboolean removed = FALSE;
+
+    notifies = g_object_steal_data (G_OBJECT (proxy), NOTIFIES_KEY);
+    for (l = notifies; l; l = l->next) {
+        GUPnPAsyncData *cbdata = l->data;
+        if (cbdata->cb == callback && cbdata->userdata == userdata) {
+            notifies = g_list_delete_link (notifies, l);
+            /* frees cbdata */
+            removed = gupnp_service_proxy_remove_notify
+                (proxy, variable, notify, cbdata);
+            break;
+        }
+    }
+    g_object_set_data_full (G_OBJECT (proxy), NOTIFIES_KEY, notifies,
+            (GDestroyNotify) g_list_free);
+
+    return removed;
 }
 
 /* state variable UDCPMessage */
@@ -231,18 +357,24 @@ udcp_message_add_notify (GUPnPServiceProxy *proxy,
         udcp_message_changed_callback callback,
         gpointer userdata)
 {
-    GUPnPAsyncData *cbdata;
-
-    cbdata = (GUPnPAsyncData *) g_slice_alloc (sizeof (*cbdata));
-    cbdata->cb = G_CALLBACK (callback);
-    cbdata->userdata = userdata;
+    return add_notify (proxy,
+            "UDCPMessage",
+            GUPNP_TYPE_BIN_BASE64,
+            _udcp_message_changed_callback,
+            G_CALLBACK (callback),
+            userdata);
+}
 
-    return gupnp_service_proxy_add_notify
-        (proxy,
-         "UDCPMessage",
-         GUPNP_TYPE_BIN_BASE64,
-         _udcp_message_changed_callback,
-         cbdata);
+gboolean
+udcp_message_remove_notify (GUPnPServiceProxy *proxy,
+        udcp_message_changed_callback callback,
+        gpointer userdata)
+{
+    return remove_notify (proxy,
+            "UDCPMessage",
+            _udcp_message_changed_callback,
+            G_CALLBACK (callback),
+            userdata);
 }
 
 /* state variable TACommunicationError */
@@ -269,16 +401,22 @@ ta_communication_error_add_notify (GUPnPServiceProxy *proxy,
         ta_communication_error_changed_callback callback,
         gpointer userdata)
 {
-    GUPnPAsyncData *cbdata;
-
-    cbdata = (GUPnPAsyncData *) g_slice_alloc (sizeof (*cbdata));
-    cbdata->cb = G_CALLBACK (callback);
-    cbdata->userdata = userdata;
+    return add_notify (proxy,
+            "TACommunicationError",
+            G_TYPE_BOOLEAN,
+            _ta_communication_error_changed_callback,
+            G_CALLBACK (callback),
+            userdata);
+}
 
-    return gupnp_service_proxy_add_notify
-        (proxy,
-         "TACommunicationError",
-         G_TYPE_BOOLEAN,
-         _ta_communication_error_changed_callback,
-         cbdata);
+gboolean
+ta_communication_error_remove_notify (GUPnPServiceProxy *proxy,
+        ta_communication_error_changed_callback callback,
+        gpointer userdata)
+{
+    return remove_notify (proxy,
+            "TACommunicationError",
+            _ta_communication_error_changed_callback,
+            G_CALLBACK (callback),
+            userdata);
 }
@@ -3,8 +3,14 @@
 
 #include <libgupnp/gupnp.h>
 
+#include "action.h"
+#include "pool.h"
+
 G_BEGIN_DECLS
 
+CtnPool *
+octa_client_get_pool (void);
+
 gboolean
 send_message_to_udcp (GUPnPServiceProxy *proxy,
         const gchar *in_octa_message,
@@ -14,8 +20,11 @@ typedef void (*send_message_to_udcp_reply) (GUPnPServiceProxy *proxy,
         GError *error,
         gpointer userdata);
 
-GUPnPServiceProxyAction *
-send_message_to_udcp_async (GUPnPServiceProxy *proxy,
+/* in_octa_message must stay valid until callback has run */
+CtnAction *
+send_message_to_udcp_async (CtnActionQueue *queue,
+        GUPnPServiceProxy *proxy,
+        const CtnActionPolicy *policy,
         const gchar *in_octa_message,
         send_message_to_udcp_reply callback,
         gpointer userdata);
@@ -29,8 +38,10 @@ typedef void (*octa_init_reply) (GUPnPServiceProxy *proxy,
         GError *error,
         gpointer userdata);
 
-GUPnPServiceProxyAction *
-octa_init_async (GUPnPServiceProxy *proxy,
+CtnAction *
+octa_init_async (CtnActionQueue *queue,
+        GUPnPServiceProxy *proxy,
+        const CtnActionPolicy *policy,
         const gboolean in_enable_octa,
         octa_init_reply callback,
         gpointer userdata);
@@ -41,6 +52,13 @@ typedef void (*get_octa_enable_reply) (GUPnPServiceProxy *proxy,
         GError *error,
         gpointer userdata);
 
+CtnAction *
+octa_get_enable_octa_async (CtnActionQueue *queue,
+        GUPnPServiceProxy *proxy,
+        const CtnActionPolicy *policy,
+        get_octa_enable_reply callback,
+        gpointer userdata);
+
 gboolean
 usb_reset_complete (GUPnPServiceProxy *proxy,
         GError **error);
@@ -49,8 +67,10 @@ typedef void (*usb_reset_complete_reply) (GUPnPServiceProxy *proxy,
         GError *error,
         gpointer userdata);
 
-GUPnPServiceProxyAction *
-usb_reset_complete_async (GUPnPServiceProxy *proxy,
+CtnAction *
+usb_reset_complete_async (CtnActionQueue *queue,
+        GUPnPServiceProxy *proxy,
+        const CtnActionPolicy *policy,
         usb_reset_complete_reply callback,
         gpointer userdata);
 
@@ -64,6 +84,11 @@ udcp_message_add_notify (GUPnPServiceProxy *proxy,
         udcp_message_changed_callback callback,
         gpointer userdata);
 
+gboolean
+udcp_message_remove_notify (GUPnPServiceProxy *proxy,
+        udcp_message_changed_callback callback,
+        gpointer userdata);
+
 typedef void
 (*ta_communication_error_changed_callback) (GUPnPServiceProxy *proxy,
         gboolean ta_communication_error,
@@ -74,6 +99,11 @@ ta_communication_error_add_notify (GUPnPServiceProxy *proxy,
         ta_communication_error_changed_callback callback,
         gpointer userdata);
 
+gboolean
+ta_communication_error_remove_notify (GUPnPServiceProxy *proxy,
+        ta_communication_error_changed_callback callback,
+        gpointer userdata);
+
 G_END_DECLS
 
 #endif
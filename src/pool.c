@@ -0,0 +1,128 @@
+#include <string.h>
+
+#include "log.h"
+#include "pool.h"
+
+typedef struct _PoolObject PoolObject;
+struct _PoolObject {
+    PoolObject* next;
+};
+
+struct _CtnPool {
+    GMutex lock;
+    const gchar* name;
+    gsize object_size;
+    guint objects_per_slab;
+    GSList* slabs;
+    PoolObject* free_list;
+    guint capacity;
+    guint in_use;
+    guint high_water;
+};
+
+//called with the lock held
+static void
+pool_grow(CtnPool* pool)
+{
+    guchar* slab = g_malloc( pool->object_size * pool->objects_per_slab );
+    guint i;
+
+    for( i=0; i<pool->objects_per_slab; i++ ) {
+        PoolObject* o = (PoolObject*)( slab + i * pool->object_size );
+        o->next = pool->free_list;
+        pool->free_list = o;
+    }
+
+    pool->slabs = g_slist_prepend( pool->slabs, slab );
+    pool->capacity += pool->objects_per_slab;
+}
+
+CtnPool*
+ctn_pool_new(const gchar* name,
+        gsize object_size,
+        guint objects_per_slab)
+{
+    CtnPool* pool = g_slice_new0( CtnPool );
+    g_mutex_init( &pool->lock );
+    pool->name = name;
+
+    //keep every object aligned for whatever gets stored in it
+    object_size = MAX( object_size, sizeof(PoolObject) );
+    pool->object_size = ( object_size + 15 ) & ~(gsize)15;
+    pool->objects_per_slab = MAX( objects_per_slab, 1 );
+
+    pool_grow( pool );
+    return pool;
+}
+
+void
+ctn_pool_destroy(CtnPool* pool)
+{
+    if( !pool ) {
+        return;
+    }
+
+    if( pool->in_use ) {
+        ctn_warning( CTN_LOG_CORE, "pool %s destroyed with %u objects in use", pool->name, pool->in_use );
+    }
+
+    g_slist_free_full( pool->slabs, g_free );
+    g_mutex_clear( &pool->lock );
+    g_slice_free( CtnPool, pool );
+}
+
+gpointer
+ctn_pool_alloc(CtnPool* pool)
+{
+    PoolObject* o;
+
+    g_mutex_lock( &pool->lock );
+    if( !pool->free_list ) {
+        pool_grow( pool );
+    }
+
+    o = pool->free_list;
+    pool->free_list = o->next;
+    pool->in_use++;
+    if( pool->in_use > pool->high_water ) {
+        pool->high_water = pool->in_use;
+    }
+    g_mutex_unlock( &pool->lock );
+
+    return o;
+}
+
+gpointer
+ctn_pool_alloc0(CtnPool* pool)
+{
+    gpointer o = ctn_pool_alloc( pool );
+    memset( o, 0, pool->object_size );
+    return o;
+}
+
+void
+ctn_pool_release(CtnPool* pool,
+        gpointer object)
+{
+    PoolObject* o = object;
+
+    g_mutex_lock( &pool->lock );
+    o->next = pool->free_list;
+    pool->free_list = o;
+    pool->in_use--;
+    g_mutex_unlock( &pool->lock );
+}
+
+void
+ctn_pool_get_stats(CtnPool* pool,
+        CtnPoolStats* stats)
+{
+    g_mutex_lock( &pool->lock );
+    stats->name = pool->name;
+    stats->object_size = pool->object_size;
+    stats->capacity = pool->capacity;
+    stats->in_use = pool->in_use;
+    stats->high_water = pool->high_water;
+    stats->slabs = g_slist_length( pool->slabs );
+    g_mutex_unlock( &pool->lock );
+}
@@ -0,0 +1,47 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Fixed size object pool. Objects come from slabs that are only given
+ * back when the pool is destroyed, so once a pool has grown to its high
+ * water mark alloc/release never touch the general allocator. Alloc and
+ * release may happen on different threads. */
+typedef struct _CtnPool CtnPool;
+
+typedef struct {
+    const gchar* name;
+    gsize object_size;
+    guint capacity;
+    guint in_use;
+    guint high_water;
+    guint slabs;
+} CtnPoolStats;
+
+CtnPool*
+ctn_pool_new (const gchar *name,
+        gsize object_size,
+        guint objects_per_slab);
+
+void
+ctn_pool_destroy (CtnPool *pool);
+
+gpointer
+ctn_pool_alloc (CtnPool *pool);
+
+gpointer
+ctn_pool_alloc0 (CtnPool *pool);
+
+void
+ctn_pool_release (CtnPool *pool,
+        gpointer object);
+
+void
+ctn_pool_get_stats (CtnPool *pool,
+        CtnPoolStats *stats);
+
+G_END_DECLS
+
+#endif
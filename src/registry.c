@@ -0,0 +1,315 @@
+#include "registry.h"
+
+#define USB_KEY(bus, address) GUINT_TO_POINTER( ( (guint)(bus) << 16 ) | (address) )
+
+typedef struct {
+    gpointer object;
+    const gchar* udn;
+    gpointer usb;
+    gchar* port;
+    GList link;
+} Entry;
+
+//one set of devices or pairs, entries are owned by by_object and the
+//other tables point into them. The order links carry the object itself so
+//the list can be handed out as is.
+typedef struct {
+    GQueue order;
+    GHashTable* by_object;
+    GHashTable* by_udn;
+    GHashTable* by_usb;
+    GHashTable* by_port;
+} Index;
+
+struct _CtnRegistry {
+    Index mocurs;
+    Index tas;
+    Index pairs;
+};
+
+static void
+entry_free(gpointer data)
+{
+    Entry* e = data;
+    g_free( e->port );
+    g_slice_free( Entry, e );
+}
+
+static void
+index_init(Index* index)
+{
+    g_queue_init( &index->order );
+    index->by_object = g_hash_table_new_full( g_direct_hash, g_direct_equal, NULL, entry_free );
+    index->by_udn = g_hash_table_new( g_str_hash, g_str_equal );
+    index->by_usb = g_hash_table_new( g_direct_hash, g_direct_equal );
+    index->by_port = g_hash_table_new( g_str_hash, g_str_equal );
+}
+
+static void
+index_clear(Index* index)
+{
+    g_hash_table_destroy( index->by_udn );
+    g_hash_table_destroy( index->by_usb );
+    g_hash_table_destroy( index->by_port );
+    g_hash_table_destroy( index->by_object );
+}
+
+static void
+index_add(
+        Index* index,
+        gpointer object,
+        GUPnPDeviceProxy* mocur,
+        GUsbDevice* ta)
+{
+    Entry* e = g_slice_new0( Entry );
+
+    e->object = object;
+    e->link.data = object;
+    g_queue_push_tail_link( &index->order, &e->link );
+    g_hash_table_insert( index->by_object, object, e );
+
+    //the udn string belongs to the device proxy, which outlives the entry
+    if( mocur ) {
+        e->udn = gupnp_device_info_get_udn( GUPNP_DEVICE_INFO(mocur) );
+        g_hash_table_insert( index->by_udn, (gpointer)e->udn, e );
+    }
+
+    if( ta ) {
+        e->usb = USB_KEY( g_usb_device_get_bus( ta ), g_usb_device_get_address( ta ) );
+        e->port = ctn_usb_port_path( ta );
+        g_hash_table_insert( index->by_usb, e->usb, e );
+        g_hash_table_insert( index->by_port, e->port, e );
+    }
+}
+
+//returns the object, NULL for a NULL entry
+static gpointer
+index_remove(
+        Index* index,
+        Entry* e)
+{
+    gpointer object;
+
+    if( !e ) {
+        return NULL;
+    }
+
+    object = e->object;
+    g_queue_unlink( &index->order, &e->link );
+    if( e->udn ) {
+        g_hash_table_remove( index->by_udn, e->udn );
+    }
+    if( e->port ) {
+        g_hash_table_remove( index->by_usb, e->usb );
+        g_hash_table_remove( index->by_port, e->port );
+    }
+    g_hash_table_remove( index->by_object, object );
+    return object;
+}
+
+static gpointer
+index_lookup(
+        GHashTable* table,
+        gconstpointer key)
+{
+    Entry* e = g_hash_table_lookup( table, key );
+    return e ? e->object : NULL;
+}
+
+CtnRegistry*
+ctn_registry_new(void)
+{
+    CtnRegistry* r = g_slice_new0( CtnRegistry );
+    index_init( &r->mocurs );
+    index_init( &r->tas );
+    index_init( &r->pairs );
+    return r;
+}
+
+void
+ctn_registry_free(CtnRegistry* r)
+{
+    gpointer o;
+
+    if( !r ) {
+        return;
+    }
+
+    while( ( o = ctn_registry_take_first_mocur( r ) ) ) {
+        g_object_unref( o );
+    }
+    while( ( o = ctn_registry_take_first_ta( r ) ) ) {
+        g_object_unref( o );
+    }
+
+    index_clear( &r->mocurs );
+    index_clear( &r->tas );
+    index_clear( &r->pairs );
+    g_slice_free( CtnRegistry, r );
+}
+
+gchar*
+ctn_usb_port_path(GUsbDevice* device)
+{
+    guint8 ports[8];
+    guint n = 0;
+    GString* path;
+    GUsbDevice* d = g_object_ref( device );
+
+    //walk up to the root hub, which has no port number, USB allows 7 tiers
+    while( d && g_usb_device_get_port_number( d ) && n < G_N_ELEMENTS(ports) ) {
+        GUsbDevice* parent = g_usb_device_get_parent( d );
+        ports[n++] = g_usb_device_get_port_number( d );
+        g_object_unref( d );
+        d = parent;
+    }
+    if( d ) {
+        g_object_unref( d );
+    }
+
+    path = g_string_new( NULL );
+    g_string_printf( path, "%u-", g_usb_device_get_bus( device ) );
+    while( n-- ) {
+        g_string_append_printf( path, "%u%s", ports[n], n ? "." : "" );
+    }
+    return g_string_free( path, FALSE );
+}
+
+void
+ctn_registry_add_mocur(CtnRegistry* r,
+        GUPnPDeviceProxy* mocur)
+{
+    index_add( &r->mocurs, g_object_ref( mocur ), mocur, NULL );
+}
+
+GUPnPDeviceProxy*
+ctn_registry_lookup_mocur(CtnRegistry* r,
+        const gchar* udn)
+{
+    return index_lookup( r->mocurs.by_udn, udn );
+}
+
+GUPnPDeviceProxy*
+ctn_registry_take_mocur(CtnRegistry* r,
+        const gchar* udn)
+{
+    return index_remove( &r->mocurs, g_hash_table_lookup( r->mocurs.by_udn, udn ) );
+}
+
+GUPnPDeviceProxy*
+ctn_registry_take_first_mocur(CtnRegistry* r)
+{
+    GList* first = g_queue_peek_head_link( &r->mocurs.order );
+    return first ? index_remove( &r->mocurs, g_hash_table_lookup( r->mocurs.by_object, first->data ) ) : NULL;
+}
+
+guint
+ctn_registry_n_mocurs(CtnRegistry* r)
+{
+    return g_queue_get_length( &r->mocurs.order );
+}
+
+GList*
+ctn_registry_get_mocurs(CtnRegistry* r)
+{
+    return g_queue_peek_head_link( &r->mocurs.order );
+}
+
+void
+ctn_registry_add_ta(CtnRegistry* r,
+        GUsbDevice* ta)
+{
+    index_add( &r->tas, g_object_ref( ta ), NULL, ta );
+}
+
+GUsbDevice*
+ctn_registry_take_ta(CtnRegistry* r,
+        guint16 bus,
+        guint16 address)
+{
+    return index_remove( &r->tas, g_hash_table_lookup( r->tas.by_usb, USB_KEY( bus, address ) ) );
+}
+
+GUsbDevice*
+ctn_registry_take_ta_port(CtnRegistry* r,
+        const gchar* port)
+{
+    return index_remove( &r->tas, g_hash_table_lookup( r->tas.by_port, port ) );
+}
+
+GUsbDevice*
+ctn_registry_take_first_ta(CtnRegistry* r)
+{
+    GList* first = g_queue_peek_head_link( &r->tas.order );
+    return first ? index_remove( &r->tas, g_hash_table_lookup( r->tas.by_object, first->data ) ) : NULL;
+}
+
+guint
+ctn_registry_n_tas(CtnRegistry* r)
+{
+    return g_queue_get_length( &r->tas.order );
+}
+
+GList*
+ctn_registry_get_tas(CtnRegistry* r)
+{
+    return g_queue_peek_head_link( &r->tas.order );
+}
+
+const gchar*
+ctn_registry_get_ta_port(CtnRegistry* r,
+        GUsbDevice* ta)
+{
+    Entry* e = g_hash_table_lookup( r->tas.by_object, ta );
+    return e ? e->port : NULL;
+}
+
+void
+ctn_registry_add_pair(CtnRegistry* r,
+        gpointer pair,
+        GUPnPDeviceProxy* mocur,
+        GUsbDevice* ta)
+{
+    index_add( &r->pairs, pair, mocur, ta );
+}
+
+void
+ctn_registry_remove_pair(CtnRegistry* r,
+        gpointer pair)
+{
+    index_remove( &r->pairs, g_hash_table_lookup( r->pairs.by_object, pair ) );
+}
+
+gpointer
+ctn_registry_lookup_pair_udn(CtnRegistry* r,
+        const gchar* udn)
+{
+    return index_lookup( r->pairs.by_udn, udn );
+}
+
+gpointer
+ctn_registry_lookup_pair_usb(CtnRegistry* r,
+        guint16 bus,
+        guint16 address)
+{
+    return index_lookup( r->pairs.by_usb, USB_KEY( bus, address ) );
+}
+
+gpointer
+ctn_registry_lookup_pair_port(CtnRegistry* r,
+        const gchar* port)
+{
+    return index_lookup( r->pairs.by_port, port );
+}
+
+GList*
+ctn_registry_get_pairs(CtnRegistry* r)
+{
+    return g_queue_peek_head_link( &r->pairs.order );
+}
+
+guint
+ctn_registry_n_pairs(CtnRegistry* r)
+{
+    return g_queue_get_length( &r->pairs.order );
+}
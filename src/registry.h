@@ -0,0 +1,109 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <gusb.h>
+#include <libgupnp/gupnp.h>
+
+G_BEGIN_DECLS
+
+/* The mocurs, TAs and pairs the daemon knows about. Unpaired devices wait
+ * in arrival order and the registry holds a ref on them, taking one hands
+ * that ref to the caller. Every set is indexed by mocur UDN, USB
+ * bus:address and USB port path, so hotplug and byebye handling never
+ * scans. Main loop only. */
+typedef struct _CtnRegistry CtnRegistry;
+
+CtnRegistry*
+ctn_registry_new (void);
+
+void
+ctn_registry_free (CtnRegistry *registry);
+
+/* "bus-port.port...", the name sysfs gives the port the device is on */
+gchar*
+ctn_usb_port_path (GUsbDevice *device);
+
+void
+ctn_registry_add_mocur (CtnRegistry *registry,
+        GUPnPDeviceProxy *mocur);
+
+/* NULL when it isn't waiting */
+GUPnPDeviceProxy*
+ctn_registry_lookup_mocur (CtnRegistry *registry,
+        const gchar *udn);
+
+GUPnPDeviceProxy*
+ctn_registry_take_mocur (CtnRegistry *registry,
+        const gchar *udn);
+
+GUPnPDeviceProxy*
+ctn_registry_take_first_mocur (CtnRegistry *registry);
+
+guint
+ctn_registry_n_mocurs (CtnRegistry *registry);
+
+/* waiting mocurs in arrival order, owned by the registry */
+GList*
+ctn_registry_get_mocurs (CtnRegistry *registry);
+
+void
+ctn_registry_add_ta (CtnRegistry *registry,
+        GUsbDevice *ta);
+
+GUsbDevice*
+ctn_registry_take_ta (CtnRegistry *registry,
+        guint16 bus,
+        guint16 address);
+
+GUsbDevice*
+ctn_registry_take_ta_port (CtnRegistry *registry,
+        const gchar *port);
+
+GUsbDevice*
+ctn_registry_take_first_ta (CtnRegistry *registry);
+
+guint
+ctn_registry_n_tas (CtnRegistry *registry);
+
+GList*
+ctn_registry_get_tas (CtnRegistry *registry);
+
+/* port path of a waiting TA */
+const gchar*
+ctn_registry_get_ta_port (CtnRegistry *registry,
+        GUsbDevice *ta);
+
+/* pair is opaque to the registry, it only keeps the pointer */
+void
+ctn_registry_add_pair (CtnRegistry *registry,
+        gpointer pair,
+        GUPnPDeviceProxy *mocur,
+        GUsbDevice *ta);
+
+void
+ctn_registry_remove_pair (CtnRegistry *registry,
+        gpointer pair);
+
+gpointer
+ctn_registry_lookup_pair_udn (CtnRegistry *registry,
+        const gchar *udn);
+
+gpointer
+ctn_registry_lookup_pair_usb (CtnRegistry *registry,
+        guint16 bus,
+        guint16 address);
+
+gpointer
+ctn_registry_lookup_pair_port (CtnRegistry *registry,
+        const gchar *port);
+
+/* in pairing order, owned by the registry */
+GList*
+ctn_registry_get_pairs (CtnRegistry *registry);
+
+guint
+ctn_registry_n_pairs (CtnRegistry *registry);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,100 @@
+#include "stats.h"
+
+static guint
+bucket_index(guint64 value)
+{
+    guint msb, shift;
+
+    if( value < CTN_HISTOGRAM_SUB ) {
+        return value;
+    }
+
+    msb = 63 - __builtin_clzll( value );
+    if( msb >= CTN_HISTOGRAM_MAX_BITS ) {
+        return CTN_HISTOGRAM_BUCKETS - 1;
+    }
+
+    shift = msb - CTN_HISTOGRAM_SUB_BITS;
+    return ( shift + 1 ) * CTN_HISTOGRAM_SUB +
+        ( ( value >> shift ) & ( CTN_HISTOGRAM_SUB - 1 ) );
+}
+
+//highest value that lands in bucket i
+static guint64
+bucket_value(guint i)
+{
+    guint shift;
+    guint64 lower;
+
+    if( i < CTN_HISTOGRAM_SUB ) {
+        return i;
+    }
+
+    shift = i / CTN_HISTOGRAM_SUB - 1;
+    lower = (guint64)( CTN_HISTOGRAM_SUB + i % CTN_HISTOGRAM_SUB ) << shift;
+    return lower + ( (guint64)1 << shift ) - 1;
+}
+
+void
+ctn_histogram_record(CtnHistogram* h,
+        guint64 value)
+{
+    h->buckets[ bucket_index( value ) ]++;
+    h->count++;
+    h->sum += value;
+    if( value > h->max ) {
+        h->max = value;
+    }
+}
+
+guint64
+ctn_histogram_percentile(const CtnHistogram* h,
+        gdouble percentile)
+{
+    guint64 target, seen = 0;
+    guint i;
+
+    if( !h->count ) {
+        return 0;
+    }
+
+    target = (guint64)( h->count * percentile / 100.0 );
+    if( target >= h->count ) {
+        return h->max;
+    }
+
+    for( i=0; i<CTN_HISTOGRAM_BUCKETS; i++ ) {
+        seen += h->buckets[i];
+        if( seen > target ) {
+            return MIN( bucket_value( i ), h->max );
+        }
+    }
+
+    return h->max;
+}
+
+static void
+histogram_print(GString* out,
+        const gchar* name,
+        const CtnHistogram* h)
+{
+    g_string_append_printf( out, "\t\t%-8s p50 %" G_GUINT64_FORMAT " p99 %" G_GUINT64_FORMAT
+            " p999 %" G_GUINT64_FORMAT " max %" G_GUINT64_FORMAT " us\n",
+            name,
+            ctn_histogram_percentile( h, 50.0 ),
+            ctn_histogram_percentile( h, 99.0 ),
+            ctn_histogram_percentile( h, 99.9 ),
+            h->max );
+}
+
+void
+ctn_flow_stats_print(GString* out,
+        const gchar* name,
+        const CtnFlowStats* stats)
+{
+    g_string_append_printf( out, "\t%s: %" G_GUINT64_FORMAT " messages, %" G_GUINT64_FORMAT
+            " bytes, %" G_GUINT64_FORMAT " errors\n",
+            name, stats->messages, stats->bytes, stats->errors );
+    histogram_print( out, "queued", &stats->queued );
+    histogram_print( out, "latency", &stats->latency );
+}
@@ -0,0 +1,49 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Log-linear histogram: every power of two is split into
+ * 2^CTN_HISTOGRAM_SUB_BITS buckets, so a percentile is within about 6%
+ * of the recorded value. Recording is a couple of shifts and an add.
+ * A histogram has a single writer, readers may see it mid update. */
+#define CTN_HISTOGRAM_SUB_BITS 4
+#define CTN_HISTOGRAM_SUB (1 << CTN_HISTOGRAM_SUB_BITS)
+#define CTN_HISTOGRAM_MAX_BITS 40
+#define CTN_HISTOGRAM_BUCKETS \
+    ((CTN_HISTOGRAM_MAX_BITS - CTN_HISTOGRAM_SUB_BITS + 1) * CTN_HISTOGRAM_SUB)
+
+typedef struct {
+    guint64 count;
+    guint64 sum;
+    guint64 max;
+    guint64 buckets[CTN_HISTOGRAM_BUCKETS];
+} CtnHistogram;
+
+void
+ctn_histogram_record (CtnHistogram *histogram,
+        guint64 value);
+
+guint64
+ctn_histogram_percentile (const CtnHistogram *histogram,
+        gdouble percentile);
+
+/* traffic in one direction of a pair, times in microseconds */
+typedef struct {
+    guint64 messages;
+    guint64 bytes;
+    guint64 errors;
+    CtnHistogram queued;  //arrival until handed to the other side
+    CtnHistogram latency; //arrival until the other side completed it
+} CtnFlowStats;
+
+void
+ctn_flow_stats_print (GString *out,
+        const gchar *name,
+        const CtnFlowStats *stats);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,58 @@
+#include "usbbuf.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "log.h"
+
+static gsize
+page_round(gsize size)
+{
+    gsize page = sysconf( _SC_PAGESIZE );
+    return ( size + page - 1 ) / page * page;
+}
+
+guchar*
+ctn_usb_buffer_alloc(gsize size,
+        gboolean* pinned)
+{
+    static gint warned = 0;
+    gsize len = page_round( size );
+    void* buffer;
+
+    buffer = mmap( NULL, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0 );
+    if( buffer != MAP_FAILED ) {
+        if( mlock( buffer, len ) == 0 ) {
+            *pinned = TRUE;
+            return buffer;
+        }
+        munmap( buffer, len );
+    }
+
+    //warn once, every buffer after this would fail the same way
+    if( g_atomic_int_compare_and_exchange( &warned, 0, 1 ) ) {
+        ctn_warning( CTN_LOG_USB, "can't pin usb buffers (%s), using the heap",
+                g_strerror( errno ) );
+    }
+
+    *pinned = FALSE;
+    return g_malloc( size );
+}
+
+void
+ctn_usb_buffer_free(guchar* buffer,
+        gsize size,
+        gboolean pinned)
+{
+    if( !buffer ) {
+        return;
+    }
+
+    if( pinned ) {
+        munmap( buffer, page_round( size ) );
+    } else {
+        g_free( buffer );
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef USBBUF_H
+#define USBBUF_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Receive buffers for bulk reads. They are page aligned, prefaulted and
+ * locked into memory, so a completing transfer never takes a page fault on
+ * them. When the kernel refuses the lock (RLIMIT_MEMLOCK) they come from the
+ * heap instead, pinned says which one it was and goes back to free. */
+guchar*
+ctn_usb_buffer_alloc (gsize size,
+        gboolean *pinned);
+
+void
+ctn_usb_buffer_free (guchar *buffer,
+        gsize size,
+        gboolean pinned);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,172 @@
+#include "worker.h"
+
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+
+struct _CtnWorker {
+    GMainContext* context;
+    GMainLoop* loop;
+    GThread* thread;
+    gint owners;
+    gint refs;
+};
+
+static void
+worker_unref(CtnWorker* w)
+{
+    if( g_atomic_int_dec_and_test( &w->refs ) ) {
+        g_main_loop_unref( w->loop );
+        g_main_context_unref( w->context );
+        g_slice_free( CtnWorker, w );
+    }
+}
+
+static gpointer
+worker_thread(gpointer data)
+{
+    CtnWorker* w = data;
+
+    g_main_context_push_thread_default( w->context );
+    g_main_loop_run( w->loop );
+    g_main_context_pop_thread_default( w->context );
+
+    worker_unref( w );
+    return NULL;
+}
+
+CtnWorker*
+ctn_worker_new(const gchar* name)
+{
+    CtnWorker* w = g_slice_new0( CtnWorker );
+    w->context = g_main_context_new();
+    w->loop = g_main_loop_new( w->context, FALSE );
+
+    //one ref for the owner, one for the thread
+    w->owners = 1;
+    w->refs = 2;
+    w->thread = g_thread_new( name, worker_thread, w );
+    g_thread_unref( w->thread );
+
+    return w;
+}
+
+CtnWorker*
+ctn_worker_ref(CtnWorker* w)
+{
+    g_atomic_int_inc( &w->owners );
+    g_atomic_int_inc( &w->refs );
+    return w;
+}
+
+static gboolean
+worker_quit(gpointer data)
+{
+    CtnWorker* w = data;
+    g_main_loop_quit( w->loop );
+    return FALSE;
+}
+
+void
+ctn_worker_release(CtnWorker* w)
+{
+    if( !w ) {
+        return;
+    }
+
+    //queued rather than g_main_loop_quit() so a quit can't be lost before
+    //the thread got around to running the loop
+    if( g_atomic_int_dec_and_test( &w->owners ) ) {
+        ctn_worker_idle_add( w, worker_quit, w );
+    }
+    worker_unref( w );
+}
+
+typedef struct {
+    CtnWorker* w;
+    gint nice;
+} WorkerNice;
+
+static gboolean
+worker_nice(gpointer data)
+{
+    WorkerNice* wn = data;
+
+    //per thread on Linux, PRIO_PROCESS with a tid only affects that thread
+    if( setpriority( PRIO_PROCESS, (id_t)syscall( SYS_gettid ), wn->nice ) < 0 ) {
+        ctn_warning( CTN_LOG_CORE, "failed to renice worker thread to %d: %s",
+                wn->nice, g_strerror( errno ) );
+    }
+
+    worker_unref( wn->w );
+    g_slice_free( WorkerNice, wn );
+    return FALSE;
+}
+
+void
+ctn_worker_set_nice(CtnWorker* w,
+        gint nice)
+{
+    WorkerNice* wn;
+
+    if( !w ) {
+        return;
+    }
+
+    wn = g_slice_new( WorkerNice );
+    g_atomic_int_inc( &w->refs );
+    wn->w = w;
+    wn->nice = nice;
+    ctn_worker_invoke( w, worker_nice, wn );
+}
+
+GMainContext*
+ctn_worker_get_context(CtnWorker* w)
+{
+    return w ? w->context : g_main_context_default();
+}
+
+gboolean
+ctn_worker_is_current(CtnWorker* w)
+{
+    return g_main_context_is_owner( ctn_worker_get_context( w ) );
+}
+
+void
+ctn_worker_idle_add(CtnWorker* w,
+        GSourceFunc func,
+        gpointer data)
+{
+    GSource* source = g_idle_source_new();
+    g_source_set_priority( source, G_PRIORITY_DEFAULT );
+    g_source_set_callback( source, func, data, NULL );
+    g_source_attach( source, ctn_worker_get_context( w ) );
+    g_source_unref( source );
+}
+
+void
+ctn_worker_invoke(CtnWorker* w,
+        GSourceFunc func,
+        gpointer data)
+{
+    if( ctn_worker_is_current( w ) ) {
+        func( data );
+    } else {
+        ctn_worker_idle_add( w, func, data );
+    }
+}
+
+GSource*
+ctn_worker_timeout_add(CtnWorker* w,
+        guint interval,
+        GSourceFunc func,
+        gpointer data)
+{
+    GSource* source = g_timeout_source_new( interval );
+    g_source_set_callback( source, func, data, NULL );
+    g_source_attach( source, ctn_worker_get_context( w ) );
+    return source;
+}
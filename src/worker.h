@@ -0,0 +1,58 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A thread running its own GMainContext. Everything queued with
+ * ctn_worker_invoke or started from inside the worker (GUsb transfers,
+ * timeouts) completes on that thread. A NULL worker means the default
+ * main context, so callers don't need two code paths. */
+typedef struct _CtnWorker CtnWorker;
+
+CtnWorker*
+ctn_worker_new (const gchar *name);
+
+/* another owner for a shared worker, each one releases it */
+CtnWorker*
+ctn_worker_ref (CtnWorker *worker);
+
+/* the last release stops the loop, the thread exits by itself once it is
+ * done dispatching */
+void
+ctn_worker_release (CtnWorker *worker);
+
+/* renices the worker thread, negative values need CAP_SYS_NICE */
+void
+ctn_worker_set_nice (CtnWorker *worker,
+        gint nice);
+
+GMainContext*
+ctn_worker_get_context (CtnWorker *worker);
+
+gboolean
+ctn_worker_is_current (CtnWorker *worker);
+
+/* run func on the worker, directly when already there, otherwise queued */
+void
+ctn_worker_invoke (CtnWorker *worker,
+        GSourceFunc func,
+        gpointer data);
+
+/* always queued, even when called from the worker itself */
+void
+ctn_worker_idle_add (CtnWorker *worker,
+        GSourceFunc func,
+        gpointer data);
+
+/* returns a ref to the source, destroy and unref it to cancel */
+GSource*
+ctn_worker_timeout_add (CtnWorker *worker,
+        guint interval,
+        GSourceFunc func,
+        gpointer data);
+
+G_END_DECLS
+
+#endif